@@ -1,19 +1,124 @@
+#ifdef __linux__
+#define _GNU_SOURCE  /* CPU affinity */
+#endif
 #define _POSIX_C_SOURCE 200809L
 #include "xsalsa.h"
+#include "xsalsa_impl_check.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
 
 #ifdef _WIN32
 #include <windows.h>
 #else
 #include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#ifdef XSALSA_ARCH_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
 #endif
 
 #define BENCH_SIZE_MB 100
 #define BENCH_SECONDS 3
 
+/* Matrix mode defaults */
+#define MATRIX_MAX_SIZE (1UL << 30)
+#define MATRIX_SECONDS 0.1
+
+/* Latency mode defaults */
+#define LATENCY_SAMPLES 100000
+#define LATENCY_COLD_SAMPLES 250
+#define LATENCY_EVICT_SIZE (32UL << 20)
+
+/* Scaling mode defaults */
+#define SCALING_SIZE (64UL << 10)
+#define SCALING_SECONDS 1.0
+#define SCALING_MAX_CPUS 1024
+
+/* Histogram: 2^HIST_SUB_BITS linear sub-buckets per power of two (about 3% resolution) */
+#define HIST_SUB_BITS 5
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (60 * HIST_SUB)
+
+/* Regression gate (--gate) */
+#define GATE_SECONDS 0.02
+#define GATE_REPS 5
+#define GATE_RETRIES 3      /* re-measurements before a slowdown counts as a regression */
+#define GATE_THRESHOLD 25.0
+#define GATE_MAX_ENTRIES 64
+
+/* Hardware counters (--perf) */
+#define PERF_CYCLES 0
+#define PERF_INSTRUCTIONS 1
+#define PERF_L1D_MISSES 2
+#define PERF_LLC_MISSES 3
+#define PERF_COUNTERS 4
+
+/* Output formats */
+#define FORMAT_TEXT 0
+#define FORMAT_CSV 1
+#define FORMAT_JSON 2
+
+typedef struct {
+    const char *name;
+    int impl;
+    bool (*available)(void);
+} bench_impl_t;
+
+static const bench_impl_t impls[] = {
+    #ifdef XSALSA_USE_IMPL_SCALAR
+    { "scalar", XSALSA_IMPL_SCALAR, NULL },
+    #endif
+    #ifdef XSALSA_USE_IMPL_AVX
+    { "avx", XSALSA_IMPL_AVX, check_avx_support },
+    #endif
+    #ifdef XSALSA_USE_IMPL_AVX2
+    { "avx2", XSALSA_IMPL_AVX2, check_avx2_support },
+    #endif
+    #ifdef XSALSA_USE_IMPL_AVX512
+    { "avx512", XSALSA_IMPL_AVX512, check_avx512_support },
+    #endif
+    #ifdef XSALSA_USE_IMPL_AVX512VL
+    { "avx512vl", XSALSA_IMPL_AVX512VL, check_avx512vl_support },
+    #endif
+};
+
+#define NUM_IMPLS (sizeof(impls) / sizeof(impls[0]))
+
+/* Message sizes swept by the matrix (capped by --max-size) */
+static const unsigned long matrix_sizes[] = {
+    1, 16, 64, 256, 1UL << 10, 4UL << 10, 16UL << 10, 64UL << 10, 256UL << 10,
+    1UL << 20, 16UL << 20, 256UL << 20, 1UL << 30
+};
+
+/* Byte offsets from a 64-byte aligned buffer */
+static const unsigned long matrix_aligns[] = { 0, 1, 32 };
+
+/* Fixed workload of the regression gate */
+static const unsigned long gate_sizes[] = { 64, 1UL << 10, 16UL << 10, 1UL << 20 };
+
+/* Packet sizes for the latency mode */
+static const unsigned long latency_sizes[] = { 64, 256, 576, 1500 };
+
+/* Percentiles reported by the latency mode */
+static const double latency_pcts[] = { 50.0, 90.0, 99.0, 99.9 };
+
 static void fill_random(unsigned char *buf, size_t len) {
     for (size_t i = 0; i < len; ++i)
         buf[i] = (unsigned char)(rand() & 0xFF);
@@ -38,9 +143,1107 @@ static double get_time_sec(void) {
 static double timespec_to_sec(const struct timespec *start, const struct timespec *end) {
     return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
 }
+
+static double get_time_sec(void) {
+    static struct timespec start = {0, 0};
+    struct timespec now;
+
+    if (start.tv_sec == 0 && start.tv_nsec == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        return 0.0;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return timespec_to_sec(&start, &now);
+}
+#endif
+
+/* Time-stamp counter (reference cycles); 0 where there is none */
+static uint64_t read_tsc(void) {
+#ifdef XSALSA_ARCH_X86
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/* Hardware counter group around a measured region. Any counter the kernel
+   refuses (no perf_event_open in a container, paranoid setting, no PMU in a
+   VM) is left closed and reported as unavailable. */
+typedef struct {
+    int fd[PERF_COUNTERS];
+    uint64_t base[PERF_COUNTERS][3]; /* value, time enabled, time running at perf_start */
+    bool open;                /* At least the cycles leader is counting */
+} perf_t;
+
+typedef struct {
+    double value[PERF_COUNTERS];
+    bool valid[PERF_COUNTERS];
+    double seconds;           /* Time the group was enabled */
+} perf_sample_t;
+
+#ifdef __linux__
+static int perf_open_one(uint32_t type, uint64_t config, int group) {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = group == -1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+#endif
+
+static bool perf_open(perf_t *p) {
+    int i;
+
+    for (i = 0; i < PERF_COUNTERS; i++) p->fd[i] = -1;
+    p->open = false;
+#ifdef __linux__
+    p->fd[PERF_CYCLES] = perf_open_one(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1);
+    if (p->fd[PERF_CYCLES] < 0) return false;
+    p->fd[PERF_INSTRUCTIONS] = perf_open_one(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, p->fd[PERF_CYCLES]);
+    p->fd[PERF_L1D_MISSES] = perf_open_one(PERF_TYPE_HW_CACHE,
+                                           PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                           (PERF_COUNT_HW_CACHE_RESULT_MISS << 16), p->fd[PERF_CYCLES]);
+    p->fd[PERF_LLC_MISSES] = perf_open_one(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, p->fd[PERF_CYCLES]);
+    p->open = true;
+#endif
+    return p->open;
+}
+
+/* Counts and enabled/running times only ever grow, so a region is the difference of two reads */
+static bool perf_read(int fd, uint64_t v[3]) {
+#ifdef __linux__
+    return fd >= 0 && read(fd, v, 3 * sizeof(uint64_t)) == (ssize_t)(3 * sizeof(uint64_t));
+#else
+    (void)fd;
+    (void)v;
+    return false;
+#endif
+}
+
+static void perf_start(perf_t *p) {
+#ifdef __linux__
+    int i;
+
+    if (!p->open) return;
+    for (i = 0; i < PERF_COUNTERS; i++) {
+        if (!perf_read(p->fd[i], p->base[i])) memset(p->base[i], 0, sizeof(p->base[i]));
+    }
+    ioctl(p->fd[PERF_CYCLES], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#else
+    (void)p;
+#endif
+}
+
+static void perf_stop(perf_t *p, perf_sample_t *out) {
+    int i;
+
+    memset(out, 0, sizeof(*out));
+#ifdef __linux__
+    if (!p->open) return;
+    ioctl(p->fd[PERF_CYCLES], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    for (i = 0; i < PERF_COUNTERS; i++) {
+        uint64_t v[3];
+
+        if (!perf_read(p->fd[i], v)) continue;
+        v[0] -= p->base[i][0];
+        v[1] -= p->base[i][1];
+        v[2] -= p->base[i][2];
+        if (v[2] == 0) continue;
+        /* Scale up if the PMU multiplexed the group */
+        out->value[i] = (double)v[0] * ((double)v[1] / (double)v[2]);
+        out->valid[i] = true;
+        if (i == PERF_CYCLES) out->seconds = (double)v[1] / 1e9;
+    }
+#else
+    (void)p;
+    (void)i;
+#endif
+}
+
+static void perf_close(perf_t *p) {
+    int i;
+
+    for (i = 0; i < PERF_COUNTERS; i++) {
+#ifdef __linux__
+        if (p->fd[i] >= 0) close(p->fd[i]);
+#endif
+        p->fd[i] = -1;
+    }
+    p->open = false;
+}
+
+/* Counter columns: cycles, instructions, IPC, L1D and LLC misses per KB, effective GHz */
+static void perf_print(int format, const perf_sample_t *ps, double bytes) {
+    const bool *ok = ps->valid;
+    const double *v = ps->value;
+    double kb = bytes / 1024.0;
+
+    if (format == FORMAT_CSV) {
+        if (ok[PERF_CYCLES]) printf(",%.0f", v[PERF_CYCLES]); else printf(",");
+        if (ok[PERF_INSTRUCTIONS]) printf(",%.0f", v[PERF_INSTRUCTIONS]); else printf(",");
+        if (ok[PERF_CYCLES] && ok[PERF_INSTRUCTIONS]) printf(",%.3f", v[PERF_INSTRUCTIONS] / v[PERF_CYCLES]); else printf(",");
+        if (ok[PERF_L1D_MISSES]) printf(",%.3f", v[PERF_L1D_MISSES] / kb); else printf(",");
+        if (ok[PERF_LLC_MISSES]) printf(",%.3f", v[PERF_LLC_MISSES] / kb); else printf(",");
+        if (ok[PERF_CYCLES] && ps->seconds > 0.0) printf(",%.3f", v[PERF_CYCLES] / ps->seconds / 1e9); else printf(",");
+    } else if (format == FORMAT_JSON) {
+        printf(", \"cycles\": ");
+        if (ok[PERF_CYCLES]) printf("%.0f", v[PERF_CYCLES]); else printf("null");
+        printf(", \"instructions\": ");
+        if (ok[PERF_INSTRUCTIONS]) printf("%.0f", v[PERF_INSTRUCTIONS]); else printf("null");
+        printf(", \"ipc\": ");
+        if (ok[PERF_CYCLES] && ok[PERF_INSTRUCTIONS]) printf("%.3f", v[PERF_INSTRUCTIONS] / v[PERF_CYCLES]); else printf("null");
+        printf(", \"l1d_misses_per_kb\": ");
+        if (ok[PERF_L1D_MISSES]) printf("%.3f", v[PERF_L1D_MISSES] / kb); else printf("null");
+        printf(", \"llc_misses_per_kb\": ");
+        if (ok[PERF_LLC_MISSES]) printf("%.3f", v[PERF_LLC_MISSES] / kb); else printf("null");
+        printf(", \"ghz\": ");
+        if (ok[PERF_CYCLES] && ps->seconds > 0.0) printf("%.3f", v[PERF_CYCLES] / ps->seconds / 1e9); else printf("null");
+    } else {
+        if (ok[PERF_CYCLES]) printf(" %14.0f", v[PERF_CYCLES]); else printf(" %14s", "n/a");
+        if (ok[PERF_INSTRUCTIONS]) printf(" %14.0f", v[PERF_INSTRUCTIONS]); else printf(" %14s", "n/a");
+        if (ok[PERF_CYCLES] && ok[PERF_INSTRUCTIONS]) printf(" %5.2f", v[PERF_INSTRUCTIONS] / v[PERF_CYCLES]); else printf(" %5s", "n/a");
+        if (ok[PERF_L1D_MISSES]) printf(" %9.2f", v[PERF_L1D_MISSES] / kb); else printf(" %9s", "n/a");
+        if (ok[PERF_LLC_MISSES]) printf(" %9.2f", v[PERF_LLC_MISSES] / kb); else printf(" %9s", "n/a");
+        if (ok[PERF_CYCLES] && ps->seconds > 0.0) printf(" %6.2f", v[PERF_CYCLES] / ps->seconds / 1e9); else printf(" %6s", "n/a");
+    }
+}
+
+static const char perf_csv_header[] = ",cycles,instructions,ipc,l1d_misses_per_kb,llc_misses_per_kb,ghz";
+
+static void perf_text_header(void) {
+    printf(" %14s %14s %5s %9s %9s %6s", "cycles", "instructions", "IPC", "L1Dmiss/KB", "LLCmiss/KB", "GHz");
+}
+
+static bool impl_available(const bench_impl_t *impl) {
+    return impl->available == NULL || impl->available();
+}
+
+/* 64-byte aligned buffer; *base receives the pointer to free */
+static unsigned char *alloc_aligned(size_t len, void **base) {
+    unsigned char *p = malloc(len + 64);
+    *base = p;
+    if (p == NULL) return NULL;
+    return p + ((64 - ((uintptr_t)p & 63)) & 63);
+}
+
+typedef struct {
+    double seconds;
+    double bytes;
+    uint64_t cycles;
+    perf_sample_t perf;
+} bench_result_t;
+
+/* Repeat xsalsa20_crypt of len bytes for at least min_sec, counting events when perf is set */
+static int bench_crypt(xsalsa20_state *st, const unsigned char *in, unsigned char *out,
+                       unsigned long len, double min_sec, perf_t *perf, bench_result_t *res) {
+    unsigned long batch = len >= (64UL << 10) ? 1 : (64UL << 10) / len;
+    unsigned long i, calls = 0;
+    double t0, t1;
+    uint64_t c0;
+
+    if (perf != NULL) perf_start(perf);
+    t0 = get_time_sec();
+    c0 = read_tsc();
+    do {
+        for (i = 0; i < batch; i++) {
+            if (xsalsa20_crypt(st, in, len, out) != XSALSA_OK) return XSALSA_ERROR;
+        }
+        calls += batch;
+        t1 = get_time_sec();
+    } while (t1 - t0 < min_sec);
+
+    res->cycles = read_tsc() - c0;
+    if (perf != NULL) perf_stop(perf, &res->perf);
+    res->seconds = t1 - t0;
+    res->bytes = (double)calls * len;
+    return XSALSA_OK;
+}
+
+static void print_size(char *buf, size_t buflen, unsigned long size) {
+    if (size >= (1UL << 30) && size % (1UL << 30) == 0) snprintf(buf, buflen, "%luG", size >> 30);
+    else if (size >= (1UL << 20) && size % (1UL << 20) == 0) snprintf(buf, buflen, "%luM", size >> 20);
+    else if (size >= (1UL << 10) && size % (1UL << 10) == 0) snprintf(buf, buflen, "%luK", size >> 10);
+    else snprintf(buf, buflen, "%lu", size);
+}
+
+/* Sizes x implementations x alignment x in-place sweep */
+static int run_matrix(int format, unsigned long max_size, double min_sec, perf_t *perf) {
+    unsigned char key[32], nonce[24];
+    unsigned char *inbuf, *outbuf;
+    void *inbase, *outbase;
+    size_t n, a, i, ip;
+    int records = 0;
+
+    fill_random(key, 32);
+    fill_random(nonce, 24);
+
+    /* Fall back to smaller buffers when the host cannot hold two of max_size */
+    for (;;) {
+        inbuf = alloc_aligned(max_size + 64, &inbase);
+        outbuf = alloc_aligned(max_size + 64, &outbase);
+        if (inbuf != NULL && outbuf != NULL) break;
+        free(inbase);
+        free(outbase);
+        if (max_size <= 1) {
+            fprintf(stderr, "Memory allocation failed\n");
+            return 1;
+        }
+        max_size /= 2;
+        fprintf(stderr, "Reducing maximum size to %lu bytes\n", max_size);
+    }
+    fill_random(inbuf, max_size + 64);
+    memset(outbuf, 0, max_size + 64);
+
+    if (format == FORMAT_CSV) {
+        printf("impl,size,align,inplace,seconds,gbps,cycles_per_byte%s\n", perf ? perf_csv_header : "");
+    } else if (format == FORMAT_JSON) {
+        printf("[\n");
+    } else {
+        printf("%-9s %6s %5s %-8s %10s %9s", "impl", "size", "align", "mode", "GB/s", "cyc/B");
+        if (perf) perf_text_header();
+        printf("\n");
+    }
+
+    for (i = 0; i < NUM_IMPLS; i++) {
+        if (!impl_available(&impls[i])) {
+            fprintf(stderr, "Skipping %s (not available)\n", impls[i].name);
+            continue;
+        }
+        xsalsa20_force_impl(impls[i].impl);
+
+        for (n = 0; n < sizeof(matrix_sizes) / sizeof(matrix_sizes[0]); n++) {
+            unsigned long size = matrix_sizes[n];
+            if (size > max_size) break;
+
+            for (a = 0; a < sizeof(matrix_aligns) / sizeof(matrix_aligns[0]); a++) {
+                for (ip = 0; ip < 2; ip++) {
+                    unsigned long align = matrix_aligns[a];
+                    unsigned char *out = outbuf + align;
+                    const unsigned char *in = ip ? out : inbuf + align;
+                    bench_result_t res;
+                    xsalsa20_state st;
+                    double gbps, cpb;
+                    char sz[24];
+
+                    if (xsalsa20_setup(&st, key, 32, nonce, 24, 20) != XSALSA_OK ||
+                        bench_crypt(&st, in, out, size, min_sec, perf, &res) != XSALSA_OK) {
+                        fprintf(stderr, "XSalsa20 encrypt failed\n");
+                        return 1;
+                    }
+                    xsalsa20_done(&st);
+
+                    gbps = res.bytes / res.seconds / 1e9;
+                    cpb = res.cycles ? (double)res.cycles / res.bytes : 0.0;
+
+                    if (format == FORMAT_CSV) {
+                        printf("%s,%lu,%lu,%d,%.6f,%.4f,", impls[i].name, size, align, (int)ip, res.seconds, gbps);
+                        if (res.cycles) printf("%.4f", cpb);
+                        if (perf) perf_print(format, &res.perf, res.bytes);
+                        printf("\n");
+                    } else if (format == FORMAT_JSON) {
+                        printf("%s  {\"impl\": \"%s\", \"size\": %lu, \"align\": %lu, \"inplace\": %s, "
+                               "\"seconds\": %.6f, \"gbps\": %.4f, \"cycles_per_byte\": ",
+                               records ? ",\n" : "", impls[i].name, size, align, ip ? "true" : "false",
+                               res.seconds, gbps);
+                        if (res.cycles) printf("%.4f", cpb); else printf("null");
+                        if (perf) perf_print(format, &res.perf, res.bytes);
+                        printf("}");
+                    } else {
+                        print_size(sz, sizeof(sz), size);
+                        printf("%-9s %6s %5lu %-8s %10.3f ", impls[i].name, sz, align, ip ? "inplace" : "copy", gbps);
+                        if (res.cycles) printf("%9.3f", cpb); else printf("%9s", "n/a");
+                        if (perf) perf_print(format, &res.perf, res.bytes);
+                        printf("\n");
+                    }
+                    fflush(stdout);
+                    records++;
+                }
+            }
+        }
+    }
+
+    if (format == FORMAT_JSON) {
+        printf("\n]\n");
+    }
+
+    free(inbase);
+    free(outbase);
+    return 0;
+}
+
+typedef struct {
+    uint64_t count[HIST_BUCKETS];
+    uint64_t total;
+} hist_t;
+
+static unsigned int hist_index(uint64_t v) {
+    unsigned int msb = 0;
+    uint64_t x = v;
+
+    if (v < HIST_SUB) return (unsigned int)v;
+    while (x >>= 1) msb++;
+    return (msb - HIST_SUB_BITS + 1) * HIST_SUB + (unsigned int)((v >> (msb - HIST_SUB_BITS)) - HIST_SUB);
+}
+
+/* Smallest value that falls into bucket idx */
+static uint64_t hist_value(unsigned int idx) {
+    unsigned int major = idx / HIST_SUB, sub = idx % HIST_SUB;
+    return major == 0 ? sub : (uint64_t)(sub + HIST_SUB) << (major - 1);
+}
+
+static void hist_add(hist_t *h, uint64_t v) {
+    unsigned int idx = hist_index(v);
+    if (idx >= HIST_BUCKETS) idx = HIST_BUCKETS - 1;
+    h->count[idx]++;
+    h->total++;
+}
+
+static uint64_t hist_percentile(const hist_t *h, double pct) {
+    uint64_t want = (uint64_t)(pct / 100.0 * (double)h->total + 0.5), seen = 0;
+    unsigned int i;
+
+    if (want == 0) want = 1;
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->count[i];
+        if (seen >= want) return hist_value(i);
+    }
+    return hist_value(HIST_BUCKETS - 1);
+}
+
+/* Latency ticks: the time-stamp counter where available, nanoseconds otherwise */
+static uint64_t read_ticks(void) {
+#ifdef XSALSA_ARCH_X86
+    return __rdtsc();
+#else
+    return (uint64_t)(get_time_sec() * 1e9);
+#endif
+}
+
+static double ticks_per_ns(void) {
+#ifdef XSALSA_ARCH_X86
+    double t0 = get_time_sec(), t1;
+    uint64_t c0 = read_tsc();
+
+    do {
+        t1 = get_time_sec();
+    } while (t1 - t0 < 0.1);
+    return (double)(read_tsc() - c0) / ((t1 - t0) * 1e9);
+#else
+    return 1.0;
+#endif
+}
+
+/* Walk a buffer larger than the caches so the next message starts cold */
+static void evict_caches(unsigned char *buf, size_t len) {
+    size_t i;
+    for (i = 0; i < len; i += 64) buf[i]++;
+}
+
+static void print_latency(int format, int *records, const char *impl, unsigned long size, bool cold,
+                          const char *phase, const hist_t *h, double tpn) {
+    size_t p;
+
+    if (format == FORMAT_CSV) {
+        printf("%s,%lu,%s,%s,%llu", impl, size, cold ? "cold" : "warm", phase, (unsigned long long)h->total);
+        for (p = 0; p < sizeof(latency_pcts) / sizeof(latency_pcts[0]); p++) {
+            printf(",%.1f", hist_percentile(h, latency_pcts[p]) / tpn);
+        }
+        printf("\n");
+    } else if (format == FORMAT_JSON) {
+        printf("%s  {\"impl\": \"%s\", \"size\": %lu, \"cache\": \"%s\", \"phase\": \"%s\", \"samples\": %llu",
+               *records ? ",\n" : "", impl, size, cold ? "cold" : "warm", phase, (unsigned long long)h->total);
+        printf(", \"p50_ns\": %.1f, \"p90_ns\": %.1f, \"p99_ns\": %.1f, \"p999_ns\": %.1f}",
+               hist_percentile(h, 50.0) / tpn, hist_percentile(h, 90.0) / tpn,
+               hist_percentile(h, 99.0) / tpn, hist_percentile(h, 99.9) / tpn);
+    } else {
+        printf("%-9s %5lu %-5s %-6s", impl, size, cold ? "cold" : "warm", phase);
+        for (p = 0; p < sizeof(latency_pcts) / sizeof(latency_pcts[0]); p++) {
+            printf(" %9.1f", hist_percentile(h, latency_pcts[p]) / tpn);
+        }
+        printf("\n");
+    }
+    (*records)++;
+}
+
+/* Per-message setup+crypt+done latency at packet sizes, warm and cold cache */
+static int run_latency(int format, unsigned long samples) {
+    static hist_t h_setup, h_crypt, h_total;
+    unsigned char key[32], nonce[24], in[1500], out[1500];
+    unsigned char *evict;
+    double tpn = ticks_per_ns();
+    size_t i, n, c;
+    int records = 0;
+
+    evict = malloc(LATENCY_EVICT_SIZE);
+    if (evict == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return 1;
+    }
+    memset(evict, 0, LATENCY_EVICT_SIZE);
+    fill_random(key, 32);
+    fill_random(nonce, 24);
+    fill_random(in, sizeof(in));
+
+    if (format == FORMAT_CSV) {
+        printf("impl,size,cache,phase,samples,p50_ns,p90_ns,p99_ns,p999_ns\n");
+    } else if (format == FORMAT_JSON) {
+        printf("[\n");
+    } else {
+        printf("%-9s %5s %-5s %-6s %9s %9s %9s %9s  (ns)\n", "impl", "size", "cache", "phase", "p50", "p90", "p99", "p99.9");
+    }
+
+    /* "auto" is the default runtime dispatch, the others are forced */
+    for (i = 0; i <= NUM_IMPLS; i++) {
+        const char *name = i == 0 ? "auto" : impls[i - 1].name;
+
+        if (i == 0) {
+            xsalsa20_set_impl_policy(XSALSA_POLICY_THROUGHPUT | XSALSA_POLICY_ADAPTIVE);
+            xsalsa20_get_size_class_impl(0);  /* keep the one-off calibration out of the samples */
+        } else if (!impl_available(&impls[i - 1])) {
+            fprintf(stderr, "Skipping %s (not available)\n", name);
+            continue;
+        } else {
+            xsalsa20_force_impl(impls[i - 1].impl);
+        }
+
+        for (n = 0; n < sizeof(latency_sizes) / sizeof(latency_sizes[0]); n++) {
+            for (c = 0; c < 2; c++) {
+                unsigned long count = c ? LATENCY_COLD_SAMPLES : samples;
+                unsigned long k;
+
+                memset(&h_setup, 0, sizeof(h_setup));
+                memset(&h_crypt, 0, sizeof(h_crypt));
+                memset(&h_total, 0, sizeof(h_total));
+
+                for (k = 0; k < count; k++) {
+                    xsalsa20_state st;
+                    uint64_t t0, t1, t2, t3;
+                    int err;
+
+                    /* A fresh nonce per message, as for real packets */
+                    nonce[0] = (unsigned char)k;
+                    nonce[1] = (unsigned char)(k >> 8);
+                    if (c) evict_caches(evict, LATENCY_EVICT_SIZE);
+
+                    t0 = read_ticks();
+                    err = xsalsa20_setup(&st, key, 32, nonce, 24, 20);
+                    t1 = read_ticks();
+                    err |= xsalsa20_crypt(&st, in, latency_sizes[n], out);
+                    t2 = read_ticks();
+                    xsalsa20_done(&st);
+                    t3 = read_ticks();
+                    if (err != XSALSA_OK) {
+                        fprintf(stderr, "XSalsa20 encrypt failed\n");
+                        free(evict);
+                        return 1;
+                    }
+
+                    hist_add(&h_setup, t1 - t0);
+                    hist_add(&h_crypt, t2 - t1);
+                    hist_add(&h_total, t3 - t0);
+                }
+
+                print_latency(format, &records, name, latency_sizes[n], c != 0, "setup", &h_setup, tpn);
+                print_latency(format, &records, name, latency_sizes[n], c != 0, "crypt", &h_crypt, tpn);
+                print_latency(format, &records, name, latency_sizes[n], c != 0, "total", &h_total, tpn);
+                fflush(stdout);
+            }
+        }
+    }
+
+    if (format == FORMAT_JSON) {
+        printf("\n]\n");
+    }
+
+    free(evict);
+    return 0;
+}
+
+static unsigned int online_cpus(void) {
+#ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return (unsigned int)si.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (unsigned int)n : 1;
+#endif
+}
+
+/* Logical CPUs this process may run on, one-per-core (smt = 0) or with all
+   SMT siblings of a core next to each other (smt = 1). Returns the count;
+   *pinned is false when the CPUs cannot be pinned on this platform. */
+#ifdef __linux__
+static int sibling_list(int cpu, int *list, int max) {
+    char path[96];
+    int n = 0, a, b;
+    FILE *f;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+    if ((f = fopen(path, "r")) == NULL) {
+        list[0] = cpu;
+        return 1;
+    }
+    while (n < max && fscanf(f, "%d", &a) == 1) {
+        b = a;
+        if (fscanf(f, "-%d", &b) != 1) b = a;
+        for (; a <= b && n < max; a++) list[n++] = a;
+        if (fgetc(f) != ',') break;
+    }
+    fclose(f);
+    if (n == 0) list[n++] = cpu;
+    return n;
+}
+
+static int cpu_layout(int smt, int *cpus, int max, bool *pinned, bool *has_smt) {
+    int sib[64], nsib, cpu, j, first, n = 0;
+    cpu_set_t set;
+
+    *pinned = true;
+    *has_smt = false;
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+        *pinned = false;
+        for (cpu = 0; cpu < (int)online_cpus() && n < max; cpu++) cpus[n++] = cpu;
+        return n;
+    }
+
+    for (cpu = 0; cpu < CPU_SETSIZE && n < max; cpu++) {
+        if (!CPU_ISSET(cpu, &set)) continue;
+        nsib = sibling_list(cpu, sib, 64);
+
+        /* A core is visited through its lowest allowed sibling */
+        for (first = -1, j = 0; j < nsib; j++) {
+            if (sib[j] < CPU_SETSIZE && CPU_ISSET(sib[j], &set)) {
+                if (first == -1) first = sib[j];
+                if (sib[j] != cpu) *has_smt = true;
+            }
+        }
+        if (first != cpu) continue;
+
+        for (j = 0; j < nsib && n < max; j++) {
+            if (sib[j] < CPU_SETSIZE && CPU_ISSET(sib[j], &set) && (smt || sib[j] == cpu)) {
+                cpus[n++] = sib[j];
+            }
+        }
+    }
+    return n;
+}
+#elif defined(_WIN32)
+static int cpu_layout(int smt, int *cpus, int max, bool *pinned, bool *has_smt) {
+    SYSTEM_LOGICAL_PROCESSOR_INFORMATION info[256];
+    DWORD len = sizeof(info), i, k;
+    int bit, n = 0;
+
+    *pinned = true;
+    *has_smt = false;
+    if (!GetLogicalProcessorInformation(info, &len)) {
+        *pinned = false;
+        for (n = 0; n < (int)online_cpus() && n < max; n++) cpus[n] = n;
+        return n;
+    }
+
+    for (i = 0; i < len / sizeof(info[0]); i++) {
+        if (info[i].Relationship != RelationProcessorCore) continue;
+        for (k = 0, bit = 0; bit < (int)(8 * sizeof(ULONG_PTR)) && n < max; bit++) {
+            if (!(info[i].ProcessorMask & ((ULONG_PTR)1 << bit))) continue;
+            if (k++ > 0) *has_smt = true;
+            if (k == 1 || smt) cpus[n++] = bit;
+        }
+    }
+    return n;
+}
+#else
+static int cpu_layout(int smt, int *cpus, int max, bool *pinned, bool *has_smt) {
+    int n;
+
+    (void)smt;
+    *pinned = false;
+    *has_smt = false;
+    for (n = 0; n < (int)online_cpus() && n < max; n++) cpus[n] = n;
+    return n;
+}
+#endif
+
+typedef struct {
+    int cpu;                  /* Logical CPU to run on, -1 = not pinned */
+    unsigned long size;       /* Bytes per xsalsa20_crypt call */
+    double seconds;
+    double bytes;
+    int err;
+} scale_worker_t;
+
+/* Start and stop flags shared by all workers of a run: set with a release store by
+   scale_run, polled with acquire loads by the workers */
+static int scale_go = 0;
+static int scale_stop = 0;
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#define load_acquire(p)     InterlockedCompareExchange((volatile LONG *)(p), 0, 0)
+#define store_release(p, v) InterlockedExchange((volatile LONG *)(p), (v))
+#else
+#define load_acquire(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#endif
+
+/* Spin-wait hint, so waiting workers leave the core (and its SMT sibling) alone */
+#ifdef XSALSA_ARCH_X86
+#define spin_pause() _mm_pause()
+#else
+#define spin_pause() ((void)0)
+#endif
+
+#ifdef _WIN32
+static DWORD WINAPI scale_thread(LPVOID arg)
+#else
+static void *scale_thread(void *arg)
+#endif
+{
+    scale_worker_t *w = arg;
+    unsigned char key[32] = { 1 }, nonce[24] = { 2 };
+    unsigned char *inbuf = NULL, *outbuf = NULL;
+    void *inbase, *outbase;
+    xsalsa20_state st;
+    double t0, t1;
+    double bytes = 0.0;
+
+    if (w->cpu >= 0) {
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(w->cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#elif defined(_WIN32)
+        SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << w->cpu);
+#endif
+    }
+
+    /* Allocated and touched after pinning, so the pages are local to the core */
+    inbuf = alloc_aligned(w->size, &inbase);
+    outbuf = alloc_aligned(w->size, &outbase);
+    if (inbuf == NULL || outbuf == NULL ||
+        xsalsa20_setup(&st, key, 32, nonce, 24, 20) != XSALSA_OK) {
+        w->err = XSALSA_ERROR;
+    } else {
+        memset(inbuf, 0x5a, w->size);
+        memset(outbuf, 0, w->size);
+    }
+
+    while (!load_acquire(&scale_go)) spin_pause();
+
+    t0 = get_time_sec();
+    while (!load_acquire(&scale_stop) && w->err == XSALSA_OK) {
+        if (xsalsa20_crypt(&st, inbuf, w->size, outbuf) != XSALSA_OK) w->err = XSALSA_ERROR;
+        bytes += w->size;
+    }
+    t1 = get_time_sec();
+
+    if (inbuf != NULL && outbuf != NULL) xsalsa20_done(&st);
+    w->seconds = t1 - t0;
+    w->bytes = bytes;
+    free(inbase);
+    free(outbase);
+#ifdef _WIN32
+    return 0;
+#else
+    return NULL;
+#endif
+}
+
+static void sleep_sec(double sec) {
+#ifdef _WIN32
+    Sleep((DWORD)(sec * 1000.0));
+#else
+    struct timespec ts;
+    ts.tv_sec = (time_t)sec;
+    ts.tv_nsec = (long)((sec - (double)ts.tv_sec) * 1e9);
+    nanosleep(&ts, NULL);
+#endif
+}
+
+/* Run threads pinned workers for sec seconds */
+static int scale_run(const int *cpus, bool pinned, int threads, unsigned long size, double sec,
+                     scale_worker_t *w) {
+#ifdef _WIN32
+    HANDLE tid[SCALING_MAX_CPUS];
+#else
+    pthread_t tid[SCALING_MAX_CPUS];
+#endif
+    int k, started, err = XSALSA_OK;
+
+    store_release(&scale_go, 0);
+    store_release(&scale_stop, 0);
+    for (started = 0; started < threads; started++) {
+        w[started].cpu = pinned ? cpus[started] : -1;
+        w[started].size = size;
+        w[started].seconds = 0.0;
+        w[started].bytes = 0.0;
+        w[started].err = XSALSA_OK;
+#ifdef _WIN32
+        if ((tid[started] = CreateThread(NULL, 0, scale_thread, &w[started], 0, NULL)) == NULL) break;
+#else
+        if (pthread_create(&tid[started], NULL, scale_thread, &w[started]) != 0) break;
 #endif
+    }
+    if (started < threads) err = XSALSA_ERROR;
+
+    store_release(&scale_go, 1);
+    sleep_sec(sec);
+    store_release(&scale_stop, 1);
+
+    for (k = 0; k < started; k++) {
+#ifdef _WIN32
+        WaitForSingleObject(tid[k], INFINITE);
+        CloseHandle(tid[k]);
+#else
+        pthread_join(tid[k], NULL);
+#endif
+        if (w[k].err != XSALSA_OK) err = w[k].err;
+    }
+    return err;
+}
+
+/* 1..N pinned threads, one per physical core and with SMT siblings paired */
+static int run_scaling(int format, unsigned long size, double sec, int max_threads) {
+    static int cpus[SCALING_MAX_CPUS];
+    static scale_worker_t w[SCALING_MAX_CPUS];
+    static const char *layouts[] = { "cores", "smt" };
+    double single[NUM_IMPLS + 1] = { 0 };
+    int layout, ncpus, threads, k, records = 0;
+    bool pinned, has_smt;
+    size_t i;
+
+    if (format == FORMAT_CSV) {
+        printf("impl,layout,threads,pinned,aggregate_gbps,thread_min_gbps,thread_avg_gbps,thread_max_gbps,efficiency\n");
+    } else if (format == FORMAT_JSON) {
+        printf("[\n");
+    } else {
+        printf("%-9s %-6s %7s %10s %10s %10s %10s %6s\n", "impl", "layout", "threads",
+               "GB/s", "min/thr", "avg/thr", "max/thr", "eff");
+    }
+
+    for (layout = 0; layout < 2; layout++) {
+        ncpus = cpu_layout(layout, cpus, SCALING_MAX_CPUS, &pinned, &has_smt);
+        if (layout == 1 && !has_smt) {
+            fprintf(stderr, "Skipping smt layout (no SMT siblings available)\n");
+            continue;
+        }
+        if (!pinned) {
+            fprintf(stderr, "Thread pinning not available, threads are not pinned\n");
+        }
+        if (max_threads > 0 && max_threads < ncpus) ncpus = max_threads;
+
+        for (i = 0; i < NUM_IMPLS; i++) {
+            if (!impl_available(&impls[i])) {
+                if (layout == 0) fprintf(stderr, "Skipping %s (not available)\n", impls[i].name);
+                continue;
+            }
+            xsalsa20_force_impl(impls[i].impl);
+
+            /* Powers of two, then the full layout */
+            for (threads = 1; threads <= ncpus; threads = threads * 2 > ncpus && threads < ncpus ? ncpus : threads * 2) {
+                double agg = 0.0, tmin = 0.0, tmax = 0.0, eff;
+
+                if (scale_run(cpus, pinned, threads, size, sec, w) != XSALSA_OK) {
+                    fprintf(stderr, "XSalsa20 scaling run failed (%s, %d threads)\n", impls[i].name, threads);
+                    return 1;
+                }
+                for (k = 0; k < threads; k++) {
+                    double g = w[k].bytes / w[k].seconds / 1e9;
+                    agg += g;
+                    if (k == 0 || g < tmin) tmin = g;
+                    if (k == 0 || g > tmax) tmax = g;
+                }
+                if (layout == 0 && threads == 1) single[i] = agg;
+                eff = single[i] > 0.0 ? agg / (threads * single[i]) : 0.0;
+
+                if (format == FORMAT_CSV) {
+                    printf("%s,%s,%d,%d,%.4f,%.4f,%.4f,%.4f,%.3f\n", impls[i].name, layouts[layout], threads,
+                           pinned ? 1 : 0, agg, tmin, agg / threads, tmax, eff);
+                } else if (format == FORMAT_JSON) {
+                    printf("%s  {\"impl\": \"%s\", \"layout\": \"%s\", \"threads\": %d, \"pinned\": %s, "
+                           "\"aggregate_gbps\": %.4f, \"thread_min_gbps\": %.4f, \"thread_avg_gbps\": %.4f, "
+                           "\"thread_max_gbps\": %.4f, \"efficiency\": %.3f}",
+                           records ? ",\n" : "", impls[i].name, layouts[layout], threads, pinned ? "true" : "false",
+                           agg, tmin, agg / threads, tmax, eff);
+                } else {
+                    printf("%-9s %-6s %7d %10.3f %10.3f %10.3f %10.3f %6.2f\n", impls[i].name, layouts[layout],
+                           threads, agg, tmin, agg / threads, tmax, eff);
+                }
+                fflush(stdout);
+                records++;
+                if (threads == ncpus) break;
+            }
+        }
+    }
+
+    if (format == FORMAT_JSON) {
+        printf("\n]\n");
+    }
+    return 0;
+}
+
+/* Throughput of each forced implementation with hardware counters next to it */
+static int run_perf(int format, double sec, perf_t *perf) {
+    const size_t bufsize = BENCH_SIZE_MB * 1024 * 1024;
+    unsigned char key[32], nonce[24];
+    unsigned char *inbuf, *outbuf;
+    void *inbase, *outbase;
+    int records = 0;
+    size_t i;
+
+    inbuf = alloc_aligned(bufsize, &inbase);
+    outbuf = alloc_aligned(bufsize, &outbase);
+    if (inbuf == NULL || outbuf == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        free(inbase);
+        free(outbase);
+        return 1;
+    }
+    fill_random(key, 32);
+    fill_random(nonce, 24);
+    fill_random(inbuf, bufsize);
+    memset(outbuf, 0, bufsize);
+
+    if (format == FORMAT_CSV) {
+        printf("impl,mbps%s\n", perf_csv_header);
+    } else if (format == FORMAT_JSON) {
+        printf("[\n");
+    } else {
+        printf("%-9s %10s", "impl", "MB/s");
+        perf_text_header();
+        printf("\n");
+    }
+
+    for (i = 0; i < NUM_IMPLS; i++) {
+        bench_result_t res;
+        xsalsa20_state st;
+        double mbps;
+
+        if (!impl_available(&impls[i])) {
+            fprintf(stderr, "Skipping %s (not available)\n", impls[i].name);
+            continue;
+        }
+        xsalsa20_force_impl(impls[i].impl);
+
+        if (xsalsa20_setup(&st, key, 32, nonce, 24, 20) != XSALSA_OK ||
+            bench_crypt(&st, inbuf, outbuf, bufsize, sec, perf, &res) != XSALSA_OK) {
+            fprintf(stderr, "XSalsa20 encrypt failed\n");
+            return 1;
+        }
+        xsalsa20_done(&st);
+        mbps = res.bytes / (1024.0 * 1024.0) / res.seconds;
+
+        if (format == FORMAT_CSV) {
+            printf("%s,%.2f", impls[i].name, mbps);
+        } else if (format == FORMAT_JSON) {
+            printf("%s  {\"impl\": \"%s\", \"mbps\": %.2f", records ? ",\n" : "", impls[i].name, mbps);
+        } else {
+            printf("%-9s %10.2f", impls[i].name, mbps);
+        }
+        perf_print(format, &res.perf, res.bytes);
+        printf(format == FORMAT_JSON ? "}" : "\n");
+        fflush(stdout);
+        records++;
+    }
+
+    if (format == FORMAT_JSON) {
+        printf("\n]\n");
+    }
+
+    free(inbase);
+    free(outbase);
+    return 0;
+}
+
+typedef struct {
+    char impl[16];
+    unsigned long size;
+    double value;
+} gate_entry_t;
+
+/* Unit of the gate figures: TSC cycles/byte, or ns/byte where there is no TSC */
+static const char *gate_unit(void) {
+    return read_tsc() != 0 ? "cycles_per_byte" : "ns_per_byte";
+}
+
+/* Exit code of --gate without a usable baseline; CTest reports it as skipped (SKIP_RETURN_CODE) */
+#define GATE_SKIP 77
+
+/* Read a baseline written by gate_save; returns the entry count or -1 */
+static int gate_load(const char *path, const char *unit, gate_entry_t *e, int max) {
+    char line[256], u[32];
+    int n = 0;
+    bool unit_ok = false;
+    FILE *f;
+
+    if ((f = fopen(path, "r")) == NULL) return -1;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        const char *p = strchr(line, '"');
+        if (p == NULL) continue;
+        if (sscanf(p, "\"unit\": \"%31[^\"]\"", u) == 1) {
+            unit_ok = strcmp(u, unit) == 0;
+        } else if (n < max && sscanf(p - 1, "{\"impl\": \"%15[^\"]\", \"size\": %lu, \"value\": %lf}",
+                                     e[n].impl, &e[n].size, &e[n].value) == 3) {
+            n++;
+        }
+    }
+    fclose(f);
+    if (!unit_ok) {
+        fprintf(stderr, "Baseline %s was not recorded in %s, re-record it\n", path, unit);
+        return -1;
+    }
+    return n;
+}
+
+static int gate_save(const char *path, const char *unit, const gate_entry_t *e, int n) {
+    FILE *f;
+    int i;
+
+    if ((f = fopen(path, "w")) == NULL) {
+        fprintf(stderr, "Cannot write baseline %s\n", path);
+        return 1;
+    }
+    fprintf(f, "{\n  \"unit\": \"%s\",\n  \"results\": [\n", unit);
+    for (i = 0; i < n; i++) {
+        fprintf(f, "    {\"impl\": \"%s\", \"size\": %lu, \"value\": %.4f}%s\n",
+                e[i].impl, e[i].size, e[i].value, i + 1 < n ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    fclose(f);
+    return 0;
+}
+
+/* Best of GATE_REPS short runs of len-byte calls with impl, in gate units; negative on failure */
+static double gate_measure(int impl, const unsigned char *key, const unsigned char *nonce,
+                           const unsigned char *in, unsigned char *out, unsigned long len) {
+    double best = 0.0, v;
+    xsalsa20_state st;
+    bench_result_t res;
+    int rep;
+
+    xsalsa20_force_impl(impl);
+    for (rep = 0; rep < GATE_REPS; rep++) {
+        if (xsalsa20_setup(&st, key, 32, nonce, 24, 20) != XSALSA_OK ||
+            bench_crypt(&st, in, out, len, GATE_SECONDS, NULL, &res) != XSALSA_OK) {
+            return -1.0;
+        }
+        xsalsa20_done(&st);
+        v = res.cycles ? (double)res.cycles / res.bytes : res.seconds * 1e9 / res.bytes;
+        if (rep == 0 || v < best) best = v;
+    }
+    return best;
+}
+
+/* Measure the fixed workload, then record it as the baseline or compare against the baseline */
+static int run_gate(const char *path, bool record, double threshold) {
+    static unsigned char inbuf[1UL << 20], outbuf[1UL << 20];
+    static gate_entry_t cur[GATE_MAX_ENTRIES], base[GATE_MAX_ENTRIES];
+    static int impl_of[GATE_MAX_ENTRIES];
+    const char *unit = gate_unit();
+    unsigned char key[32], nonce[24];
+    int n = 0, nbase, i, j, tries, failed = 0;
+    size_t k, z;
+
+    /* Never record as a side effect of a comparison run: a missing baseline would make the gate pass */
+    nbase = record ? 0 : gate_load(path, unit, base, GATE_MAX_ENTRIES);
+    if (nbase < 0) {
+        printf("SKIPPED: no usable baseline at %s; record one with --gate %s --record (make bench_baseline)\n",
+               path, path);
+        return GATE_SKIP;
+    }
+
+    fill_random(key, 32);
+    fill_random(nonce, 24);
+    fill_random(inbuf, sizeof(inbuf));
+
+    for (k = 0; k < NUM_IMPLS; k++) {
+        if (!impl_available(&impls[k])) continue;
+
+        for (z = 0; z < sizeof(gate_sizes) / sizeof(gate_sizes[0]) && n < GATE_MAX_ENTRIES; z++) {
+            impl_of[n] = impls[k].impl;
+            snprintf(cur[n].impl, sizeof(cur[n].impl), "%s", impls[k].name);
+            cur[n].size = gate_sizes[z];
+            cur[n].value = gate_measure(impls[k].impl, key, nonce, inbuf, outbuf, gate_sizes[z]);
+            if (cur[n].value < 0.0) {
+                fprintf(stderr, "XSalsa20 encrypt failed\n");
+                return 1;
+            }
+            n++;
+        }
+    }
+
+    if (record) {
+        if (gate_save(path, unit, cur, n) != 0) return 1;
+        printf("Recorded %d measurements (%s) to %s\n", n, unit, path);
+        return 0;
+    }
+
+    printf("%-9s %8s %10s %10s %8s  %s (%s, threshold %.0f%%)\n", "impl", "size", "baseline", "current",
+           "change", "status", unit, threshold);
+    for (i = 0; i < n; i++) {
+        char sz[24];
+        const char *status = "new";
+        double change = 0.0;
+
+        for (j = 0; j < nbase; j++) {
+            if (strcmp(base[j].impl, cur[i].impl) == 0 && base[j].size == cur[i].size) break;
+        }
+        print_size(sz, sizeof(sz), cur[i].size);
+        if (j == nbase) {
+            printf("%-9s %8s %10s %10.3f %8s  %s\n", cur[i].impl, sz, "-", cur[i].value, "-", status);
+            continue;
+        }
+
+        /* A slowdown has to reproduce before it fails the gate, one noisy run is not enough */
+        for (tries = 0; cur[i].value > base[j].value * (1.0 + threshold / 100.0) && tries < GATE_RETRIES; tries++) {
+            double v = gate_measure(impl_of[i], key, nonce, inbuf, outbuf, cur[i].size);
+            if (v >= 0.0 && v < cur[i].value) cur[i].value = v;
+        }
+        change = (cur[i].value / base[j].value - 1.0) * 100.0;
+        status = change > threshold ? "REGRESSION" : "ok";
+        if (change > threshold) failed++;
+        printf("%-9s %8s %10.3f %10.3f %+7.1f%%  %s\n", cur[i].impl, sz, base[j].value, cur[i].value, change, status);
+    }
 
-int main(void) {
+    if (failed) {
+        printf("%d measurement(s) regressed by more than %.0f%%\n", failed, threshold);
+        return 1;
+    }
+    printf("No regressions\n");
+    return 0;
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s [mode] [options]\n", prog);
+    printf("Modes:\n");
+    printf("  (none)            %d s of %d MB xsalsa20_crypt calls, auto-selected implementation\n",
+           BENCH_SECONDS, BENCH_SIZE_MB);
+    printf("  --matrix          sizes x implementations x alignment x in-place sweep\n");
+    printf("  --latency         per-message setup+crypt+done latency percentiles, warm and cold cache\n");
+    printf("  --scaling         1..N pinned threads, one per core and with SMT siblings paired\n");
+    printf("  --perf            %d MB throughput of each implementation with hardware counters;\n", BENCH_SIZE_MB);
+    printf("                    with --matrix, adds the counters to every measurement (Linux)\n");
+    printf("  --gate FILE       compare a fixed workload against the baseline FILE, fail on regression\n");
+    printf("                    (exits with 77, skipped, when FILE is missing; see --record)\n");
+    printf("Options:\n");
+    printf("  --csv, --json     machine-readable output\n");
+    printf("  --max-size BYTES  largest message size (default %lu)\n", MATRIX_MAX_SIZE);
+    printf("  --time SECONDS    time per measurement (default %.2f, scaling %.2f)\n", MATRIX_SECONDS, SCALING_SECONDS);
+    printf("  --record          with --gate, overwrite the baseline with this run\n");
+    printf("  --threshold PCT   with --gate, allowed slowdown in percent (default %.0f)\n", GATE_THRESHOLD);
+    printf("  --samples N       warm-cache messages per latency measurement (default %d)\n", LATENCY_SAMPLES);
+    printf("  --size BYTES      bytes per call in the scaling mode (default %lu)\n", SCALING_SIZE);
+    printf("  --threads N       most threads in the scaling mode (default: every allowed CPU)\n");
+}
+
+static int run_throughput(void) {
     const size_t bufsize = BENCH_SIZE_MB * 1024 * 1024;
     unsigned char *key = malloc(32);
     unsigned char *nonce = malloc(24);
@@ -106,4 +1309,78 @@ int main(void) {
     free(inbuf);
     free(outbuf);
     return 0;
-} 
\ No newline at end of file
+}
+
+int main(int argc, char **argv) {
+    unsigned long max_size = MATRIX_MAX_SIZE;
+    double sec = 0.0;  /* 0 = the mode's default */
+    unsigned long samples = LATENCY_SAMPLES;
+    int format = FORMAT_TEXT;
+    unsigned long size = SCALING_SIZE;
+    int max_threads = 0;
+    const char *gate = NULL;
+    double threshold = GATE_THRESHOLD;
+    bool matrix = false, latency = false, scaling = false, use_perf = false, record = false;
+    perf_t perf;
+    int ret;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--matrix") == 0) {
+            matrix = true;
+        } else if (strcmp(argv[i], "--latency") == 0) {
+            latency = true;
+        } else if (strcmp(argv[i], "--scaling") == 0) {
+            scaling = true;
+        } else if (strcmp(argv[i], "--gate") == 0 && i + 1 < argc) {
+            gate = argv[++i];
+        } else if (strcmp(argv[i], "--record") == 0) {
+            record = true;
+        } else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            threshold = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--perf") == 0) {
+            use_perf = true;
+        } else if (strcmp(argv[i], "--csv") == 0) {
+            format = FORMAT_CSV;
+        } else if (strcmp(argv[i], "--json") == 0) {
+            format = FORMAT_JSON;
+        } else if (strcmp(argv[i], "--max-size") == 0 && i + 1 < argc) {
+            max_size = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--time") == 0 && i + 1 < argc) {
+            sec = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc) {
+            samples = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            size = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            max_threads = atoi(argv[++i]);
+        } else {
+            usage(argv[0]);
+            return strcmp(argv[i], "--help") == 0 ? 0 : 1;
+        }
+    }
+
+    if (gate != NULL) {
+        return run_gate(gate, record, threshold);
+    }
+    if (use_perf && !perf_open(&perf)) {
+        fprintf(stderr, "Hardware counters not available (perf_event_open failed), reporting timings only\n");
+    }
+    if (matrix) {
+        ret = run_matrix(format, max_size, sec > 0.0 ? sec : MATRIX_SECONDS, use_perf ? &perf : NULL);
+        if (use_perf) perf_close(&perf);
+        return ret;
+    }
+    if (use_perf) {
+        ret = run_perf(format, sec > 0.0 ? sec : BENCH_SECONDS, &perf);
+        perf_close(&perf);
+        return ret;
+    }
+    if (latency) {
+        return run_latency(format, samples);
+    }
+    if (scaling) {
+        return run_scaling(format, size ? size : SCALING_SIZE, sec > 0.0 ? sec : SCALING_SECONDS, max_threads);
+    }
+    return run_throughput();
+}
@@ -0,0 +1,280 @@
+#include "xsalsa.h"
+#include "xsalsa_impl_check.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Differential fuzz target: every compiled implementation encrypts the same
+ * input through the same sequence of calls, and any difference aborts.
+ *
+ * Input layout:
+ *   [0..31]   key
+ *   [32..55]  nonce
+ *   [56]      rounds selector: 2, 4, ..., 32 (counts other than 8, 12 and 20
+ *             run the generic round loop)
+ *   [57..64]  counter seed (little endian): the stream offset to seek to.
+ *             With the top bit set, the offset lands within 255 blocks
+ *             before the 32-bit block counter carries into input[9].
+ *   [65]      number of chunk sizes n (0..15)
+ *   [66]      mode: the entry point that processes the chunks
+ *               0 xsalsa20_crypt, 1 xsalsa20_keystream, 2 xsalsa20_crypt_at,
+ *               3 xsalsa20_crypt_multi (one job per chunk),
+ *               4 xsalsa20_crypt_batch (one packet per chunk, starting at
+ *                 offset 0 with the chunk index folded into the nonce)
+ *   [67..]    n little-endian 16-bit chunk sizes, used in turn
+ *   rest      data (at most FUZZ_MAX_DATA bytes)
+ *
+ * Built with libFuzzer when XSALSA_FUZZ_LIBFUZZER is defined; otherwise main()
+ * runs each file named on the command line, or stdin (for AFL).
+ */
+
+#define FUZZ_HEADER 67
+#define FUZZ_MAX_CHUNKS 15
+#define FUZZ_MAX_DATA 65536
+#define FUZZ_MAX_JOBS 16
+
+/* Modes; FUZZ_PACKETS is the reference for FUZZ_BATCH (one context per packet) */
+enum { FUZZ_CRYPT, FUZZ_KEYSTREAM, FUZZ_CRYPT_AT, FUZZ_MULTI, FUZZ_BATCH, FUZZ_MODES, FUZZ_PACKETS = FUZZ_MODES };
+
+typedef struct {
+    const char *name;
+    int impl;
+    bool (*available)(void);
+} fuzz_impl_t;
+
+static const fuzz_impl_t impls[] = {
+    #ifdef XSALSA_USE_IMPL_SCALAR
+    { "scalar", XSALSA_IMPL_SCALAR, NULL },
+    #endif
+    #ifdef XSALSA_USE_IMPL_AVX
+    { "avx", XSALSA_IMPL_AVX, check_avx_support },
+    #endif
+    #ifdef XSALSA_USE_IMPL_AVX2
+    { "avx2", XSALSA_IMPL_AVX2, check_avx2_support },
+    #endif
+    #ifdef XSALSA_USE_IMPL_AVX512
+    { "avx512", XSALSA_IMPL_AVX512, check_avx512_support },
+    #endif
+    #ifdef XSALSA_USE_IMPL_AVX512VL
+    { "avx512vl", XSALSA_IMPL_AVX512VL, check_avx512vl_support },
+    #endif
+};
+
+#define NUM_IMPLS (sizeof(impls) / sizeof(impls[0]))
+
+static unsigned char ref[FUZZ_MAX_DATA];
+static unsigned char out[FUZZ_MAX_DATA];
+
+static void fail(const char *what, const char *name, unsigned long at)
+{
+    fprintf(stderr, "xsalsa20 fuzz: %s mismatch for %s at byte %lu\n", what, name, at);
+    abort();
+}
+
+static unsigned long first_diff(const unsigned char *a, const unsigned char *b, unsigned long len)
+{
+    unsigned long i;
+    for (i = 0; i < len && a[i] == b[i]; i++) { }
+    return i;
+}
+
+/* Length of the chunk at off: the chunk sizes in turn, or everything left */
+static unsigned long next_chunk(const unsigned long *chunks, unsigned int nchunks, unsigned int *k,
+                                unsigned long off, unsigned long len)
+{
+    unsigned long n = nchunks ? chunks[(*k)++ % nchunks] : len;
+
+    if (n > len - off) n = len - off;
+    if (nchunks && *k > len + FUZZ_MAX_CHUNKS) n = len - off;  /* zero-length chunks only: finish */
+    return n;
+}
+
+/* One job per chunk, each on its own context seeked to the chunk's offset */
+static int run_multi(const unsigned char *key, const unsigned char *nonce, int rounds, ulong64 offset,
+                     const unsigned long *chunks, unsigned int nchunks,
+                     const unsigned char *data, unsigned long len, unsigned char *dst)
+{
+    xsalsa20_state st[FUZZ_MAX_JOBS];
+    xsalsa20_job jobs[FUZZ_MAX_JOBS];
+    unsigned long off = 0, n;
+    unsigned int k = 0, j, count;
+    int err = XSALSA_OK;
+
+    while (err == XSALSA_OK && off < len) {
+        for (count = 0; err == XSALSA_OK && count < FUZZ_MAX_JOBS && off < len; count++, off += n) {
+            n = next_chunk(chunks, nchunks, &k, off, len);
+            jobs[count].st = &st[count];
+            jobs[count].in = data + off;
+            jobs[count].inlen = n;
+            jobs[count].out = dst + off;
+            if ((err = xsalsa20_setup(&st[count], key, 32, nonce, 24, rounds)) == XSALSA_OK) {
+                err = xsalsa20_seek(&st[count], offset + off);
+            }
+        }
+        if (err == XSALSA_OK) err = xsalsa20_crypt_multi(jobs, count);
+        for (j = 0; j < count; j++) xsalsa20_done(&st[j]);
+    }
+    return err;
+}
+
+/* One packet per chunk from offset 0, through xsalsa20_crypt_batch or one context each */
+static int run_packets(int mode, const unsigned char *key, const unsigned char *nonce, int rounds,
+                       const unsigned long *chunks, unsigned int nchunks,
+                       const unsigned char *data, unsigned long len, unsigned char *dst)
+{
+    unsigned char nonces[FUZZ_MAX_JOBS * 24];
+    const unsigned char *in[FUZZ_MAX_JOBS];
+    unsigned char *out_of[FUZZ_MAX_JOBS];
+    unsigned long inlen[FUZZ_MAX_JOBS];
+    xsalsa20_state st;
+    unsigned long off = 0, n, idx = 0;
+    unsigned int k = 0, j, count;
+    int err = XSALSA_OK;
+
+    while (err == XSALSA_OK && off < len) {
+        for (count = 0; count < FUZZ_MAX_JOBS && off < len; count++, idx++, off += n) {
+            n = next_chunk(chunks, nchunks, &k, off, len);
+            memcpy(nonces + 24 * count, nonce, 24);
+            nonces[24 * count + 23] ^= (unsigned char)idx;
+            nonces[24 * count + 22] ^= (unsigned char)(idx >> 8);
+            in[count] = data + off;
+            inlen[count] = n;
+            out_of[count] = dst + off;
+        }
+        if (mode == FUZZ_BATCH) {
+            err = xsalsa20_crypt_batch(key, 32, nonces, 24, rounds, count, in, inlen, out_of);
+            continue;
+        }
+        for (j = 0; err == XSALSA_OK && j < count; j++) {
+            if ((err = xsalsa20_setup(&st, key, 32, nonces + 24 * j, 24, rounds)) == XSALSA_OK) {
+                err = xsalsa20_crypt(&st, in[j], inlen[j], out_of[j]);
+            }
+            xsalsa20_done(&st);
+        }
+    }
+    return err;
+}
+
+/* Run one implementation over the chunk sequence in the given mode; returns the first error code */
+static int run_chunks(int mode, const unsigned char *key, const unsigned char *nonce, int rounds, ulong64 offset,
+                      const unsigned long *chunks, unsigned int nchunks,
+                      const unsigned char *data, unsigned long len, unsigned char *dst)
+{
+    xsalsa20_state st;
+    unsigned long off, n, i;
+    unsigned int k = 0;
+    int err;
+
+    if (mode == FUZZ_MULTI) return run_multi(key, nonce, rounds, offset, chunks, nchunks, data, len, dst);
+    if (mode == FUZZ_BATCH || mode == FUZZ_PACKETS) {
+        return run_packets(mode, key, nonce, rounds, chunks, nchunks, data, len, dst);
+    }
+
+    if ((err = xsalsa20_setup(&st, key, 32, nonce, 24, rounds)) != XSALSA_OK) return err;
+    err = xsalsa20_seek(&st, offset);
+    for (off = 0; err == XSALSA_OK && off < len; off += n) {
+        n = next_chunk(chunks, nchunks, &k, off, len);
+        if (mode == FUZZ_KEYSTREAM) {
+            err = xsalsa20_keystream(&st, dst + off, n);
+            for (i = 0; i < n; i++) dst[off + i] ^= data[off + i];
+        } else if (mode == FUZZ_CRYPT_AT) {
+            /* crypt_at leaves the context alone: every chunk starts from the seeked state */
+            err = xsalsa20_crypt_at(&st, offset + off, data + off, n, dst + off);
+        } else {
+            err = xsalsa20_crypt(&st, data + off, n, dst + off);
+        }
+    }
+    xsalsa20_done(&st);
+    return err;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *buf, size_t size)
+{
+    unsigned long chunks[FUZZ_MAX_CHUNKS];
+    unsigned int nchunks, ref_chunks, k;
+    const unsigned char *data;
+    unsigned long len;
+    ulong64 seed, offset;
+    int rounds, mode, ref_mode, ref_err = XSALSA_OK, err;
+    size_t i, base = NUM_IMPLS;
+
+    if (size < FUZZ_HEADER) return 0;
+
+    rounds = 2 * (buf[56] % 16 + 1);
+    for (seed = 0, k = 0; k < 8; k++) seed |= (ulong64)buf[57 + k] << (8 * k);
+    if (seed >> 63) {
+        offset = (((ulong64)1 << 32) - (seed & 0xff)) * 64 + ((seed >> 8) & 63);
+    } else {
+        offset = seed & (((ulong64)1 << 44) - 1);
+    }
+
+    nchunks = buf[65] % (FUZZ_MAX_CHUNKS + 1);
+    mode = buf[66] % FUZZ_MODES;
+    if (size < FUZZ_HEADER + 2 * (size_t)nchunks) return 0;
+    for (k = 0; k < nchunks; k++) {
+        chunks[k] = buf[FUZZ_HEADER + 2 * k] | (unsigned long)buf[FUZZ_HEADER + 2 * k + 1] << 8;
+    }
+    data = buf + FUZZ_HEADER + 2 * nchunks;
+    len = (unsigned long)(size - FUZZ_HEADER - 2 * nchunks);
+    if (len > FUZZ_MAX_DATA) len = FUZZ_MAX_DATA;
+
+    /* The reference is one xsalsa20_crypt call, or one context per packet for the batch */
+    ref_mode = (mode == FUZZ_BATCH) ? FUZZ_PACKETS : FUZZ_CRYPT;
+    ref_chunks = (mode == FUZZ_BATCH) ? nchunks : 0;
+
+    for (i = 0; i < NUM_IMPLS; i++) {
+        if (impls[i].available != NULL && !impls[i].available()) continue;
+        xsalsa20_force_impl(impls[i].impl);
+
+        /* The first implementation's reference run sets ref; the others must match it */
+        if (base == NUM_IMPLS) {
+            base = i;
+            ref_err = run_chunks(ref_mode, buf, buf + 32, rounds, offset, chunks, ref_chunks, data, len, ref);
+        } else {
+            err = run_chunks(ref_mode, buf, buf + 32, rounds, offset, chunks, ref_chunks, data, len, out);
+            if (err != ref_err) fail("error code (reference)", impls[i].name, 0);
+            if (err == XSALSA_OK && memcmp(out, ref, len) != 0) {
+                fail("reference", impls[i].name, first_diff(out, ref, len));
+            }
+        }
+
+        /* The chunked sequence through the selected entry point must give the same output */
+        err = run_chunks(mode, buf, buf + 32, rounds, offset, chunks, nchunks, data, len, out);
+        if (err != ref_err) fail("error code (chunked)", impls[i].name, 0);
+        if (err == XSALSA_OK && memcmp(out, ref, len) != 0) {
+            fail("chunked", impls[i].name, first_diff(out, ref, len));
+        }
+    }
+
+    return 0;
+}
+
+#ifndef XSALSA_FUZZ_LIBFUZZER
+static int run_file(FILE *f)
+{
+    static uint8_t buf[FUZZ_HEADER + 2 * FUZZ_MAX_CHUNKS + FUZZ_MAX_DATA];
+    size_t n = fread(buf, 1, sizeof(buf), f);
+
+    return LLVMFuzzerTestOneInput(buf, n);
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+
+    if (argc < 2) return run_file(stdin);
+    for (i = 1; i < argc; i++) {
+        FILE *f = fopen(argv[i], "rb");
+        if (f == NULL) {
+            perror(argv[i]);
+            return 1;
+        }
+        run_file(f);
+        fclose(f);
+    }
+    return 0;
+}
+#endif
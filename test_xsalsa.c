@@ -1,5 +1,7 @@
 #include "xsalsa.h"
 #include "xsalsa_impl_check.h"
+#include "xsalsa_poly1305.h"
+#include "xsalsa_poly1305_impl.h"
 #include <stdio.h>
 #include <string.h>
 
@@ -18,6 +20,21 @@ static unsigned char nonce[24] = {
 
 static const char *plaintext = "Hello, XSalsa20! This is a test message.";
 
+/* NaCl tests/stream3.out: first 32 keystream bytes for key/nonce above */
+static const unsigned char kat_stream32[32] = {
+    0xee, 0xa6, 0xa7, 0x25, 0x1c, 0x1e, 0x72, 0x91,
+    0x6d, 0x11, 0xc2, 0xcb, 0x21, 0x4d, 0x3c, 0x25,
+    0x25, 0x39, 0x12, 0x1d, 0x8e, 0x23, 0x4e, 0x65,
+    0x2d, 0x65, 0x1f, 0xa4, 0xc8, 0xcf, 0xf8, 0x80
+};
+
+/* NaCl tests/stream.out: SHA-256 of the first 4194304 keystream bytes */
+#define KAT_STREAM_LEN 4194304UL
+static const char *kat_stream_sha256 = "662b9d0e3463029156069b12f918691a98f7dfb2ca0393c96bbfc6b1fbd630a2";
+
+/* Longest message of the differential length sweep */
+#define DIFF_MAX_LEN 8192
+
 typedef struct {
     const char *name;
     int impl;
@@ -48,9 +65,65 @@ static const impl_test_t impls[] = {
     #else
     { "AVX512", -1 },
     #endif
+
+    #ifdef XSALSA_USE_IMPL_AVX512VL
+    { "AVX512VL", XSALSA_IMPL_AVX512VL, check_avx512vl_support },
+    #else
+    { "AVX512VL", -1 },
+    #endif
 };
 
 
+/* Minimal SHA-256, only for hashing long KAT streams */
+static void sha256_block(uint32_t h[8], const unsigned char *p)
+{
+    static const uint32_t k[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+    };
+    uint32_t w[64], a, b, c, d, e, f, g, hh, t1, t2;
+    int i;
+
+    #define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+    for (i = 0; i < 16; i++) {
+        w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+    }
+    for (i = 16; i < 64; i++) {
+        w[i] = w[i - 16] + (ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ (w[i - 15] >> 3)) +
+               w[i - 7] + (ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ (w[i - 2] >> 10));
+    }
+    a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4]; f = h[5]; g = h[6]; hh = h[7];
+    for (i = 0; i < 64; i++) {
+        t1 = hh + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+        t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        hh = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2;
+    }
+    #undef ROR
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+}
+
+/* Hex digest of in; len must be a multiple of 64 (enough for the KATs) */
+static void sha256_hex(const unsigned char *in, unsigned long len, char hex[65])
+{
+    uint32_t h[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    unsigned char pad[64] = { 0x80 };
+    unsigned long i;
+    uint64_t bits = (uint64_t)len * 8;
+
+    for (i = 0; i + 64 <= len; i += 64) sha256_block(h, in + i);
+    for (i = 0; i < 8; i++) pad[56 + i] = (unsigned char)(bits >> (56 - 8 * i));
+    sha256_block(h, pad);
+    for (i = 0; i < 8; i++) snprintf(hex + 8 * i, 9, "%08x", (unsigned int)h[i]);
+}
+
 int run_impl_tests(int impl)
 {
     xsalsa20_force_impl(impl);
@@ -125,6 +198,531 @@ int run_impl_tests(int impl)
 }
 
 
+int run_kat_tests(int impl)
+{
+    static unsigned char stream[KAT_STREAM_LEN];
+    xsalsa20_state st;
+    char hex[65];
+
+    xsalsa20_force_impl(impl);
+
+    /* Odd first call, so the rest runs from a buffered partial block */
+    if (xsalsa20_setup(&st, key, 32, nonce, 24, 20) != XSALSA_OK ||
+        xsalsa20_keystream(&st, stream, 17) != XSALSA_OK ||
+        xsalsa20_keystream(&st, stream + 17, KAT_STREAM_LEN - 17) != XSALSA_OK) {
+        printf("✗ KAT keystream generation failed\n");
+        return 1;
+    }
+    xsalsa20_done(&st);
+
+    sha256_hex(stream, KAT_STREAM_LEN, hex);
+    if (memcmp(stream, kat_stream32, sizeof(kat_stream32)) != 0 || strcmp(hex, kat_stream_sha256) != 0) {
+        printf("✗ 4 MB keystream does not match the NaCl KAT (sha256 %s)\n", hex);
+        return 1;
+    }
+    printf("✓ 4 MB keystream matches the NaCl KAT\n");
+
+    return 0;
+}
+
+
+int run_batch_setup_tests(int impl)
+{
+    enum { BATCH = 21 };  /* covers full and partial passes for every lane width */
+    static unsigned char keys[BATCH * 32];
+    static unsigned char nonces[BATCH * 24];
+    xsalsa20_state batch[BATCH];
+    xsalsa20_state single;
+    unsigned long i;
+
+    xsalsa20_force_impl(impl);
+
+    for (i = 0; i < sizeof(keys); i++) keys[i] = (unsigned char)(key[i % 32] + i / 32);
+    for (i = 0; i < sizeof(nonces); i++) nonces[i] = (unsigned char)(nonce[i % 24] ^ (i / 24));
+
+    if (xsalsa20_setup_batch(batch, BATCH, key, 32, nonces, 24, 20) != XSALSA_OK) {
+        printf("✗ Batch setup failed\n");
+        return 1;
+    }
+    for (i = 0; i < BATCH; i++) {
+        xsalsa20_setup(&single, key, 32, nonces + i * 24, 24, 20);
+        if (memcmp(single.input, batch[i].input, sizeof(single.input)) != 0) {
+            printf("✗ Batch setup does not match single setup (context %lu)\n", i);
+            return 1;
+        }
+    }
+    printf("✓ Batch setup matches single setup\n");
+
+    if (xsalsa20_setup_batch_keys(batch, BATCH, keys, 32, nonces, 24, 20) != XSALSA_OK) {
+        printf("✗ Batch setup with per-context keys failed\n");
+        return 1;
+    }
+    for (i = 0; i < BATCH; i++) {
+        xsalsa20_setup(&single, keys + i * 32, 32, nonces + i * 24, 24, 20);
+        if (memcmp(single.input, batch[i].input, sizeof(single.input)) != 0) {
+            printf("✗ Batch setup with per-context keys does not match single setup (context %lu)\n", i);
+            return 1;
+        }
+    }
+    printf("✓ Batch setup with per-context keys matches single setup\n");
+
+    return 0;
+}
+
+
+int run_crypt_multi_tests(int impl)
+{
+    enum { JOBS = 19, MAXLEN = 1100 };  /* more jobs than lanes, mixed lengths */
+    static const unsigned long lens[JOBS] = {
+        0, 1, 63, 64, 65, 127, 128, 129, 255, 256, 257, 511, 512, 1000, 1024, 1100, 7, 200, 640
+    };
+    static unsigned char in[MAXLEN];
+    static unsigned char out_multi[JOBS][MAXLEN + 100];
+    static unsigned char out_single[MAXLEN + 100];
+    xsalsa20_state multi[JOBS];
+    xsalsa20_state single;
+    xsalsa20_job jobs[JOBS];
+    unsigned long i, pre;
+
+    xsalsa20_force_impl(impl);
+
+    for (i = 0; i < sizeof(in); i++) in[i] = (unsigned char)(i * 31 + 7);
+
+    for (i = 0; i < JOBS; i++) {
+        nonce[23] ^= (unsigned char)i;
+        xsalsa20_setup(&multi[i], key, 32, nonce, 24, 20);
+        nonce[23] ^= (unsigned char)i;
+        /* Leave some jobs with buffered keystream from a previous call */
+        pre = (i % 3 == 1) ? (lens[i] < 10 ? lens[i] : 10) : 0;
+        xsalsa20_crypt(&multi[i], in, pre, out_multi[i]);
+        jobs[i].st = &multi[i];
+        jobs[i].in = in + pre;
+        jobs[i].inlen = lens[i] - pre;
+        jobs[i].out = out_multi[i] + pre;
+    }
+
+    if (xsalsa20_crypt_multi(jobs, JOBS) != XSALSA_OK) {
+        printf("✗ Multi-buffer crypt failed\n");
+        return 1;
+    }
+
+    for (i = 0; i < JOBS; i++) {
+        nonce[23] ^= (unsigned char)i;
+        xsalsa20_setup(&single, key, 32, nonce, 24, 20);
+        nonce[23] ^= (unsigned char)i;
+        xsalsa20_crypt(&single, in, lens[i], out_single);
+        /* Both states must continue the same stream */
+        xsalsa20_crypt(&single, in, 100, out_single + lens[i]);
+        xsalsa20_crypt(&multi[i], in, 100, out_multi[i] + lens[i]);
+        if (memcmp(out_single, out_multi[i], lens[i] + 100) != 0) {
+            printf("✗ Multi-buffer crypt does not match single crypt (job %lu)\n", i);
+            return 1;
+        }
+    }
+    printf("✓ Multi-buffer crypt matches single crypt\n");
+
+    return 0;
+}
+
+
+int run_crypt_batch_tests(int impl)
+{
+    enum { PACKETS = 37, MAXLEN = 1500 };  /* more than two chunks on every tier */
+    static unsigned char nonces[PACKETS * 24];
+    static unsigned char in[PACKETS][MAXLEN];
+    static unsigned char out_batch[PACKETS][MAXLEN];
+    static unsigned char out_single[MAXLEN];
+    const unsigned char *ins[PACKETS];
+    unsigned char *outs[PACKETS];
+    unsigned long lens[PACKETS];
+    unsigned long i, j;
+
+    xsalsa20_force_impl(impl);
+
+    for (i = 0; i < sizeof(nonces); i++) nonces[i] = (unsigned char)(nonce[i % 24] ^ (i / 24));
+    for (i = 0; i < PACKETS; i++) {
+        lens[i] = (i * 97 + 13) % MAXLEN;
+        for (j = 0; j < lens[i]; j++) in[i][j] = (unsigned char)(i + j * 3);
+        ins[i] = in[i];
+        outs[i] = out_batch[i];
+    }
+
+    if (xsalsa20_crypt_batch(key, 32, nonces, 24, 20, PACKETS, ins, lens, outs) != XSALSA_OK) {
+        printf("✗ Packet batch crypt failed\n");
+        return 1;
+    }
+    for (i = 0; i < PACKETS; i++) {
+        xsalsa20_memory(key, 32, nonces + i * 24, 24, 20, in[i], lens[i], out_single);
+        if (memcmp(out_single, out_batch[i], lens[i]) != 0) {
+            printf("✗ Packet batch crypt does not match one-shot crypt (packet %lu)\n", i);
+            return 1;
+        }
+    }
+    printf("✓ Packet batch crypt matches one-shot crypt\n");
+
+    return 0;
+}
+
+int run_seek_tests(int impl)
+{
+    static const unsigned long offsets[] = { 0, 1, 63, 64, 65, 200, 511, 512, 1000, 2047 };
+    static unsigned char in[2048];
+    static unsigned char stream[2048];
+    unsigned char out[48];
+    xsalsa20_state st;
+    unsigned long i;
+
+    xsalsa20_force_impl(impl);
+
+    for (i = 0; i < sizeof(in); i++) in[i] = (unsigned char)(i * 13 + 5);
+    xsalsa20_memory(key, 32, nonce, 24, 20, in, sizeof(in), stream);
+    xsalsa20_setup(&st, key, 32, nonce, 24, 20);
+
+    for (i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++) {
+        unsigned long off = offsets[i];
+        unsigned long len = sizeof(in) - off < sizeof(out) ? sizeof(in) - off : sizeof(out);
+
+        if (xsalsa20_seek(&st, off) != XSALSA_OK || xsalsa20_tell(&st) != off ||
+            xsalsa20_crypt(&st, in + off, len, out) != XSALSA_OK ||
+            memcmp(out, stream + off, len) != 0 || xsalsa20_tell(&st) != off + len) {
+            printf("✗ Seek does not match sequential stream (offset %lu)\n", off);
+            return 1;
+        }
+        if (xsalsa20_crypt_at(&st, off, in + off, len, out) != XSALSA_OK ||
+            memcmp(out, stream + off, len) != 0 || xsalsa20_tell(&st) != off + len) {
+            printf("✗ Positioned crypt does not match sequential stream (offset %lu)\n", off);
+            return 1;
+        }
+    }
+    xsalsa20_done(&st);
+    printf("✓ Seek and positioned crypt match sequential stream\n");
+
+    return 0;
+}
+
+int run_pinned_impl_tests(int impl)
+{
+    static unsigned char in[1000];
+    static unsigned char ref[1000];
+    static unsigned char out[1000];
+    int other = impl == XSALSA_IMPL_SCALAR ? XSALSA_IMPL_AVX512VL : XSALSA_IMPL_SCALAR;
+    xsalsa20_state st;
+    xsalsa20_job job;
+    xsalsa20_stats stats;
+    unsigned long i;
+    int err, counted;
+
+    xsalsa20_force_impl(impl);
+
+    for (i = 0; i < sizeof(in); i++) in[i] = (unsigned char)(i * 11 + 3);
+    xsalsa20_memory(key, 32, nonce, 24, 20, in, sizeof(in), ref);
+    xsalsa20_setup(&st, key, 32, nonce, 24, 20);
+    xsalsa20_crypt(&st, in, 100, out);
+
+    /* The context keeps the implementation it was set up with */
+    xsalsa20_force_impl(other);
+    xsalsa20_crypt(&st, in + 100, 300, out + 100);
+    xsalsa20_reset_impl();
+    xsalsa20_crypt(&st, in + 400, sizeof(in) - 400, out + 400);
+    xsalsa20_force_impl(impl);
+    xsalsa20_done(&st);
+
+    if (memcmp(out, ref, sizeof(ref)) != 0) {
+        printf("✗ Context changed implementation after force/reset\n");
+        return 1;
+    }
+    printf("✓ Context keeps its implementation across force/reset\n");
+
+    /* crypt_multi runs a job on its context's tier too (visible in the counters when compiled in) */
+    xsalsa20_setup(&st, key, 32, nonce, 24, 20);
+    job.st = &st;
+    job.in = in;
+    job.inlen = sizeof(in);
+    job.out = out;
+    memset(out, 0, sizeof(out));
+    xsalsa20_force_impl(other);
+    xsalsa20_reset_stats();
+    err = xsalsa20_crypt_multi(&job, 1);
+    counted = xsalsa20_get_stats(&stats) == XSALSA_OK;
+    xsalsa20_force_impl(impl);
+    xsalsa20_done(&st);
+
+    if (err != XSALSA_OK || memcmp(out, ref, sizeof(ref)) != 0 ||
+        (counted && (stats.impl[impl].calls == 0 || stats.impl[other].calls != 0))) {
+        printf("✗ Multi-buffer crypt ignored the context's implementation\n");
+        return 1;
+    }
+    printf("✓ Multi-buffer crypt uses the context's implementation\n");
+
+    return 0;
+}
+
+int run_stats_tests(int impl)
+{
+    enum { LEN = 2 * 1024 * 1024 };
+    static unsigned char in[LEN];
+    static unsigned char out[LEN];
+    xsalsa20_stats stats;
+    const xsalsa20_impl_stats *s = &stats.impl[impl];
+    ulong64 bytes = 0;
+    xsalsa20_state st;
+    int i;
+
+    xsalsa20_force_impl(impl);
+    xsalsa20_reset_stats();
+    if (xsalsa20_get_stats(&stats) != XSALSA_OK) {
+        printf("  (hot-path statistics not compiled in, skipping)\n");
+        return 0;
+    }
+
+    /* 10 bytes: one tail block, 54 left buffered. Then 54 drained and 2118
+       through the loops: 2048 bytes in whole multi-block steps, 70 in 2 blocks. */
+    xsalsa20_setup(&st, key, 32, nonce, 24, 20);
+    xsalsa20_crypt(&st, in, 10, out);
+    xsalsa20_crypt(&st, in, 54 + 2118, out);
+    xsalsa20_done(&st);
+    xsalsa20_get_stats(&stats);
+
+    if (s->calls != 2 || s->bytes != 10 + 54 + 2118 || s->drain_bytes != 54 || s->setups != 1 ||
+        s->overflows != 0 || s->bulk_blocks != (impl == XSALSA_IMPL_SCALAR ? 0 : 32) ||
+        s->bulk_blocks + s->tail_blocks != 1 + 34) {
+        printf("✗ Statistics do not match the calls made\n");
+        return 1;
+    }
+    for (i = XSALSA_IMPL_SCALAR; i <= XSALSA_IMPL_AVX512VL; i++) {
+        if (i != impl && stats.impl[i].calls != 0) {
+            printf("✗ Statistics counted for an implementation that did not run\n");
+            return 1;
+        }
+    }
+
+    /* Worker threads count into their own blocks, which get_stats sums */
+    xsalsa20_reset_stats();
+    xsalsa20_set_threads(4);
+    xsalsa20_setup(&st, key, 32, nonce, 24, 20);
+    xsalsa20_crypt_parallel(&st, in, LEN, out);
+    xsalsa20_done(&st);
+    xsalsa20_set_threads(0);
+    xsalsa20_get_stats(&stats);
+    for (i = XSALSA_IMPL_SCALAR; i <= XSALSA_IMPL_AVX512VL; i++) bytes += stats.impl[i].bytes;
+    if (bytes != LEN) {
+        printf("✗ Statistics lost bytes processed on worker threads\n");
+        return 1;
+    }
+
+    xsalsa20_reset_stats();
+    xsalsa20_get_stats(&stats);
+    if (s->calls != 0 || s->bytes != 0 || s->setups != 0) {
+        printf("✗ Statistics not cleared by reset\n");
+        return 1;
+    }
+    printf("✓ Hot-path statistics count calls, bytes and blocks\n");
+
+    return 0;
+}
+
+int run_parallel_tests(int impl)
+{
+    enum { LEN = 3 * 1024 * 1024 + 1000 };  /* above the threshold, not block aligned */
+    static const unsigned long pre[] = { 0, 5, 64 };
+    static unsigned char in[LEN];
+    static unsigned char out_serial[LEN];
+    static unsigned char out_parallel[LEN];
+    xsalsa20_state serial, parallel;
+    unsigned long i, j;
+
+    xsalsa20_force_impl(impl);
+    xsalsa20_set_threads(4);
+
+    for (i = 0; i < sizeof(in); i++) in[i] = (unsigned char)(i * 7 + 1);
+
+    for (i = 0; i < sizeof(pre) / sizeof(pre[0]); i++) {
+        xsalsa20_setup(&serial, key, 32, nonce, 24, 20);
+        xsalsa20_crypt(&serial, in, pre[i], out_serial);
+        parallel = serial;
+        for (j = 0; j < 2; j++) {
+            unsigned long len = LEN - pre[i] - j * 1000;
+            xsalsa20_crypt(&serial, in, len, out_serial);
+            if (xsalsa20_crypt_parallel(&parallel, in, len, out_parallel) != XSALSA_OK ||
+                memcmp(out_serial, out_parallel, len) != 0 ||
+                memcmp(serial.input, parallel.input, sizeof(serial.input)) != 0 ||
+                serial.ksleft != parallel.ksleft ||
+                memcmp(serial.kstream + 64 - serial.ksleft, parallel.kstream + 64 - parallel.ksleft, serial.ksleft) != 0) {
+                printf("✗ Parallel crypt does not match serial crypt (offset %lu)\n", pre[i]);
+                xsalsa20_set_threads(0);
+                return 1;
+            }
+        }
+    }
+    xsalsa20_set_threads(0);
+    printf("✓ Parallel crypt matches serial crypt\n");
+
+    return 0;
+}
+
+int run_poly1305_tests(int impl)
+{
+    /* RFC 8439 section 2.5.2 */
+    static const unsigned char rfc_key[32] = {
+        0x85, 0xd6, 0xbe, 0x78, 0x57, 0x55, 0x6d, 0x33, 0x7f, 0x44, 0x52, 0xfe, 0x42, 0xd5, 0x06, 0xa8,
+        0x01, 0x03, 0x80, 0x8a, 0xfb, 0x0d, 0xb2, 0xfd, 0x4a, 0xbf, 0xf6, 0xaf, 0x41, 0x49, 0xf5, 0x1b
+    };
+    static const unsigned char rfc_tag[16] = {
+        0xa8, 0x06, 0x1d, 0xc1, 0x30, 0x51, 0x36, 0xc6, 0xc2, 0x2b, 0x8b, 0xaf, 0x0c, 0x01, 0x27, 0xa9
+    };
+    static const char *rfc_msg = "Cryptographic Forum Research Group";
+    static const unsigned long lens[] = { 0, 15, 16, 255, 256, 512, 1000, 1024, 4096 + 48, 20000 };
+    static unsigned char msg[20000];
+    unsigned char tag[16], ref[16];
+    xsalsa20_poly1305_state st;
+    unsigned long i, j, n;
+
+    xsalsa20_force_impl(impl);
+
+    xsalsa20_poly1305_init(&st, rfc_key);
+    xsalsa20_poly1305_update(&st, (const unsigned char*)rfc_msg, strlen(rfc_msg));
+    xsalsa20_poly1305_finish(&st, tag);
+    if (memcmp(tag, rfc_tag, sizeof(tag)) != 0) {
+        printf("✗ Poly1305 does not match the RFC 8439 test vector\n");
+        return 1;
+    }
+
+    /* Bulk updates take the multi-lane block function, 15-byte updates
+       always go through the single-block path */
+    for (i = 0; i < sizeof(msg); i++) msg[i] = (unsigned char)(i * 29 + 17);
+    for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+        xsalsa20_poly1305_init(&st, key);
+        xsalsa20_poly1305_update(&st, msg, lens[i]);
+        xsalsa20_poly1305_finish(&st, tag);
+        xsalsa20_poly1305_init(&st, key);
+        for (j = 0; j < lens[i]; j += n) {
+            n = lens[i] - j < 15 ? lens[i] - j : 15;
+            xsalsa20_poly1305_update(&st, msg + j, n);
+        }
+        xsalsa20_poly1305_finish(&st, ref);
+        if (memcmp(tag, ref, sizeof(tag)) != 0) {
+            printf("✗ Poly1305 bulk update does not match block-wise update (length %lu)\n", lens[i]);
+            return 1;
+        }
+    }
+    printf("✓ Poly1305 matches RFC 8439 and the block-wise reference\n");
+
+#ifdef XSALSA_USE_IMPL_AVX512
+    /* Accumulators whose limbs sit at the carry boundaries of the radix-2^44
+       conversions: the last carry of each conversion must not be dropped */
+    if (impl == XSALSA_IMPL_AVX512 && check_avx512ifma_support()) {
+        static const ulong32 edges[][5] = {
+            { 0x3ffffff, 0x3ffffff, 0x3ffffff, 0x3ffffff, 0x4000000 },
+            { 0x3ffffff, 0x3ffffff, 0x3ffffff, 0x3ffffff, 0x3ffffff },
+            { 0x3ffffff, 0x4000000, 0x3ffffff, 0x3ffffff, 0x3ffffff },
+            { 0x4000004, 0x3ffffff, 0x0000001, 0x3ffffff, 0x3ffffff },
+        };
+        static const unsigned char ones[32] = {
+            0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+            0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+        };
+        xsalsa20_poly1305_state vec;
+
+        memset(msg, 0xff, 1024);
+        for (i = 0; i < sizeof(edges) / sizeof(edges[0]); i++) {
+            for (n = 512; n <= 512 + 48; n += 48) {
+                xsalsa20_poly1305_init(&st, (i & 1) ? key : ones);
+                memcpy(st.h, edges[i], sizeof(st.h));
+                vec = st;
+                xsalsa20_poly1305_blocks_scalar(&st, msg, n);
+                xsalsa20_poly1305_blocks_avx512ifma(&vec, msg, n);
+                xsalsa20_poly1305_finish(&st, ref);
+                xsalsa20_poly1305_finish(&vec, tag);
+                if (memcmp(tag, ref, sizeof(tag)) != 0) {
+                    printf("✗ Poly1305 IFMA blocks lose a carry (boundary state %lu, length %lu)\n", i, n);
+                    return 1;
+                }
+            }
+        }
+        printf("✓ Poly1305 IFMA blocks keep carries at the limb boundaries\n");
+    }
+#endif
+
+    return 0;
+}
+
+int run_secretbox_tests(int impl)
+{
+    /* NaCl crypto_secretbox test vector (key and nonce as above) */
+    static const unsigned char m[131] = {
+        0xbe, 0x07, 0x5f, 0xc5, 0x3c, 0x81, 0xf2, 0xd5, 0xcf, 0x14, 0x13, 0x16, 0xeb, 0xeb, 0x0c, 0x7b,
+        0x52, 0x28, 0xc5, 0x2a, 0x4c, 0x62, 0xcb, 0xd4, 0x4b, 0x66, 0x84, 0x9b, 0x64, 0x24, 0x4f, 0xfc,
+        0xe5, 0xec, 0xba, 0xaf, 0x33, 0xbd, 0x75, 0x1a, 0x1a, 0xc7, 0x28, 0xd4, 0x5e, 0x6c, 0x61, 0x29,
+        0x6c, 0xdc, 0x3c, 0x01, 0x23, 0x35, 0x61, 0xf4, 0x1d, 0xb6, 0x6c, 0xce, 0x31, 0x4a, 0xdb, 0x31,
+        0x0e, 0x3b, 0xe8, 0x25, 0x0c, 0x46, 0xf0, 0x6d, 0xce, 0xea, 0x3a, 0x7f, 0xa1, 0x34, 0x80, 0x57,
+        0xe2, 0xf6, 0x55, 0x6a, 0xd6, 0xb1, 0x31, 0x8a, 0x02, 0x4a, 0x83, 0x8f, 0x21, 0xaf, 0x1f, 0xde,
+        0x04, 0x89, 0x77, 0xeb, 0x48, 0xf5, 0x9f, 0xfd, 0x49, 0x24, 0xca, 0x1c, 0x60, 0x90, 0x2e, 0x52,
+        0xf0, 0xa0, 0x89, 0xbc, 0x76, 0x89, 0x70, 0x40, 0xe0, 0x82, 0xf9, 0x37, 0x76, 0x38, 0x48, 0x64,
+        0x5e, 0x07, 0x05
+    };
+    static const unsigned char c[131] = {
+        0x8e, 0x99, 0x3b, 0x9f, 0x48, 0x68, 0x12, 0x73, 0xc2, 0x96, 0x50, 0xba, 0x32, 0xfc, 0x76, 0xce,
+        0x48, 0x33, 0x2e, 0xa7, 0x16, 0x4d, 0x96, 0xa4, 0x47, 0x6f, 0xb8, 0xc5, 0x31, 0xa1, 0x18, 0x6a,
+        0xc0, 0xdf, 0xc1, 0x7c, 0x98, 0xdc, 0xe8, 0x7b, 0x4d, 0xa7, 0xf0, 0x11, 0xec, 0x48, 0xc9, 0x72,
+        0x71, 0xd2, 0xc2, 0x0f, 0x9b, 0x92, 0x8f, 0xe2, 0x27, 0x0d, 0x6f, 0xb8, 0x63, 0xd5, 0x17, 0x38,
+        0xb4, 0x8e, 0xee, 0xe3, 0x14, 0xa7, 0xcc, 0x8a, 0xb9, 0x32, 0x16, 0x45, 0x48, 0xe5, 0x26, 0xae,
+        0x90, 0x22, 0x43, 0x68, 0x51, 0x7a, 0xcf, 0xea, 0xbd, 0x6b, 0xb3, 0x73, 0x2b, 0xc0, 0xe9, 0xda,
+        0x99, 0x83, 0x2b, 0x61, 0xca, 0x01, 0xb6, 0xde, 0x56, 0x24, 0x4a, 0x9e, 0x88, 0xd5, 0xf9, 0xb3,
+        0x79, 0x73, 0xf6, 0x22, 0xa4, 0x3d, 0x14, 0xa6, 0x59, 0x9b, 0x1f, 0x65, 0x4c, 0xb4, 0x5a, 0x74,
+        0xe3, 0x55, 0xa5
+    };
+    static const unsigned char t[16] = {
+        0xf3, 0xff, 0xc7, 0x70, 0x3f, 0x94, 0x00, 0xe5, 0x2a, 0x7d, 0xfb, 0x4b, 0x3d, 0x33, 0x05, 0xd9
+    };
+    enum { LONG = 20000 + 13 };  /* several chunks plus a partial block */
+    static unsigned char in[LONG], box[LONG], opened[LONG], ref[32 + LONG];
+    xsalsa20_poly1305_state poly;
+    unsigned char tag[16];
+    unsigned char ref_tag[16];
+    unsigned long i;
+
+    xsalsa20_force_impl(impl);
+
+    if (xsalsa20_secretbox(key, 32, nonce, 24, m, sizeof(m), box, tag) != XSALSA_OK ||
+        memcmp(box, c, sizeof(c)) != 0 || memcmp(tag, t, sizeof(t)) != 0) {
+        printf("✗ Secretbox does not match the NaCl test vector\n");
+        return 1;
+    }
+    if (xsalsa20_secretbox_open(key, 32, nonce, 24, c, sizeof(c), t, opened) != XSALSA_OK ||
+        memcmp(opened, m, sizeof(m)) != 0) {
+        printf("✗ Secretbox open failed on the NaCl test vector\n");
+        return 1;
+    }
+    printf("✓ Secretbox matches the NaCl test vector\n");
+
+    /* A long message against the unfused construction: stream bytes 0..31
+       key Poly1305, the rest encrypt the message */
+    for (i = 0; i < 32; i++) ref[i] = 0;
+    for (i = 0; i < sizeof(in); i++) ref[32 + i] = in[i] = (unsigned char)(i * 11 + 3);
+    xsalsa20_memory(key, 32, nonce, 24, 20, ref, sizeof(ref), ref);
+    xsalsa20_poly1305_init(&poly, ref);
+    xsalsa20_poly1305_update(&poly, ref + 32, sizeof(in));
+    xsalsa20_poly1305_finish(&poly, ref_tag);
+    if (xsalsa20_secretbox(key, 32, nonce, 24, in, sizeof(in), box, tag) != XSALSA_OK ||
+        memcmp(box, ref + 32, sizeof(box)) != 0 || memcmp(tag, ref_tag, sizeof(tag)) != 0) {
+        printf("✗ Secretbox of a long message does not match encrypt-then-MAC\n");
+        return 1;
+    }
+    if (xsalsa20_secretbox_open(key, 32, nonce, 24, box, sizeof(box), tag, opened) != XSALSA_OK ||
+        memcmp(opened, in, sizeof(in)) != 0) {
+        printf("✗ Secretbox open failed on a long message\n");
+        return 1;
+    }
+    box[LONG / 2] ^= 1;
+    if (xsalsa20_secretbox_open(key, 32, nonce, 24, box, sizeof(box), tag, opened) != XSALSA_AUTH_FAILED) {
+        printf("✗ Secretbox open accepted a forged message\n");
+        return 1;
+    }
+    printf("✓ Secretbox round trip and forgery rejection\n");
+
+    return 0;
+}
+
 int run_impl_comparison_tests(void)
 {
     unsigned long plaintext_len = strlen(plaintext);
@@ -161,6 +759,157 @@ int run_impl_comparison_tests(void)
 }
 
 
+int run_adaptive_tests(void)
+{
+    static const unsigned long chunks[] = { 1, 40, 63, 64, 300, 511, 512, 2000, 4095, 4096, 20000, 7 };
+    static unsigned char in[40000];
+    static unsigned char ref[40000];
+    static unsigned char out[40000];
+    static const unsigned long lens[] = { 0, 1, 63, 64, 511, 512, 4095, 4096, 40000 };
+    xsalsa20_state st;
+    unsigned long i, off;
+    int id;
+
+    for (i = 0; i < sizeof(in); i++) in[i] = (unsigned char)(i * 5 + 9);
+
+    /* Reference from a single fixed kernel */
+    xsalsa20_set_impl_policy(XSALSA_POLICY_THROUGHPUT);
+    xsalsa20_memory(key, 32, nonce, 24, 20, in, sizeof(in), ref);
+
+    xsalsa20_set_impl_policy(XSALSA_POLICY_THROUGHPUT | XSALSA_POLICY_ADAPTIVE);
+    for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+        id = xsalsa20_get_size_class_impl(lens[i]);
+        if (id < XSALSA_IMPL_SCALAR || id > XSALSA_IMPL_AVX512VL) {
+            printf("✗ Adaptive dispatch picked no kernel for %lu bytes\n", lens[i]);
+            return 1;
+        }
+        if (xsalsa20_memory(key, 32, nonce, 24, 20, in, lens[i], out) != XSALSA_OK ||
+            memcmp(out, ref, lens[i]) != 0) {
+            printf("✗ Adaptive one-shot does not match (%lu bytes)\n", lens[i]);
+            return 1;
+        }
+    }
+
+    /* Consecutive calls of different sizes may switch kernels mid-stream */
+    xsalsa20_setup(&st, key, 32, nonce, 24, 20);
+    for (i = 0, off = 0; off < sizeof(in); i++) {
+        unsigned long len = chunks[i % (sizeof(chunks) / sizeof(chunks[0]))];
+        if (len > sizeof(in) - off) len = sizeof(in) - off;
+        xsalsa20_crypt(&st, in + off, len, out + off);
+        off += len;
+    }
+    xsalsa20_done(&st);
+    if (memcmp(out, ref, sizeof(ref)) != 0) {
+        printf("✗ Adaptive stream does not match\n");
+        return 1;
+    }
+    printf("✓ Adaptive dispatch matches (kernels: <64 %d, <512 %d, <4K %d, bulk %d)\n",
+           xsalsa20_get_size_class_impl(40), xsalsa20_get_size_class_impl(256),
+           xsalsa20_get_size_class_impl(2048), xsalsa20_get_size_class_impl(16384));
+
+    return 0;
+}
+
+
+/* Deterministic generator for the split patterns */
+static unsigned long diff_rand(unsigned long *seed)
+{
+    *seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (unsigned long)(*seed >> 33);
+}
+
+/* Call length biased towards block and ksleft boundaries */
+static unsigned long diff_chunk(unsigned long *seed)
+{
+    switch (diff_rand(seed) % 4) {
+        case 0: return diff_rand(seed) % 8;
+        case 1: return 64 * (diff_rand(seed) % 20) + diff_rand(seed) % 3 - 1;
+        case 2: return diff_rand(seed) % 200;
+        default: return diff_rand(seed) % 3000;
+    }
+}
+
+int run_differential_tests(void)
+{
+    static const int rounds[] = { 20, 12, 8, 14 };  /* 14: the generic round loop */
+    /* Stream offsets: the start, and just before the 32-bit block counter carries into input[9] */
+    static const ulong64 starts[] = { 0, (((ulong64)1 << 32) - 5) * 64 + 3 };
+    static unsigned char in[DIFF_MAX_LEN];
+    static unsigned char mis[DIFF_MAX_LEN + 16];
+    static unsigned char ref[DIFF_MAX_LEN];
+    static unsigned char out[DIFF_MAX_LEN + 16];
+    const impl_test_t *base = NULL;
+    unsigned long seed = 1, len, off, trial;
+    xsalsa20_state st;
+    size_t i, r, o;
+
+    for (i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+        if (impls[i].impl != -1 && (!impls[i].test_availability || impls[i].test_availability())) {
+            base = &impls[i];  /* scalar whenever it is compiled in */
+            break;
+        }
+    }
+    if (base == NULL) return 1;
+    for (i = 0; i < sizeof(in); i++) in[i] = (unsigned char)(i * 29 + 7);
+
+    for (r = 0; r < sizeof(rounds) / sizeof(rounds[0]); r++) {
+        for (o = 0; o < sizeof(starts) / sizeof(starts[0]); o++) {
+            /* Reference: the whole range in one call; every shorter call must produce a prefix */
+            xsalsa20_force_impl(base->impl);
+            if (xsalsa20_setup(&st, key, 32, nonce, 24, rounds[r]) != XSALSA_OK ||
+                xsalsa20_seek(&st, starts[o]) != XSALSA_OK ||
+                xsalsa20_crypt(&st, in, DIFF_MAX_LEN, ref) != XSALSA_OK) {
+                printf("✗ %s reference failed\n", base->name);
+                return 1;
+            }
+            xsalsa20_done(&st);
+
+            for (i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+                if (impls[i].impl == -1 || (impls[i].test_availability && !impls[i].test_availability())) {
+                    continue;
+                }
+                xsalsa20_force_impl(impls[i].impl);
+
+                /* Every length 0..DIFF_MAX_LEN in one call, buffers misaligned by len % 16 */
+                for (len = 0; len <= DIFF_MAX_LEN; len++) {
+                    unsigned char *src = mis + len % 16, *dst = out + len % 16;
+
+                    memcpy(src, in, len);
+                    xsalsa20_setup(&st, key, 32, nonce, 24, rounds[r]);
+                    xsalsa20_seek(&st, starts[o]);
+                    if (xsalsa20_crypt(&st, src, len, dst) != XSALSA_OK || memcmp(dst, ref, len) != 0) {
+                        printf("✗ %s differs from %s at length %lu (rounds %d, start %llu)\n",
+                               impls[i].name, base->name, len, rounds[r], (unsigned long long)starts[o]);
+                        return 1;
+                    }
+                    xsalsa20_done(&st);
+                }
+
+                /* Random call splits crossing the ksleft boundary */
+                for (trial = 0; trial < 300; trial++) {
+                    xsalsa20_setup(&st, key, 32, nonce, 24, rounds[r]);
+                    xsalsa20_seek(&st, starts[o]);
+                    for (off = 0; off < DIFF_MAX_LEN; off += len) {
+                        len = diff_chunk(&seed);
+                        if (len > DIFF_MAX_LEN - off) len = DIFF_MAX_LEN - off;
+                        xsalsa20_crypt(&st, in + off, len, out + off);
+                    }
+                    xsalsa20_done(&st);
+                    if (memcmp(out, ref, DIFF_MAX_LEN) != 0) {
+                        printf("✗ %s differs from %s on a split pattern (rounds %d, start %llu, trial %lu)\n",
+                               impls[i].name, base->name, rounds[r], (unsigned long long)starts[o], trial);
+                        return 1;
+                    }
+                }
+            }
+        }
+    }
+    printf("✓ All implementations match %s for every length 0..%d and split pattern\n", base->name, DIFF_MAX_LEN);
+
+    return 0;
+}
+
+
 int main(void)
 {
     int ret = 0;
@@ -172,7 +921,12 @@ int main(void)
         }
 
         printf("\nTesting XSalsa20 %s implementation...\n", impls[i].name);
-        if (run_impl_tests(impls[i].impl) != 0) {
+        if (run_impl_tests(impls[i].impl) != 0 || run_batch_setup_tests(impls[i].impl) != 0 ||
+            run_crypt_multi_tests(impls[i].impl) != 0 || run_crypt_batch_tests(impls[i].impl) != 0 ||
+            run_kat_tests(impls[i].impl) != 0 ||
+            run_seek_tests(impls[i].impl) != 0 || run_pinned_impl_tests(impls[i].impl) != 0 ||
+            run_parallel_tests(impls[i].impl) != 0 || run_stats_tests(impls[i].impl) != 0 ||
+            run_poly1305_tests(impls[i].impl) != 0 || run_secretbox_tests(impls[i].impl) != 0) {
             printf("✗ XSalsa20 %s implementation failed\n", impls[i].name);
             ret = 1;
         }
@@ -184,6 +938,18 @@ int main(void)
         ret = 1;
     }
 
+    printf("\nTesting XSalsa20 cross-implementation differential...\n");
+    if (run_differential_tests() != 0) {
+        printf("✗ XSalsa20 cross-implementation differential failed\n");
+        ret = 1;
+    }
+
+    printf("\nTesting XSalsa20 size-adaptive dispatch...\n");
+    if (run_adaptive_tests() != 0) {
+        printf("✗ XSalsa20 size-adaptive dispatch failed\n");
+        ret = 1;
+    }
+
     if (ret == 0) {
         printf("All tests passed!\n");
     }
@@ -12,16 +12,29 @@
 #define XSALSA_INVALID_NONCE_SIZE -4
 #define XSALSA_INVALID_ROUNDS -5
 #define XSALSA_OVERFLOW -6
+#define XSALSA_AUTH_FAILED -7
 
 #define XSALSA_IMPL_SCALAR 0
 #define XSALSA_IMPL_AVX 1
 #define XSALSA_IMPL_AVX2 2
 #define XSALSA_IMPL_AVX512 3
+#define XSALSA_IMPL_AVX512VL 4
+
+/* Implementation selection policies */
+#define XSALSA_POLICY_THROUGHPUT 0  /* widest available vectors, including 512-bit */
+#define XSALSA_POLICY_NO_ZMM 1      /* never use 512-bit registers (avoids AVX-512 frequency drops) */
+#define XSALSA_POLICY_ADAPTIVE 2    /* flag: pick the kernel per call size, calibrated on first use (default) */
+
+/* Inputs shorter than this are never split across threads by xsalsa20_crypt_parallel */
+#define XSALSA_PARALLEL_THRESHOLD (1UL << 20)
 
 /* Data types */
 typedef uint32_t ulong32;
 typedef uint64_t ulong64;
 
+/* Resolved implementation (function table), opaque */
+struct xsalsa20_impl;
+
 /* XSalsa20 state structure */
 typedef struct {
     ulong32 input[16];        /* The input state */
@@ -29,18 +42,56 @@ typedef struct {
     unsigned long ksleft;      /* Number of keystream bytes left */
     unsigned long ivlen;       /* Length of IV/nonce */
     int rounds;               /* Number of rounds */
+    const struct xsalsa20_impl *impl; /* Implementation pinned by xsalsa20_setup */
 } xsalsa20_state;
 
+/* One stream of a multi-buffer request */
+typedef struct {
+    xsalsa20_state *st;       /* The stream's state (must be initialized) */
+    const unsigned char *in;  /* The input data */
+    unsigned long inlen;      /* The length of the input data */
+    unsigned char *out;       /* [out] The output data (same length as input) */
+} xsalsa20_job;
+
+/* Hot-path counters of one implementation (see xsalsa20_get_stats) */
+typedef struct {
+    ulong64 calls;            /* crypt/keystream calls and multi-buffer jobs */
+    ulong64 bytes;            /* Bytes processed by those calls */
+    ulong64 drain_bytes;      /* Bytes served from buffered keystream (ksleft) */
+    ulong64 bulk_blocks;      /* Blocks generated by the multi-block loop */
+    ulong64 tail_blocks;      /* Blocks generated by the single-block loop */
+    ulong64 setups;           /* Contexts set up */
+    ulong64 overflows;        /* Calls stopped by the block counter wrapping */
+} xsalsa20_impl_stats;
+
+/* Counters of every implementation, indexed by XSALSA_IMPL_* */
+typedef struct {
+    xsalsa20_impl_stats impl[XSALSA_IMPL_AVX512VL + 1];
+} xsalsa20_stats;
+
 
 typedef int (*xsalsa20_setup_fn)(xsalsa20_state *st, 
                                  const unsigned char *key, unsigned long keylen,
                                  const unsigned char *nonce, unsigned long noncelen,
                                  int rounds);
 
+typedef int (*xsalsa20_setup_batch_fn)(xsalsa20_state *st, unsigned long count,
+                                       const unsigned char *keys, unsigned long keystride, unsigned long keylen,
+                                       const unsigned char *nonces, unsigned long noncelen,
+                                       int rounds);
+
 typedef int (*xsalsa20_crypt_fn)(xsalsa20_state *st, 
                                  const unsigned char *in, unsigned long inlen, 
                                  unsigned char *out);
 
+typedef int (*xsalsa20_crypt_multi_fn)(xsalsa20_job *jobs, unsigned long count);
+
+typedef int (*xsalsa20_crypt_batch_fn)(const unsigned char *key, unsigned long keylen,
+                                       const unsigned char *nonces, unsigned long noncelen,
+                                       int rounds, unsigned long count,
+                                       const unsigned char *const *in, const unsigned long *inlen,
+                                       unsigned char *const *out);
+
 typedef int (*xsalsa20_keystream_fn)(xsalsa20_state *st, 
                                      unsigned char *out, unsigned long outlen);
 
@@ -66,6 +117,39 @@ int xsalsa20_setup(xsalsa20_state *st,
                    const unsigned char *nonce, unsigned long noncelen,
                    int rounds);
 
+/**
+ * Initialize several XSalsa20 contexts that share one key
+ * The HSalsa20 subkey derivations run side by side on the SIMD lanes.
+ * @param st        [out] Array of count XSalsa20 states
+ * @param count     The number of contexts to initialize
+ * @param key       The secret key (must be 32 bytes)
+ * @param keylen    The length of the secret key (must be 32)
+ * @param nonces    count nonces of 24 bytes each, stored back to back
+ * @param noncelen  The length of each nonce (must be 24)
+ * @param rounds    Number of rounds (must be evenly divisible by 2, default is 20)
+ * @return XSALSA_OK if successful
+ */
+int xsalsa20_setup_batch(xsalsa20_state *st, unsigned long count,
+                         const unsigned char *key, unsigned long keylen,
+                         const unsigned char *nonces, unsigned long noncelen,
+                         int rounds);
+
+/**
+ * Initialize several XSalsa20 contexts, each with its own key and nonce
+ * @param st        [out] Array of count XSalsa20 states
+ * @param count     The number of contexts to initialize
+ * @param keys      count keys of 32 bytes each, stored back to back
+ * @param keylen    The length of each key (must be 32)
+ * @param nonces    count nonces of 24 bytes each, stored back to back
+ * @param noncelen  The length of each nonce (must be 24)
+ * @param rounds    Number of rounds (must be evenly divisible by 2, default is 20)
+ * @return XSALSA_OK if successful
+ */
+int xsalsa20_setup_batch_keys(xsalsa20_state *st, unsigned long count,
+                              const unsigned char *keys, unsigned long keylen,
+                              const unsigned char *nonces, unsigned long noncelen,
+                              int rounds);
+
 /**
  * Encrypt or decrypt data with XSalsa20
  * @param st      The XSalsa20 state (must be initialized with xsalsa20_setup)
@@ -78,6 +162,62 @@ int xsalsa20_crypt(xsalsa20_state *st,
                    const unsigned char *in, unsigned long inlen, 
                    unsigned char *out);
 
+/**
+ * Encrypt or decrypt several independent streams in one SIMD pass
+ * Each stream runs in its own vector lane, so short unrelated messages
+ * still use the full vector width. Every job leaves its state exactly
+ * as xsalsa20_crypt on that job alone would, and runs on the implementation
+ * its context was set up with; consecutive jobs pinned to the same one share a pass.
+ * @param jobs    Array of count jobs, each with its own initialized state
+ * @param count   The number of jobs
+ * @return XSALSA_OK if successful, otherwise the first error met by a job
+ */
+int xsalsa20_crypt_multi(xsalsa20_job *jobs, unsigned long count);
+
+/**
+ * Encrypt or decrypt a batch of packets that share one key
+ * Each packet has its own nonce. Subkey derivation and keystream
+ * generation both run across the batch inside the selected kernel,
+ * and no state is left behind. Like xsalsa20_memory it takes no context,
+ * so it uses the current implementation rather than a pinned one.
+ * @param key       The secret key (must be 32 bytes)
+ * @param keylen    The length of the secret key (must be 32)
+ * @param nonces    count nonces of 24 bytes each, stored back to back
+ * @param noncelen  The length of each nonce (must be 24)
+ * @param rounds    Number of rounds (must be evenly divisible by 2, default is 20)
+ * @param count     The number of packets
+ * @param in        Array of count input pointers
+ * @param inlen     Array of count input lengths
+ * @param out       [out] Array of count output pointers (same lengths as input)
+ * @return XSALSA_OK if successful, otherwise the first error met by a packet
+ */
+int xsalsa20_crypt_batch(const unsigned char *key, unsigned long keylen,
+                         const unsigned char *nonces, unsigned long noncelen,
+                         int rounds, unsigned long count,
+                         const unsigned char *const *in, const unsigned long *inlen,
+                         unsigned char *const *out);
+
+/**
+ * Encrypt or decrypt a large buffer on several threads
+ * Inputs of at least XSALSA_PARALLEL_THRESHOLD bytes are split into
+ * counter-aligned ranges that run on an internal thread pool with the
+ * selected kernel. The state ends up exactly as after xsalsa20_crypt.
+ * @param st      The XSalsa20 state (must be initialized with xsalsa20_setup)
+ * @param in      The input data
+ * @param inlen   The length of the input data
+ * @param out     [out] The output data (same length as input)
+ * @return XSALSA_OK if successful
+ */
+int xsalsa20_crypt_parallel(xsalsa20_state *st,
+                            const unsigned char *in, unsigned long inlen,
+                            unsigned char *out);
+
+/**
+ * Set the number of threads used by xsalsa20_crypt_parallel
+ * @param threads  The thread count including the caller (0 = one per online CPU)
+ */
+void xsalsa20_set_threads(unsigned int threads);
+
 /**
  * Generate keystream bytes
  * @param st      The XSalsa20 state (must be initialized with xsalsa20_setup)
@@ -88,6 +228,37 @@ int xsalsa20_crypt(xsalsa20_state *st,
 int xsalsa20_keystream(xsalsa20_state *st, 
                        unsigned char *out, unsigned long outlen);
 
+/**
+ * Move the stream to an absolute byte offset
+ * The counter is set directly, so seeking costs at most one block
+ * of keystream whatever the distance.
+ * @param st      The XSalsa20 state (must be initialized with xsalsa20_setup)
+ * @param offset  The keystream byte offset to continue from
+ * @return XSALSA_OK if successful
+ */
+int xsalsa20_seek(xsalsa20_state *st, ulong64 offset);
+
+/**
+ * Get the current byte offset of the stream
+ * @param st      The XSalsa20 state
+ * @return The offset of the next keystream byte
+ */
+ulong64 xsalsa20_tell(const xsalsa20_state *st);
+
+/**
+ * Encrypt or decrypt data at an absolute stream offset
+ * The context is left unchanged, so calls may come in any order.
+ * @param st      The XSalsa20 state (must be initialized with xsalsa20_setup)
+ * @param offset  The keystream byte offset of in[0]
+ * @param in      The input data
+ * @param inlen   The length of the input data
+ * @param out     [out] The output data (same length as input)
+ * @return XSALSA_OK if successful
+ */
+int xsalsa20_crypt_at(const xsalsa20_state *st, ulong64 offset,
+                      const unsigned char *in, unsigned long inlen,
+                      unsigned char *out);
+
 /**
  * Clean up XSalsa20 state
  * @param st      The XSalsa20 state to clean up
@@ -113,10 +284,84 @@ int xsalsa20_memory(const unsigned char *key, unsigned long keylen,
                     unsigned char *dataout);
 
 /**
- * Reset the last selected implementation
+ * Authenticated encryption (NaCl crypto_secretbox_xsalsa20poly1305)
+ * The Poly1305 key is taken from the first 32 keystream bytes and the
+ * message is encrypted from byte 32 on. Each chunk is MACed right after
+ * it is encrypted, while the ciphertext is still in L1.
+ * @param key       The secret key (must be 32 bytes)
+ * @param keylen    The length of the secret key (must be 32)
+ * @param nonce     The nonce (must be 24 bytes, never reused with one key)
+ * @param noncelen  The length of the nonce (must be 24)
+ * @param in        The plaintext
+ * @param inlen     The length of the plaintext
+ * @param out       [out] The ciphertext (same length as plaintext)
+ * @param tag       [out] The 16-byte authentication tag
+ * @return XSALSA_OK if successful
+ */
+int xsalsa20_secretbox(const unsigned char *key, unsigned long keylen,
+                       const unsigned char *nonce, unsigned long noncelen,
+                       const unsigned char *in, unsigned long inlen,
+                       unsigned char *out, unsigned char *tag);
+
+/**
+ * Verify and decrypt a secretbox
+ * On a tag mismatch the output is wiped and XSALSA_AUTH_FAILED returned.
+ * @param key       The secret key (must be 32 bytes)
+ * @param keylen    The length of the secret key (must be 32)
+ * @param nonce     The nonce (must be 24 bytes)
+ * @param noncelen  The length of the nonce (must be 24)
+ * @param in        The ciphertext
+ * @param inlen     The length of the ciphertext
+ * @param tag       The 16-byte authentication tag
+ * @param out       [out] The plaintext (same length as ciphertext)
+ * @return XSALSA_OK if successful, XSALSA_AUTH_FAILED if the tag does not match
+ */
+int xsalsa20_secretbox_open(const unsigned char *key, unsigned long keylen,
+                            const unsigned char *nonce, unsigned long noncelen,
+                            const unsigned char *in, unsigned long inlen,
+                            const unsigned char *tag, unsigned char *out);
+
+/**
+ * Set the implementation selection policy for new contexts and stateless calls
+ * @param policy    XSALSA_POLICY_THROUGHPUT or XSALSA_POLICY_NO_ZMM, optionally
+ *                  or-ed with XSALSA_POLICY_ADAPTIVE (default: THROUGHPUT | ADAPTIVE)
+ */
+void xsalsa20_set_impl_policy(int policy);
+
+/**
+ * Get the implementation selection policy
+ * @return The value last passed to xsalsa20_set_impl_policy
+ */
+int xsalsa20_get_impl_policy(void);
+
+/**
+ * Get the implementation xsalsa20_crypt uses for calls of a given length
+ * on contexts set up now (runs the calibration if it is still pending)
+ * @param len       The length of the call
+ * @return XSALSA_IMPL_* of the kernel for len
+ */
+int xsalsa20_get_size_class_impl(unsigned long len);
+
+/**
+ * Re-resolve the implementation used by new contexts and stateless calls.
+ * Contexts that are already set up keep the implementation they were set up with.
  */
 void xsalsa20_reset_impl(void);
 
+/**
+ * Get the hot-path counters summed over all threads, including threads that
+ * have exited. Counting is only compiled in with the ENABLE_STATS build option;
+ * counters of threads inside a call at the same time may lag by that call.
+ * @param stats     [out] The counters of every implementation
+ * @return XSALSA_OK if successful, XSALSA_ERROR (stats zeroed) if built without stats
+ */
+int xsalsa20_get_stats(xsalsa20_stats *stats);
+
+/**
+ * Reset the hot-path counters of every thread to zero
+ */
+void xsalsa20_reset_stats(void);
+
 /**
  * Run self-test
  * @return XSALSA_OK if successful
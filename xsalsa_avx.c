@@ -1,4 +1,6 @@
 #include "xsalsa.h"
+#include "xsalsa_stats.h"
+#include "xsalsa_rounds.h"
 #include <immintrin.h>
 #include <string.h>
 #include <stdio.h>
@@ -101,31 +103,68 @@ static inline void s_xsalsa20_doubleround_avx(ulong32 *x, int rounds)
    }
 }
 
-/* Internal function: Salsa20 block generation with AVX */
-static void s_salsa20_block_avx(unsigned char *output, const ulong32 *input, int rounds)
+/* Rotate every 32-bit lane of a 128-bit vector left */
+#define ROL128(v, n) _mm_or_si128(_mm_slli_epi32((v), (n)), _mm_srli_epi32((v), 32 - (n)))
+
+/* Internal function: Salsa20 block generation with AVX - a single block
+   kept as four 128-bit diagonal rows (x0,x5,x10,x15), (x4,x9,x14,x3),
+   (x8,x13,x2,x7), (x12,x1,x6,x11); lane shuffles switch between the
+   column and row round layouts. The block is XOR-ed with in (or stored as-is
+   when in is NULL) into out. */
+static XSALSA_INLINE void s_salsa20_block_avx(unsigned char *output, const unsigned char *in,
+                                              const ulong32 *input, int rounds)
 {
-   ulong32 x[16];
-   int i;
-   memcpy(x, input, sizeof(x));
-   
-   for (i = rounds; i > 0; i -= 2) {
-      QUARTERROUND( 0, 4, 8,12)
-      QUARTERROUND( 5, 9,13, 1)
-      QUARTERROUND(10,14, 2, 6)
-      QUARTERROUND(15, 3, 7,11)
-      QUARTERROUND( 0, 1, 2, 3)
-      QUARTERROUND( 5, 6, 7, 4)
-      QUARTERROUND(10,11, 8, 9)
-      QUARTERROUND(15,12,13,14)
-   }
-   
-   /* Use AVX for the final addition and store */
-   for (i = 0; i < 16; i += 4) {
-      __m128i input_vec = _mm_set_epi32(input[i+3], input[i+2], input[i+1], input[i]);
-      __m128i state_vec = _mm_set_epi32(x[i+3], x[i+2], x[i+1], x[i]);
-      __m128i sum_vec = _mm_add_epi32(state_vec, input_vec);
-      _mm_storeu_si128((__m128i*)(output + 4 * i), sum_vec);
+   __m128i a, b, c, d, a0, b0, c0, d0, t;
+   __m128i r0, r1, r2, r3;
+
+   a = a0 = _mm_set_epi32((int)input[15], (int)input[10], (int)input[ 5], (int)input[ 0]);
+   b = b0 = _mm_set_epi32((int)input[ 3], (int)input[14], (int)input[ 9], (int)input[ 4]);
+   c = c0 = _mm_set_epi32((int)input[ 7], (int)input[ 2], (int)input[13], (int)input[ 8]);
+   d = d0 = _mm_set_epi32((int)input[11], (int)input[ 6], (int)input[ 1], (int)input[12]);
+
+   XSALSA_ROUNDS(rounds,
+      /* columnround */
+      b = _mm_xor_si128(b, ROL128(_mm_add_epi32(a, d),  7));
+      c = _mm_xor_si128(c, ROL128(_mm_add_epi32(b, a),  9));
+      d = _mm_xor_si128(d, ROL128(_mm_add_epi32(c, b), 13));
+      a = _mm_xor_si128(a, ROL128(_mm_add_epi32(d, c), 18));
+      /* to row layout: (x1,x6,x11,x12), (x2,x7,x8,x13), (x3,x4,x9,x14) */
+      t = b;
+      b = _mm_shuffle_epi32(d, 0x39);
+      c = _mm_shuffle_epi32(c, 0x4E);
+      d = _mm_shuffle_epi32(t, 0x93);
+      /* rowround */
+      b = _mm_xor_si128(b, ROL128(_mm_add_epi32(a, d),  7));
+      c = _mm_xor_si128(c, ROL128(_mm_add_epi32(b, a),  9));
+      d = _mm_xor_si128(d, ROL128(_mm_add_epi32(c, b), 13));
+      a = _mm_xor_si128(a, ROL128(_mm_add_epi32(d, c), 18));
+      /* back to column layout */
+      t = b;
+      b = _mm_shuffle_epi32(d, 0x39);
+      c = _mm_shuffle_epi32(c, 0x4E);
+      d = _mm_shuffle_epi32(t, 0x93);
+   );
+
+   a = _mm_add_epi32(a, a0);
+   b = _mm_add_epi32(b, b0);
+   c = _mm_add_epi32(c, c0);
+   d = _mm_add_epi32(d, d0);
+
+   /* Gather the diagonals back into rows of the output block */
+   r0 = _mm_blend_epi16(_mm_blend_epi16(a, d, 0x0C), _mm_blend_epi16(c, b, 0xC0), 0xF0);
+   r1 = _mm_blend_epi16(_mm_blend_epi16(b, a, 0x0C), _mm_blend_epi16(d, c, 0xC0), 0xF0);
+   r2 = _mm_blend_epi16(_mm_blend_epi16(c, b, 0x0C), _mm_blend_epi16(a, d, 0xC0), 0xF0);
+   r3 = _mm_blend_epi16(_mm_blend_epi16(d, c, 0x0C), _mm_blend_epi16(b, a, 0xC0), 0xF0);
+   if (in != NULL) {
+      r0 = _mm_xor_si128(r0, _mm_loadu_si128((const __m128i*)(in +  0)));
+      r1 = _mm_xor_si128(r1, _mm_loadu_si128((const __m128i*)(in + 16)));
+      r2 = _mm_xor_si128(r2, _mm_loadu_si128((const __m128i*)(in + 32)));
+      r3 = _mm_xor_si128(r3, _mm_loadu_si128((const __m128i*)(in + 48)));
    }
+   _mm_storeu_si128((__m128i*)(output +  0), r0);
+   _mm_storeu_si128((__m128i*)(output + 16), r1);
+   _mm_storeu_si128((__m128i*)(output + 32), r2);
+   _mm_storeu_si128((__m128i*)(output + 48), r3);
 }
 
 /* Internal function: Zero memory */
@@ -138,7 +177,7 @@ static inline void zeromem(volatile void *out, size_t outlen)
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
 /* AVX vectorized quarter round - processes 4 blocks in parallel */
-static void quarterround_avx_4blocks(__m128i *x, int a, int b, int c, int d)
+static XSALSA_INLINE void quarterround_avx_4blocks(__m128i *x, int a, int b, int c, int d)
 {
    __m128i temp;
    
@@ -171,24 +210,68 @@ static void quarterround_avx_4blocks(__m128i *x, int a, int b, int c, int d)
    ));
 }
 
-/* AVX vectorized Salsa20 block generation - processes 4 blocks at once */
-static void s_salsa20_block_avx_4blocks(unsigned char *output, const ulong32 *input, int rounds)
+/* AVX 4x4 transpose of 32-bit words: r[i] holds word i of blocks 0..3 on
+   entry, r[k] holds the same 4 words of block k on exit */
+static inline void transpose4x4_avx(__m128i *r)
+{
+   __m128i t0, t1, t2, t3;
+
+   t0 = _mm_unpacklo_epi32(r[0], r[1]);
+   t1 = _mm_unpackhi_epi32(r[0], r[1]);
+   t2 = _mm_unpacklo_epi32(r[2], r[3]);
+   t3 = _mm_unpackhi_epi32(r[2], r[3]);
+
+   r[0] = _mm_unpacklo_epi64(t0, t2);
+   r[1] = _mm_unpackhi_epi64(t0, t2);
+   r[2] = _mm_unpacklo_epi64(t1, t3);
+   r[3] = _mm_unpackhi_epi64(t1, t3);
+}
+
+/* Internal function: splat the context for the 4-block kernel, one vector per
+   state word; lane k of words 8 and 9 holds the 64-bit counter input[8..9] + k */
+static inline void s_salsa20_lanes_avx(__m128i *v, const ulong32 *input)
+{
+   const __m128i sign = _mm_set1_epi32((int)0x80000000);
+   __m128i ctr;
+   int i;
+
+   for (i = 0; i < 16; i++) {
+      v[i] = _mm_set1_epi32((int)input[i]);
+   }
+   ctr = _mm_add_epi32(v[8], _mm_set_epi32(3, 2, 1, 0));
+   /* unsigned counter < input[8] means the low word wrapped: carry into word 9 */
+   v[9] = _mm_sub_epi32(v[9], _mm_cmpgt_epi32(_mm_xor_si128(v[8], sign), _mm_xor_si128(ctr, sign)));
+   v[8] = ctr;
+}
+
+/* Internal function: advance the counter lanes of a splatted context by 4 blocks */
+static inline void s_salsa20_lanes_step_avx(__m128i *v)
+{
+   const __m128i sign = _mm_set1_epi32((int)0x80000000);
+   const __m128i step = _mm_set1_epi32(4);
+
+   v[8] = _mm_add_epi32(v[8], step);
+   /* unsigned counter < 4 means the low word wrapped: carry into word 9 */
+   v[9] = _mm_sub_epi32(v[9], _mm_cmpgt_epi32(_mm_xor_si128(step, sign), _mm_xor_si128(v[8], sign)));
+}
+
+/* AVX vectorized Salsa20 block generation - processes 4 blocks at once.
+   v is the context splatted by s_salsa20_lanes_avx; lane k of every
+   vector belongs to the block with the counter in lane k of v[8..9].
+   The 4 keystream blocks are XOR-ed with in (or stored as-is when in is NULL)
+   into 256 contiguous bytes at out. */
+static XSALSA_INLINE void s_salsa20_block_avx_4blocks(unsigned char *out, const unsigned char *in,
+                                                      const __m128i *v, int rounds)
 {
    __m128i x[16];  /* 16 __m128i = 64 32-bit values (4 blocks) */
-   int i, j;
-   
-   /* Load 4 blocks into AVX vectors */
-   for (i = 0; i < 16; i += 4) {
-      for (j = 0; j < 4; j++) {
-         x[i+j] = _mm_set_epi32(
-            input[i*4 + j*4 + 3], input[i*4 + j*4 + 2],
-            input[i*4 + j*4 + 1], input[i*4 + j*4 + 0]
-         );
-      }
+   int i, k;
+
+   for (i = 0; i < 16; i++) {
+      x[i] = v[i];
    }
-   
+
    /* Process rounds */
-   for (i = rounds; i > 0; i -= 2) {
+   XSALSA_ROUNDS(rounds,
       /* columnround */
       quarterround_avx_4blocks(x,  0,  4,  8, 12);
       quarterround_avx_4blocks(x,  5,  9, 13,  1);
@@ -199,18 +282,27 @@ static void s_salsa20_block_avx_4blocks(unsigned char *output, const ulong32 *in
       quarterround_avx_4blocks(x,  5,  6,  7,  4);
       quarterround_avx_4blocks(x, 10, 11,  8,  9);
       quarterround_avx_4blocks(x, 15, 12, 13, 14);
+   );
+   
+   /* Feed-forward: add the input state back */
+   for (i = 0; i < 16; i++) {
+      x[i] = _mm_add_epi32(x[i], v[i]);
    }
    
-   /* Store results */
+   /* De-interleave lanes into blocks, 4 words (16 bytes) at a time */
    for (i = 0; i < 16; i += 4) {
-      for (j = 0; j < 4; j++) {
-         _mm_storeu_si128((__m128i*)(output + (i*4 + j*4) * 4), x[i+j]);
+      transpose4x4_avx(x + i);
+      for (k = 0; k < 4; k++) {
+         __m128i v = x[i + k];
+         if (in != NULL) {
+            v = _mm_xor_si128(v, _mm_loadu_si128((const __m128i*)(in + k * 64 + i * 4)));
+         }
+         _mm_storeu_si128((__m128i*)(out + k * 64 + i * 4), v);
       }
    }
 }
 
 
-
 /**
    Initialize an XSalsa20 context (AVX version)
    @param st        [out] The destination of the XSalsa20 state
@@ -284,9 +376,10 @@ int xsalsa20_setup_avx(xsalsa20_state *st, const unsigned char *key, unsigned lo
    st->rounds = rounds;
    st->ksleft = 0;
    st->ivlen  = 24;           /* set switch to say nonce/IV has been loaded */
+   XSALSA_STAT_ADD(XSALSA_IMPL_AVX, setups, 1);
 
    /* Use AVX for zeroing memory */
-   for (i = 0; i < 64; i += 16) {
+   for (i = 0; i < 64; i += 4) {
       _mm_storeu_si128((__m128i*)(x + i), _mm_setzero_si128());
    }
    for (i = 0; i < 32; i += 16) {
@@ -296,17 +389,158 @@ int xsalsa20_setup_avx(xsalsa20_state *st, const unsigned char *key, unsigned lo
    return XSALSA_OK;
 }
 
+/* Internal function: HSalsa20 for up to 4 contexts at once, one per lane.
+   Lanes past the last context repeat its key/nonce and are discarded. */
+static void s_xsalsa20_setup_lanes_avx(xsalsa20_state *st, unsigned long lanes,
+                                       const unsigned char *keys, unsigned long keystride,
+                                       const unsigned char *nonces, int rounds)
+{
+   static const int kwi[] = {1, 2, 3, 4, 11, 12, 13, 14};  /* words loaded from the key */
+   _Alignas(16) ulong32 w[16][4];   /* lane-major key/nonce words */
+   __m128i x[16];
+   ulong32 c[4];
+   unsigned long k;
+   int i;
+
+   LOAD32L(c[0], constants +  0);
+   LOAD32L(c[1], constants +  4);
+   LOAD32L(c[2], constants +  8);
+   LOAD32L(c[3], constants + 12);
+
+   for (k = 0; k < 4; k++) {
+      unsigned long src = k < lanes ? k : lanes - 1;
+      const unsigned char *key = keys + src * keystride;
+      const unsigned char *nonce = nonces + src * 24;
+      if (keystride != 0) {
+         for (i = 0; i < 8; i++) {
+            LOAD32L(w[kwi[i]][k], key + 4 * i);
+         }
+      }
+      for (i = 0; i < 4; i++) {
+         LOAD32L(w[6 + i][k], nonce + 4 * i);
+      }
+   }
+
+   /* load the state to "hash" the keys */
+   x[ 0] = _mm_set1_epi32((int)c[0]);
+   x[ 5] = _mm_set1_epi32((int)c[1]);
+   x[10] = _mm_set1_epi32((int)c[2]);
+   x[15] = _mm_set1_epi32((int)c[3]);
+   for (i = 0; i < 8; i++) {
+      if (keystride != 0) {
+         x[kwi[i]] = _mm_load_si128((const __m128i*)w[kwi[i]]);
+      } else {
+         /* shared key: the same word in every lane */
+         ulong32 kw;
+         LOAD32L(kw, keys + 4 * i);
+         x[kwi[i]] = _mm_set1_epi32((int)kw);
+      }
+   }
+   for (i = 6; i < 10; i++) {
+      x[i] = _mm_load_si128((const __m128i*)w[i]);
+   }
+
+   /* use modified salsa20 doubleround (no final addition) */
+   for (i = rounds; i > 0; i -= 2) {
+      /* columnround */
+      quarterround_avx_4blocks(x,  0,  4,  8, 12);
+      quarterround_avx_4blocks(x,  5,  9, 13,  1);
+      quarterround_avx_4blocks(x, 10, 14,  2,  6);
+      quarterround_avx_4blocks(x, 15,  3,  7, 11);
+      /* rowround */
+      quarterround_avx_4blocks(x,  0,  1,  2,  3);
+      quarterround_avx_4blocks(x,  5,  6,  7,  4);
+      quarterround_avx_4blocks(x, 10, 11,  8,  9);
+      quarterround_avx_4blocks(x, 15, 12, 13, 14);
+   }
+
+   /* extract the subkeys: words 0, 5, 10, 15, 6, 7, 8, 9 */
+   _mm_store_si128((__m128i*)w[ 1], x[ 0]);
+   _mm_store_si128((__m128i*)w[ 2], x[ 5]);
+   _mm_store_si128((__m128i*)w[ 3], x[10]);
+   _mm_store_si128((__m128i*)w[ 4], x[15]);
+   _mm_store_si128((__m128i*)w[11], x[ 6]);
+   _mm_store_si128((__m128i*)w[12], x[ 7]);
+   _mm_store_si128((__m128i*)w[13], x[ 8]);
+   _mm_store_si128((__m128i*)w[14], x[ 9]);
+
+   /* load the final initial states */
+   for (k = 0; k < lanes; k++) {
+      for (i = 0; i < 8; i++) {
+         st[k].input[kwi[i]] = w[kwi[i]][k];
+      }
+      st[k].input[ 0] = c[0];
+      st[k].input[ 5] = c[1];
+      st[k].input[10] = c[2];
+      st[k].input[15] = c[3];
+      LOAD32L(st[k].input[ 6], nonces + k * 24 + 16);
+      LOAD32L(st[k].input[ 7], nonces + k * 24 + 20);
+      st[k].input[ 8] = 0;
+      st[k].input[ 9] = 0;
+      st[k].rounds = rounds;
+      st[k].ksleft = 0;
+      st[k].ivlen  = 24;
+   }
+
+   /* Use AVX for zeroing memory */
+   for (i = 0; i < 16; i++) {
+      _mm_store_si128((__m128i*)w[i], _mm_setzero_si128());
+      _mm_store_si128(&x[i], _mm_setzero_si128());
+   }
+}
+
+/**
+   Initialize several XSalsa20 contexts at once (AVX version)
+   @param st        [out] The destinations of the XSalsa20 states (count entries)
+   @param count     The number of contexts to initialize
+   @param keys      The secret key(s)
+   @param keystride The distance between consecutive keys (0 to share one key)
+   @param keylen    The length of each secret key, must be 32 (octets)
+   @param nonces    The nonces, count * 24 octets back to back
+   @param noncelen  The length of each nonce, must be 24 (octets)
+   @param rounds    Number of rounds (must be evenly divisible by 2, default is 20)
+   @return XSALSA_OK if successful
+*/
+int xsalsa20_setup_batch_avx(xsalsa20_state *st, unsigned long count,
+                             const unsigned char *keys, unsigned long keystride, unsigned long keylen,
+                             const unsigned char *nonces, unsigned long noncelen,
+                             int rounds)
+{
+   unsigned long n;
+
+   if (count == 0) return XSALSA_OK; /* nothing to do */
+
+   XSALSA_ARGCHK(st        != NULL);
+   XSALSA_ARGCHK(keys      != NULL);
+   XSALSA_ARGCHK(keylen    == 32);
+   XSALSA_ARGCHK(nonces    != NULL);
+   XSALSA_ARGCHK(noncelen  == 24);
+   if (rounds == 0) rounds = 20;
+   XSALSA_ARGCHK(rounds % 2 == 0);     /* number of rounds must be evenly divisible by 2 */
+
+   /* 4 HSalsa20 permutations per pass, one per lane */
+   for (n = 0; n < count; n += 4) {
+      s_xsalsa20_setup_lanes_avx(st + n, MIN(count - n, 4), keys + n * keystride, keystride,
+                                 nonces + n * 24, rounds);
+   }
+
+   XSALSA_STAT_ADD(XSALSA_IMPL_AVX, setups, count);
+   return XSALSA_OK;
+}
+
 /**
    Encrypt (or decrypt) bytes of ciphertext (or plaintext) with XSalsa20 (AVX version)
    @param st      The XSalsa20 state
    @param in      The plaintext (or ciphertext)
    @param inlen   The length of the input (octets)
    @param out     [out] The ciphertext (or plaintext), length inlen
+   @param rounds  The number of rounds (a constant in the _r8/_r12/_r20 entry points)
    @return XSALSA_OK if successful
 */
-int xsalsa20_crypt_avx(xsalsa20_state *st, const unsigned char *in, unsigned long inlen, unsigned char *out)
+static XSALSA_INLINE int s_xsalsa20_crypt_avx(xsalsa20_state *st, const unsigned char *in, unsigned long inlen,
+                                              unsigned char *out, int rounds)
 {
-   unsigned char buf[256];  /* Buffer for 4 blocks (4 * 64 = 256 bytes) */
+   __m128i v[16];           /* Context splatted for the bulk loop */
    unsigned long i, j;
 
    if (inlen == 0) return XSALSA_OK; /* nothing to do */
@@ -315,52 +549,31 @@ int xsalsa20_crypt_avx(xsalsa20_state *st, const unsigned char *in, unsigned lon
    XSALSA_ARGCHK(in        != NULL);
    XSALSA_ARGCHK(out       != NULL);
    XSALSA_ARGCHK(st->ivlen == 24);
+   XSALSA_STAT_CALL(XSALSA_IMPL_AVX, inlen);
 
    if (st->ksleft > 0) {
       j = MIN(st->ksleft, inlen);
+      XSALSA_STAT_ADD(XSALSA_IMPL_AVX, drain_bytes, j);
       for (i = 0; i < j; ++i, st->ksleft--) out[i] = in[i] ^ st->kstream[64 - st->ksleft];
       inlen -= j;
       if (inlen == 0) return XSALSA_OK;
       out += j;
       in  += j;
    }
+   XSALSA_STAT_BLOCKS(XSALSA_IMPL_AVX, inlen, 256);
    
    /* Process data in 4-block chunks for better AVX utilization */
+   if (inlen >= 256) s_salsa20_lanes_avx(v, st->input);
    while (inlen >= 256) {
-      /* Generate 4 blocks of keystream */
-      ulong32 input_blocks[64];  /* 4 blocks * 16 words each */
-      int block;
-      
-      /* Prepare 4 blocks with consecutive counters */
-      for (block = 0; block < 4; block++) {
-         for (i = 0; i < 16; i++) {
-            input_blocks[block * 16 + i] = st->input[i];
-         }
-         /* Increment counter for next block */
-         if (block < 3) {
-            input_blocks[block * 16 + 8]++;
-            if (input_blocks[block * 16 + 8] == 0) {
-               input_blocks[block * 16 + 9]++;
-            }
-         }
-      }
-      
-      /* Generate keystream for all 4 blocks at once */
-      s_salsa20_block_avx_4blocks(buf, input_blocks, st->rounds);
-      
-      /* XOR with input using AVX */
-      for (i = 0; i < 256; i += 16) {
-         __m128i in_vec = _mm_loadu_si128((__m128i*)(in + i));
-         __m128i buf_vec = _mm_loadu_si128((__m128i*)(buf + i));
-         __m128i out_vec = _mm_xor_si128(in_vec, buf_vec);
-         _mm_storeu_si128((__m128i*)(out + i), out_vec);
-      }
+      /* Generate 4 blocks of keystream and XOR them straight into out */
+      s_salsa20_block_avx_4blocks(out, in, v, rounds);
       
-      /* Update counter for next iteration */
+      /* Update counter for next iteration: the lanes in-vector, and the context */
+      s_salsa20_lanes_step_avx(v);
       st->input[8] += 4;
       if (st->input[8] < 4) {  /* Overflow check */
          st->input[9]++;
-         if (st->input[9] == 0) return XSALSA_OVERFLOW;
+         if (st->input[9] == 0) return XSALSA_STAT_OVERFLOW(XSALSA_IMPL_AVX);
       }
       
       inlen -= 256;
@@ -368,40 +581,212 @@ int xsalsa20_crypt_avx(xsalsa20_state *st, const unsigned char *in, unsigned lon
       in  += 256;
    }
    
-   /* Handle remaining data with single blocks */
-   for (;;) {
-     s_salsa20_block_avx(buf, st->input, st->rounds);
+   /* Whole blocks go straight to out; the keystream of a final partial block
+      goes to st->kstream, which keeps the part left unused */
+   while (inlen >= 64) {
+     s_salsa20_block_avx(out, in, st->input, rounds);
      /* XSalsa20: 64-bit counter, increment 64-bit counter */
-     if (0 == ++st->input[8] && 0 == ++st->input[9]) return XSALSA_OVERFLOW;
-     if (inlen <= 64) {
-       /* Use AVX for XOR operations when possible */
-       if (inlen >= 16) {
-          for (i = 0; i < inlen - 15; i += 16) {
-             __m128i in_vec = _mm_loadu_si128((__m128i*)(in + i));
-             __m128i buf_vec = _mm_loadu_si128((__m128i*)(buf + i));
-             __m128i out_vec = _mm_xor_si128(in_vec, buf_vec);
-             _mm_storeu_si128((__m128i*)(out + i), out_vec);
-          }
-          /* Handle remaining bytes */
-          for (; i < inlen; ++i) out[i] = in[i] ^ buf[i];
-       } else {
-          for (i = 0; i < inlen; ++i) out[i] = in[i] ^ buf[i];
-       }
-       st->ksleft = 64 - inlen;
-       for (i = inlen; i < 64; ++i) st->kstream[i] = buf[i];
-       return XSALSA_OK;
-     }
-     /* Use AVX for XOR operations */
-     for (i = 0; i < 64; i += 16) {
-        __m128i in_vec = _mm_loadu_si128((__m128i*)(in + i));
-        __m128i buf_vec = _mm_loadu_si128((__m128i*)(buf + i));
-        __m128i out_vec = _mm_xor_si128(in_vec, buf_vec);
-        _mm_storeu_si128((__m128i*)(out + i), out_vec);
-     }
+     if (0 == ++st->input[8] && 0 == ++st->input[9]) return XSALSA_STAT_OVERFLOW(XSALSA_IMPL_AVX);
      inlen -= 64;
      out += 64;
      in  += 64;
    }
+   if (inlen == 0) return XSALSA_OK;   /* ended on a block boundary, nothing to buffer */
+
+   s_salsa20_block_avx(st->kstream, NULL, st->input, rounds);
+   if (0 == ++st->input[8] && 0 == ++st->input[9]) return XSALSA_STAT_OVERFLOW(XSALSA_IMPL_AVX);
+   /* Use AVX for XOR operations when possible */
+   for (i = 0; i + 16 <= inlen; i += 16) {
+      __m128i ks_vec = _mm_loadu_si128((const __m128i*)(st->kstream + i));
+      __m128i in_vec = _mm_loadu_si128((const __m128i*)(in + i));
+      _mm_storeu_si128((__m128i*)(out + i), _mm_xor_si128(in_vec, ks_vec));
+   }
+   for (; i < inlen; ++i) out[i] = in[i] ^ st->kstream[i];
+   st->ksleft = 64 - inlen;
+   return XSALSA_OK;
+}
+
+XSALSA_CRYPT_ENTRIES(avx)
+
+/**
+   Encrypt (or decrypt) several independent streams at once (AVX version)
+   Every stream occupies one of the 4 lanes; a lane whose stream has
+   finished is masked out and refilled with the next pending job. Jobs
+   whose round count differs from the first job run on their own.
+   @param jobs    The jobs (state, input, length, output)
+   @param count   The number of jobs
+   @return XSALSA_OK if successful, otherwise the first error met by a job
+*/
+int xsalsa20_crypt_multi_avx(xsalsa20_job *jobs, unsigned long count)
+{
+   _Alignas(16) ulong32 w[16][4];   /* input state of every lane, word-major */
+   xsalsa20_job lane[4];             /* remaining work of every lane */
+   unsigned char blk[64];
+   __m128i x[16];
+   unsigned long next = 0, i, j;
+   unsigned long blocks = 0;         /* lane blocks, counted once at the end */
+   unsigned int active = 0;           /* bit k set: lane k holds a stream */
+   int rounds = 0;
+   int err = XSALSA_OK, e;
+   int k;
+
+   if (count == 0) return XSALSA_OK; /* nothing to do */
+
+   XSALSA_ARGCHK(jobs != NULL);
+
+   for (;;) {
+      /* Refill idle lanes with pending jobs */
+      for (k = 0; k < 4 && next < count; k++) {
+         if (active & (1u << k)) continue;
+         while (next < count) {
+            xsalsa20_job *job = &jobs[next++];
+            xsalsa20_state *st = job->st;
+            if (job->inlen == 0) continue;
+            if (st == NULL || job->in == NULL || job->out == NULL || st->ivlen != 24) {
+               if (err == XSALSA_OK) err = XSALSA_INVALID_ARG;
+               continue;
+            }
+            if (rounds == 0) rounds = st->rounds;
+            if (st->rounds != rounds) {
+               e = xsalsa20_crypt_avx(st, job->in, job->inlen, job->out);
+               if (err == XSALSA_OK) err = e;
+               continue;
+            }
+            lane[k] = *job;
+            XSALSA_STAT_CALL(XSALSA_IMPL_AVX, job->inlen);
+            if (st->ksleft > 0) {
+               j = MIN(st->ksleft, lane[k].inlen);
+               XSALSA_STAT_ADD(XSALSA_IMPL_AVX, drain_bytes, j);
+               for (i = 0; i < j; ++i, st->ksleft--) lane[k].out[i] = lane[k].in[i] ^ st->kstream[64 - st->ksleft];
+               lane[k].inlen -= j;
+               if (lane[k].inlen == 0) continue;
+               lane[k].out += j;
+               lane[k].in  += j;
+            }
+            for (i = 0; i < 16; i++) w[i][k] = st->input[i];
+            active |= 1u << k;
+            break;
+         }
+      }
+      if (active == 0) break;
+
+      /* One keystream block for every lane */
+      for (i = 0; i < 16; i++) {
+         x[i] = _mm_load_si128((const __m128i*)w[i]);
+      }
+      for (i = rounds; i > 0; i -= 2) {
+         /* columnround */
+         quarterround_avx_4blocks(x,  0,  4,  8, 12);
+         quarterround_avx_4blocks(x,  5,  9, 13,  1);
+         quarterround_avx_4blocks(x, 10, 14,  2,  6);
+         quarterround_avx_4blocks(x, 15,  3,  7, 11);
+         /* rowround */
+         quarterround_avx_4blocks(x,  0,  1,  2,  3);
+         quarterround_avx_4blocks(x,  5,  6,  7,  4);
+         quarterround_avx_4blocks(x, 10, 11,  8,  9);
+         quarterround_avx_4blocks(x, 15, 12, 13, 14);
+      }
+      for (i = 0; i < 16; i++) {
+         x[i] = _mm_add_epi32(x[i], _mm_load_si128((const __m128i*)w[i]));
+      }
+      for (i = 0; i < 16; i += 4) {
+         transpose4x4_avx(x + i);
+      }
+
+      /* Consume the block of every active lane */
+      for (k = 0; k < 4; k++) {
+         xsalsa20_state *st = lane[k].st;
+         if (!(active & (1u << k))) continue;
+         blocks++;
+         /* XSalsa20: 64-bit counter, increment 64-bit counter */
+         if (0 == ++w[8][k] && 0 == ++w[9][k]) {
+            XSALSA_STAT_ADD(XSALSA_IMPL_AVX, overflows, 1);
+            if (err == XSALSA_OK) err = XSALSA_OVERFLOW;
+            lane[k].inlen = 0;
+         } else if (lane[k].inlen >= 64) {
+            for (j = 0; j < 4; j++) {
+               __m128i v = _mm_loadu_si128((const __m128i*)(lane[k].in + 16 * j));
+               _mm_storeu_si128((__m128i*)(lane[k].out + 16 * j), _mm_xor_si128(v, x[4 * j + k]));
+            }
+            lane[k].inlen -= 64;
+            lane[k].out += 64;
+            lane[k].in  += 64;
+         } else {
+            for (j = 0; j < 4; j++) {
+               _mm_storeu_si128((__m128i*)(blk + 16 * j), x[4 * j + k]);
+            }
+            for (i = 0; i < lane[k].inlen; ++i) lane[k].out[i] = lane[k].in[i] ^ blk[i];
+            st->ksleft = 64 - lane[k].inlen;
+            for (i = lane[k].inlen; i < 64; ++i) st->kstream[i] = blk[i];
+            lane[k].inlen = 0;
+         }
+         if (lane[k].inlen == 0) {
+            st->input[8] = w[8][k];
+            st->input[9] = w[9][k];
+            active &= ~(1u << k);
+         }
+      }
+   }
+
+   XSALSA_STAT_ADD(XSALSA_IMPL_AVX, bulk_blocks, blocks);
+   zeromem(blk, sizeof(blk));
+   zeromem(w, sizeof(w));
+   zeromem(x, sizeof(x));
+   return err;
+}
+
+/**
+   Encrypt (or decrypt) a batch of packets that share one key (AVX version)
+   Packets are taken 8 at a time: their subkeys are derived 4 per pass
+   with the batch setup, then the chunk runs through the multi-buffer kernel
+   while its states are still in cache.
+   @param key       The secret key shared by every packet
+   @param keylen    The length of the secret key, must be 32 (octets)
+   @param nonces    The nonces, count * 24 octets back to back
+   @param noncelen  The length of each nonce, must be 24 (octets)
+   @param rounds    Number of rounds (must be evenly divisible by 2, default is 20)
+   @param count     The number of packets
+   @param in        The input of every packet
+   @param inlen     The length of every packet (octets)
+   @param out       [out] The output of every packet, length inlen[n]
+   @return XSALSA_OK if successful, otherwise the first error met by a packet
+*/
+int xsalsa20_crypt_batch_avx(const unsigned char *key, unsigned long keylen,
+                             const unsigned char *nonces, unsigned long noncelen,
+                             int rounds, unsigned long count,
+                             const unsigned char *const *in, const unsigned long *inlen,
+                             unsigned char *const *out)
+{
+   xsalsa20_state st[8];
+   xsalsa20_job jobs[8];
+   unsigned long n, k, c;
+   int err = XSALSA_OK, e;
+
+   if (count == 0) return XSALSA_OK; /* nothing to do */
+
+   XSALSA_ARGCHK(key       != NULL);
+   XSALSA_ARGCHK(nonces    != NULL);
+   XSALSA_ARGCHK(in        != NULL);
+   XSALSA_ARGCHK(inlen     != NULL);
+   XSALSA_ARGCHK(out       != NULL);
+
+   for (n = 0; n < count; n += c) {
+      c = MIN(count - n, 8);
+      if ((e = xsalsa20_setup_batch_avx(st, c, key, 0, keylen, nonces + n * 24, noncelen, rounds)) != XSALSA_OK) {
+         return e;
+      }
+      for (k = 0; k < c; k++) {
+         jobs[k].st    = &st[k];
+         jobs[k].in    = in[n + k];
+         jobs[k].inlen = inlen[n + k];
+         jobs[k].out   = out[n + k];
+      }
+      e = xsalsa20_crypt_multi_avx(jobs, c);
+      if (err == XSALSA_OK) err = e;
+   }
+
+   for (k = 0; k < 8; k++) xsalsa20_done(&st[k]);
+   return err;
 }
 
 /**
@@ -409,11 +794,13 @@ int xsalsa20_crypt_avx(xsalsa20_state *st, const unsigned char *in, unsigned lon
    @param st      The XSalsa20 state
    @param out     [out] The keystream output
    @param outlen  The number of keystream bytes to generate
+   @param rounds  The number of rounds (a constant in the _r8/_r12/_r20 entry points)
    @return XSALSA_OK if successful
 */
-int xsalsa20_keystream_avx(xsalsa20_state *st, unsigned char *out, unsigned long outlen)
+static XSALSA_INLINE int s_xsalsa20_keystream_avx(xsalsa20_state *st, unsigned char *out, unsigned long outlen,
+                                                  int rounds)
 {
-   unsigned char buf[256];  /* Buffer for 4 blocks (4 * 64 = 256 bytes) */
+   __m128i v[16];           /* Context splatted for the bulk loop */
    unsigned long i, j;
 
    if (outlen == 0) return XSALSA_OK; /* nothing to do */
@@ -421,86 +808,60 @@ int xsalsa20_keystream_avx(xsalsa20_state *st, unsigned char *out, unsigned long
    XSALSA_ARGCHK(st        != NULL);
    XSALSA_ARGCHK(out       != NULL);
    XSALSA_ARGCHK(st->ivlen == 24);
+   XSALSA_STAT_CALL(XSALSA_IMPL_AVX, outlen);
 
    if (st->ksleft > 0) {
       j = MIN(st->ksleft, outlen);
+      XSALSA_STAT_ADD(XSALSA_IMPL_AVX, drain_bytes, j);
       for (i = 0; i < j; ++i, st->ksleft--) out[i] = st->kstream[64 - st->ksleft];
       outlen -= j;
       if (outlen == 0) return XSALSA_OK;
       out += j;
    }
+   XSALSA_STAT_BLOCKS(XSALSA_IMPL_AVX, outlen, 256);
    
    /* Process data in 4-block chunks for better AVX utilization */
+   if (outlen >= 256) s_salsa20_lanes_avx(v, st->input);
    while (outlen >= 256) {
-      /* Generate 4 blocks of keystream */
-      ulong32 input_blocks[64];  /* 4 blocks * 16 words each */
-      int block;
-      
-      /* Prepare 4 blocks with consecutive counters */
-      for (block = 0; block < 4; block++) {
-         for (i = 0; i < 16; i++) {
-            input_blocks[block * 16 + i] = st->input[i];
-         }
-         /* Increment counter for next block */
-         if (block < 3) {
-            input_blocks[block * 16 + 8]++;
-            if (input_blocks[block * 16 + 8] == 0) {
-               input_blocks[block * 16 + 9]++;
-            }
-         }
-      }
-      
-      /* Generate keystream for all 4 blocks at once */
-      s_salsa20_block_avx_4blocks(buf, input_blocks, st->rounds);
-      
-      /* Copy keystream using AVX */
-      for (i = 0; i < 256; i += 16) {
-         __m128i buf_vec = _mm_loadu_si128((__m128i*)(buf + i));
-         _mm_storeu_si128((__m128i*)(out + i), buf_vec);
-      }
+      /* Generate 4 blocks of keystream straight into out */
+      s_salsa20_block_avx_4blocks(out, NULL, v, rounds);
       
-      /* Update counter for next iteration */
+      /* Update counter for next iteration: the lanes in-vector, and the context */
+      s_salsa20_lanes_step_avx(v);
       st->input[8] += 4;
       if (st->input[8] < 4) {  /* Overflow check */
          st->input[9]++;
-         if (st->input[9] == 0) return XSALSA_OVERFLOW;
+         if (st->input[9] == 0) return XSALSA_STAT_OVERFLOW(XSALSA_IMPL_AVX);
       }
       
       outlen -= 256;
       out += 256;
    }
    
-   /* Handle remaining data with single blocks */
-   for (;;) {
-     s_salsa20_block_avx(buf, st->input, st->rounds);
+   /* Whole blocks go straight to out; the keystream of a final partial block
+      goes to st->kstream, which keeps the part left unused */
+   while (outlen >= 64) {
+     s_salsa20_block_avx(out, NULL, st->input, rounds);
      /* XSalsa20: 64-bit counter, increment 64-bit counter */
-     if (0 == ++st->input[8] && 0 == ++st->input[9]) return XSALSA_OVERFLOW;
-     if (outlen <= 64) {
-       /* Use AVX for memory copy when possible */
-       if (outlen >= 16) {
-          for (i = 0; i < outlen - 15; i += 16) {
-             __m128i buf_vec = _mm_loadu_si128((__m128i*)(buf + i));
-             _mm_storeu_si128((__m128i*)(out + i), buf_vec);
-          }
-          /* Handle remaining bytes */
-          for (; i < outlen; ++i) out[i] = buf[i];
-       } else {
-          for (i = 0; i < outlen; ++i) out[i] = buf[i];
-       }
-       st->ksleft = 64 - outlen;
-       for (i = outlen; i < 64; ++i) st->kstream[i] = buf[i];
-       return XSALSA_OK;
-     }
-     /* Use AVX for memory copy */
-     for (i = 0; i < 64; i += 16) {
-        __m128i buf_vec = _mm_loadu_si128((__m128i*)(buf + i));
-        _mm_storeu_si128((__m128i*)(out + i), buf_vec);
-     }
+     if (0 == ++st->input[8] && 0 == ++st->input[9]) return XSALSA_STAT_OVERFLOW(XSALSA_IMPL_AVX);
      outlen -= 64;
      out += 64;
    }
+   if (outlen == 0) return XSALSA_OK;   /* ended on a block boundary, nothing to buffer */
+
+   s_salsa20_block_avx(st->kstream, NULL, st->input, rounds);
+   if (0 == ++st->input[8] && 0 == ++st->input[9]) return XSALSA_STAT_OVERFLOW(XSALSA_IMPL_AVX);
+   /* Use AVX for memory copy when possible */
+   for (i = 0; i + 16 <= outlen; i += 16) {
+      _mm_storeu_si128((__m128i*)(out + i), _mm_loadu_si128((const __m128i*)(st->kstream + i)));
+   }
+   for (; i < outlen; ++i) out[i] = st->kstream[i];
+   st->ksleft = 64 - outlen;
+   return XSALSA_OK;
 }
 
+XSALSA_KEYSTREAM_ENTRIES(avx)
+
 /**
    One-shot encryption/decryption function (AVX version)
    @param key       The secret key (32 bytes)
@@ -2,12 +2,29 @@
 #define XSALSA_AVX_H
 
 #include "xsalsa.h"
+#include "xsalsa_poly1305_impl.h"
 
 int xsalsa20_setup_avx(xsalsa20_state *st, const unsigned char *key, unsigned long keylen,
                                       const unsigned char *nonce, unsigned long noncelen,
                                       int rounds);
+int xsalsa20_setup_batch_avx(xsalsa20_state *st, unsigned long count,
+                             const unsigned char *keys, unsigned long keystride, unsigned long keylen,
+                             const unsigned char *nonces, unsigned long noncelen,
+                             int rounds);
 int xsalsa20_crypt_avx(xsalsa20_state *st, const unsigned char *in, unsigned long inlen, unsigned char *out);
+int xsalsa20_crypt_avx_r8(xsalsa20_state *st, const unsigned char *in, unsigned long inlen, unsigned char *out);
+int xsalsa20_crypt_avx_r12(xsalsa20_state *st, const unsigned char *in, unsigned long inlen, unsigned char *out);
+int xsalsa20_crypt_avx_r20(xsalsa20_state *st, const unsigned char *in, unsigned long inlen, unsigned char *out);
+int xsalsa20_crypt_multi_avx(xsalsa20_job *jobs, unsigned long count);
+int xsalsa20_crypt_batch_avx(const unsigned char *key, unsigned long keylen,
+                             const unsigned char *nonces, unsigned long noncelen,
+                             int rounds, unsigned long count,
+                             const unsigned char *const *in, const unsigned long *inlen,
+                             unsigned char *const *out);
 int xsalsa20_keystream_avx(xsalsa20_state *st, unsigned char *out, unsigned long outlen);
+int xsalsa20_keystream_avx_r8(xsalsa20_state *st, unsigned char *out, unsigned long outlen);
+int xsalsa20_keystream_avx_r12(xsalsa20_state *st, unsigned char *out, unsigned long outlen);
+int xsalsa20_keystream_avx_r20(xsalsa20_state *st, unsigned char *out, unsigned long outlen);
 int xsalsa20_memory_avx(const unsigned char *key, unsigned long keylen,
                     const unsigned char *nonce, unsigned long noncelen,
                     unsigned long rounds,
@@ -15,12 +32,22 @@ int xsalsa20_memory_avx(const unsigned char *key, unsigned long keylen,
                     unsigned char *dataout);
 
 
-static inline void xsalsa20_avx_init(xsalsa20_setup_fn *xsalsa20_setup_impl, xsalsa20_crypt_fn *xsalsa20_crypt_impl, xsalsa20_keystream_fn *xsalsa20_keystream_impl, xsalsa20_memory_fn *xsalsa20_memory_impl) {
+static inline void xsalsa20_avx_init(xsalsa20_setup_fn *xsalsa20_setup_impl, xsalsa20_setup_batch_fn *xsalsa20_setup_batch_impl, xsalsa20_crypt_fn *xsalsa20_crypt_impl, xsalsa20_crypt_multi_fn *xsalsa20_crypt_multi_impl, xsalsa20_crypt_batch_fn *xsalsa20_crypt_batch_impl, xsalsa20_keystream_fn *xsalsa20_keystream_impl, xsalsa20_memory_fn *xsalsa20_memory_impl, xsalsa20_poly1305_blocks_fn *xsalsa20_poly1305_blocks_impl, xsalsa20_crypt_fn *xsalsa20_crypt_rounds_impl, xsalsa20_keystream_fn *xsalsa20_keystream_rounds_impl) {
     #ifdef XSALSA_USE_IMPL_AVX
     *xsalsa20_setup_impl = xsalsa20_setup_avx;
+    *xsalsa20_setup_batch_impl = xsalsa20_setup_batch_avx;
     *xsalsa20_crypt_impl = xsalsa20_crypt_avx;
+    *xsalsa20_crypt_multi_impl = xsalsa20_crypt_multi_avx;
+    *xsalsa20_crypt_batch_impl = xsalsa20_crypt_batch_avx;
     *xsalsa20_keystream_impl = xsalsa20_keystream_avx;
     *xsalsa20_memory_impl = xsalsa20_memory_avx;
+    *xsalsa20_poly1305_blocks_impl = xsalsa20_poly1305_blocks_scalar;
+    xsalsa20_crypt_rounds_impl[0] = xsalsa20_crypt_avx_r8;
+    xsalsa20_crypt_rounds_impl[1] = xsalsa20_crypt_avx_r12;
+    xsalsa20_crypt_rounds_impl[2] = xsalsa20_crypt_avx_r20;
+    xsalsa20_keystream_rounds_impl[0] = xsalsa20_keystream_avx_r8;
+    xsalsa20_keystream_rounds_impl[1] = xsalsa20_keystream_avx_r12;
+    xsalsa20_keystream_rounds_impl[2] = xsalsa20_keystream_avx_r20;
     #endif
 }
 
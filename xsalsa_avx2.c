@@ -1,4 +1,6 @@
 #include "xsalsa.h"
+#include "xsalsa_stats.h"
+#include "xsalsa_rounds.h"
 #include <immintrin.h>
 #include <string.h>
 #include <stdio.h>
@@ -100,33 +102,68 @@ static inline void s_xsalsa20_doubleround_avx2(ulong32 *x, int rounds)
    }
 }
 
-/* Internal function: Salsa20 block generation with AVX2 */
-static void s_salsa20_block_avx2(unsigned char *output, const ulong32 *input, int rounds)
+/* Rotate every 32-bit lane of a 128-bit vector left */
+#define ROL128(v, n) _mm_or_si128(_mm_slli_epi32((v), (n)), _mm_srli_epi32((v), 32 - (n)))
+
+/* Internal function: Salsa20 block generation with AVX2 - a single block
+   kept as four 128-bit diagonal rows (x0,x5,x10,x15), (x4,x9,x14,x3),
+   (x8,x13,x2,x7), (x12,x1,x6,x11); lane shuffles switch between the
+   column and row round layouts. The block is XOR-ed with in (or stored as-is
+   when in is NULL) into out. */
+static XSALSA_INLINE void s_salsa20_block_avx2(unsigned char *output, const unsigned char *in,
+                                               const ulong32 *input, int rounds)
 {
-   ulong32 x[16];
-   int i;
-   memcpy(x, input, sizeof(x));
-   
-   for (i = rounds; i > 0; i -= 2) {
-      QUARTERROUND( 0, 4, 8,12)
-      QUARTERROUND( 5, 9,13, 1)
-      QUARTERROUND(10,14, 2, 6)
-      QUARTERROUND(15, 3, 7,11)
-      QUARTERROUND( 0, 1, 2, 3)
-      QUARTERROUND( 5, 6, 7, 4)
-      QUARTERROUND(10,11, 8, 9)
-      QUARTERROUND(15,12,13,14)
-   }
-   
-   /* Use AVX2 for the final addition and store */
-   for (i = 0; i < 16; i += 8) {
-      __m256i input_vec = _mm256_set_epi32(input[i+7], input[i+6], input[i+5], input[i+4],
-                                           input[i+3], input[i+2], input[i+1], input[i]);
-      __m256i state_vec = _mm256_set_epi32(x[i+7], x[i+6], x[i+5], x[i+4],
-                                           x[i+3], x[i+2], x[i+1], x[i]);
-      __m256i sum_vec = _mm256_add_epi32(state_vec, input_vec);
-      _mm256_storeu_si256((__m256i*)(output + 4 * i), sum_vec);
+   __m128i a, b, c, d, a0, b0, c0, d0, t;
+   __m128i r0, r1, r2, r3;
+
+   a = a0 = _mm_set_epi32((int)input[15], (int)input[10], (int)input[ 5], (int)input[ 0]);
+   b = b0 = _mm_set_epi32((int)input[ 3], (int)input[14], (int)input[ 9], (int)input[ 4]);
+   c = c0 = _mm_set_epi32((int)input[ 7], (int)input[ 2], (int)input[13], (int)input[ 8]);
+   d = d0 = _mm_set_epi32((int)input[11], (int)input[ 6], (int)input[ 1], (int)input[12]);
+
+   XSALSA_ROUNDS(rounds,
+      /* columnround */
+      b = _mm_xor_si128(b, ROL128(_mm_add_epi32(a, d),  7));
+      c = _mm_xor_si128(c, ROL128(_mm_add_epi32(b, a),  9));
+      d = _mm_xor_si128(d, ROL128(_mm_add_epi32(c, b), 13));
+      a = _mm_xor_si128(a, ROL128(_mm_add_epi32(d, c), 18));
+      /* to row layout: (x1,x6,x11,x12), (x2,x7,x8,x13), (x3,x4,x9,x14) */
+      t = b;
+      b = _mm_shuffle_epi32(d, 0x39);
+      c = _mm_shuffle_epi32(c, 0x4E);
+      d = _mm_shuffle_epi32(t, 0x93);
+      /* rowround */
+      b = _mm_xor_si128(b, ROL128(_mm_add_epi32(a, d),  7));
+      c = _mm_xor_si128(c, ROL128(_mm_add_epi32(b, a),  9));
+      d = _mm_xor_si128(d, ROL128(_mm_add_epi32(c, b), 13));
+      a = _mm_xor_si128(a, ROL128(_mm_add_epi32(d, c), 18));
+      /* back to column layout */
+      t = b;
+      b = _mm_shuffle_epi32(d, 0x39);
+      c = _mm_shuffle_epi32(c, 0x4E);
+      d = _mm_shuffle_epi32(t, 0x93);
+   );
+
+   a = _mm_add_epi32(a, a0);
+   b = _mm_add_epi32(b, b0);
+   c = _mm_add_epi32(c, c0);
+   d = _mm_add_epi32(d, d0);
+
+   /* Gather the diagonals back into rows of the output block */
+   r0 = _mm_blend_epi32(_mm_blend_epi32(a, d, 0x2), _mm_blend_epi32(c, b, 0x8), 0xC);
+   r1 = _mm_blend_epi32(_mm_blend_epi32(b, a, 0x2), _mm_blend_epi32(d, c, 0x8), 0xC);
+   r2 = _mm_blend_epi32(_mm_blend_epi32(c, b, 0x2), _mm_blend_epi32(a, d, 0x8), 0xC);
+   r3 = _mm_blend_epi32(_mm_blend_epi32(d, c, 0x2), _mm_blend_epi32(b, a, 0x8), 0xC);
+   if (in != NULL) {
+      r0 = _mm_xor_si128(r0, _mm_loadu_si128((const __m128i*)(in +  0)));
+      r1 = _mm_xor_si128(r1, _mm_loadu_si128((const __m128i*)(in + 16)));
+      r2 = _mm_xor_si128(r2, _mm_loadu_si128((const __m128i*)(in + 32)));
+      r3 = _mm_xor_si128(r3, _mm_loadu_si128((const __m128i*)(in + 48)));
    }
+   _mm_storeu_si128((__m128i*)(output +  0), r0);
+   _mm_storeu_si128((__m128i*)(output + 16), r1);
+   _mm_storeu_si128((__m128i*)(output + 32), r2);
+   _mm_storeu_si128((__m128i*)(output + 48), r3);
 }
 
 /* Internal function: Zero memory */
@@ -139,7 +176,7 @@ static inline void zeromem(volatile void *out, size_t outlen)
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
 /* AVX2 vectorized quarter round - processes 8 blocks in parallel */
-static void quarterround_avx2_8blocks(__m256i *x, int a, int b, int c, int d)
+static XSALSA_INLINE void quarterround_avx2_8blocks(__m256i *x, int a, int b, int c, int d)
 {
    __m256i temp;
    
@@ -172,22 +209,100 @@ static void quarterround_avx2_8blocks(__m256i *x, int a, int b, int c, int d)
    ));
 }
 
-/* AVX2 vectorized Salsa20 block generation - processes 8 blocks at once */
-static void s_salsa20_block_avx2_8blocks(unsigned char *output, const ulong32 *input, int rounds)
+/* AVX2 8x8 transpose of 32-bit words: r[i] holds word i of blocks 0..7 on
+   entry, r[k] holds words 0..7 of block k on exit */
+static inline void transpose8x8_avx2(__m256i *r)
+{
+   __m256i t0, t1, t2, t3, t4, t5, t6, t7;
+   __m256i u0, u1, u2, u3, u4, u5, u6, u7;
+
+   t0 = _mm256_unpacklo_epi32(r[0], r[1]);
+   t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+   t2 = _mm256_unpacklo_epi32(r[2], r[3]);
+   t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+   t4 = _mm256_unpacklo_epi32(r[4], r[5]);
+   t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+   t6 = _mm256_unpacklo_epi32(r[6], r[7]);
+   t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+
+   u0 = _mm256_unpacklo_epi64(t0, t2);
+   u1 = _mm256_unpackhi_epi64(t0, t2);
+   u2 = _mm256_unpacklo_epi64(t1, t3);
+   u3 = _mm256_unpackhi_epi64(t1, t3);
+   u4 = _mm256_unpacklo_epi64(t4, t6);
+   u5 = _mm256_unpackhi_epi64(t4, t6);
+   u6 = _mm256_unpacklo_epi64(t5, t7);
+   u7 = _mm256_unpackhi_epi64(t5, t7);
+
+   r[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+   r[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+   r[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+   r[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+   r[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+   r[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+   r[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+   r[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+}
+
+/* Store (or XOR with in, when in is not NULL) eight transposed 32-byte half-blocks */
+static inline void store8_avx2(unsigned char *out, const unsigned char *in, const __m256i *r)
+{
+   int k;
+
+   for (k = 0; k < 8; k++) {
+      __m256i v = r[k];
+      if (in != NULL) {
+         v = _mm256_xor_si256(v, _mm256_loadu_si256((const __m256i*)(in + k * 64)));
+      }
+      _mm256_storeu_si256((__m256i*)(out + k * 64), v);
+   }
+}
+
+/* Internal function: splat the context for the 8-block kernel, one vector per
+   state word; lane k of words 8 and 9 holds the 64-bit counter input[8..9] + k */
+static inline void s_salsa20_lanes_avx2(__m256i *v, const ulong32 *input)
+{
+   const __m256i sign = _mm256_set1_epi32((int)0x80000000);
+   __m256i ctr;
+   int i;
+
+   for (i = 0; i < 16; i++) {
+      v[i] = _mm256_set1_epi32((int)input[i]);
+   }
+   ctr = _mm256_add_epi32(v[8], _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+   /* unsigned counter < input[8] means the low word wrapped: carry into word 9 */
+   v[9] = _mm256_sub_epi32(v[9], _mm256_cmpgt_epi32(_mm256_xor_si256(v[8], sign), _mm256_xor_si256(ctr, sign)));
+   v[8] = ctr;
+}
+
+/* Internal function: advance the counter lanes of a splatted context by 8 blocks */
+static inline void s_salsa20_lanes_step_avx2(__m256i *v)
+{
+   const __m256i sign = _mm256_set1_epi32((int)0x80000000);
+   const __m256i step = _mm256_set1_epi32(8);
+
+   v[8] = _mm256_add_epi32(v[8], step);
+   /* unsigned counter < 8 means the low word wrapped: carry into word 9 */
+   v[9] = _mm256_sub_epi32(v[9], _mm256_cmpgt_epi32(_mm256_xor_si256(step, sign), _mm256_xor_si256(v[8], sign)));
+}
+
+/* AVX2 vectorized Salsa20 block generation - processes 8 blocks at once.
+   v is the context splatted by s_salsa20_lanes_avx2; lane k of every
+   vector belongs to the block with the counter in lane k of v[8..9].
+   The 8 keystream blocks are XOR-ed with in (or stored as-is when in is NULL)
+   into 512 contiguous bytes at out. */
+static XSALSA_INLINE void s_salsa20_block_avx2_8blocks(unsigned char *out, const unsigned char *in,
+                                                       const __m256i *v, int rounds)
 {
    __m256i x[16];  /* 16 __m256i = 128 32-bit values (8 blocks) */
-   int i, j;
-   
-   /* Load 8 blocks into AVX2 vectors */
+   int i;
+
    for (i = 0; i < 16; i++) {
-      x[i] = _mm256_set_epi32(
-         input[i*8 + 7], input[i*8 + 6], input[i*8 + 5], input[i*8 + 4],
-         input[i*8 + 3], input[i*8 + 2], input[i*8 + 1], input[i*8 + 0]
-      );
+      x[i] = v[i];
    }
-   
+
    /* Process rounds */
-   for (i = rounds; i > 0; i -= 2) {
+   XSALSA_ROUNDS(rounds,
       /* columnround */
       quarterround_avx2_8blocks(x,  0,  4,  8, 12);
       quarterround_avx2_8blocks(x,  5,  9, 13,  1);
@@ -198,12 +313,18 @@ static void s_salsa20_block_avx2_8blocks(unsigned char *output, const ulong32 *i
       quarterround_avx2_8blocks(x,  5,  6,  7,  4);
       quarterround_avx2_8blocks(x, 10, 11,  8,  9);
       quarterround_avx2_8blocks(x, 15, 12, 13, 14);
-   }
-   
-   /* Store results */
+   );
+
+   /* Feed-forward: add the input state back */
    for (i = 0; i < 16; i++) {
-      _mm256_storeu_si256((__m256i*)(output + i * 32), x[i]);
+      x[i] = _mm256_add_epi32(x[i], v[i]);
    }
+
+   /* De-interleave lanes into blocks: words 0..7 then words 8..15 */
+   transpose8x8_avx2(x);
+   transpose8x8_avx2(x + 8);
+   store8_avx2(out, in, x);
+   store8_avx2(out + 32, in != NULL ? in + 32 : NULL, x + 8);
 }
 
 /**
@@ -279,9 +400,10 @@ int xsalsa20_setup_avx2(xsalsa20_state *st, const unsigned char *key, unsigned l
    st->rounds = rounds;
    st->ksleft = 0;
    st->ivlen  = 24;           /* set switch to say nonce/IV has been loaded */
+   XSALSA_STAT_ADD(XSALSA_IMPL_AVX2, setups, 1);
 
    /* Use AVX2 for zeroing memory */
-   for (i = 0; i < 64; i += 32) {
+   for (i = 0; i < 64; i += 8) {
       _mm256_storeu_si256((__m256i*)(x + i), _mm256_setzero_si256());
    }
    for (i = 0; i < 32; i += 32) {
@@ -291,17 +413,158 @@ int xsalsa20_setup_avx2(xsalsa20_state *st, const unsigned char *key, unsigned l
    return XSALSA_OK;
 }
 
+/* Internal function: HSalsa20 for up to 8 contexts at once, one per lane.
+   Lanes past the last context repeat its key/nonce and are discarded. */
+static void s_xsalsa20_setup_lanes_avx2(xsalsa20_state *st, unsigned long lanes,
+                                        const unsigned char *keys, unsigned long keystride,
+                                        const unsigned char *nonces, int rounds)
+{
+   static const int kwi[] = {1, 2, 3, 4, 11, 12, 13, 14};  /* words loaded from the key */
+   _Alignas(32) ulong32 w[16][8];   /* lane-major key/nonce words */
+   __m256i x[16];
+   ulong32 c[4];
+   unsigned long k;
+   int i;
+
+   LOAD32L(c[0], constants +  0);
+   LOAD32L(c[1], constants +  4);
+   LOAD32L(c[2], constants +  8);
+   LOAD32L(c[3], constants + 12);
+
+   for (k = 0; k < 8; k++) {
+      unsigned long src = k < lanes ? k : lanes - 1;
+      const unsigned char *key = keys + src * keystride;
+      const unsigned char *nonce = nonces + src * 24;
+      if (keystride != 0) {
+         for (i = 0; i < 8; i++) {
+            LOAD32L(w[kwi[i]][k], key + 4 * i);
+         }
+      }
+      for (i = 0; i < 4; i++) {
+         LOAD32L(w[6 + i][k], nonce + 4 * i);
+      }
+   }
+
+   /* load the state to "hash" the keys */
+   x[ 0] = _mm256_set1_epi32((int)c[0]);
+   x[ 5] = _mm256_set1_epi32((int)c[1]);
+   x[10] = _mm256_set1_epi32((int)c[2]);
+   x[15] = _mm256_set1_epi32((int)c[3]);
+   for (i = 0; i < 8; i++) {
+      if (keystride != 0) {
+         x[kwi[i]] = _mm256_load_si256((const __m256i*)w[kwi[i]]);
+      } else {
+         /* shared key: the same word in every lane */
+         ulong32 kw;
+         LOAD32L(kw, keys + 4 * i);
+         x[kwi[i]] = _mm256_set1_epi32((int)kw);
+      }
+   }
+   for (i = 6; i < 10; i++) {
+      x[i] = _mm256_load_si256((const __m256i*)w[i]);
+   }
+
+   /* use modified salsa20 doubleround (no final addition) */
+   for (i = rounds; i > 0; i -= 2) {
+      /* columnround */
+      quarterround_avx2_8blocks(x,  0,  4,  8, 12);
+      quarterround_avx2_8blocks(x,  5,  9, 13,  1);
+      quarterround_avx2_8blocks(x, 10, 14,  2,  6);
+      quarterround_avx2_8blocks(x, 15,  3,  7, 11);
+      /* rowround */
+      quarterround_avx2_8blocks(x,  0,  1,  2,  3);
+      quarterround_avx2_8blocks(x,  5,  6,  7,  4);
+      quarterround_avx2_8blocks(x, 10, 11,  8,  9);
+      quarterround_avx2_8blocks(x, 15, 12, 13, 14);
+   }
+
+   /* extract the subkeys: words 0, 5, 10, 15, 6, 7, 8, 9 */
+   _mm256_store_si256((__m256i*)w[ 1], x[ 0]);
+   _mm256_store_si256((__m256i*)w[ 2], x[ 5]);
+   _mm256_store_si256((__m256i*)w[ 3], x[10]);
+   _mm256_store_si256((__m256i*)w[ 4], x[15]);
+   _mm256_store_si256((__m256i*)w[11], x[ 6]);
+   _mm256_store_si256((__m256i*)w[12], x[ 7]);
+   _mm256_store_si256((__m256i*)w[13], x[ 8]);
+   _mm256_store_si256((__m256i*)w[14], x[ 9]);
+
+   /* load the final initial states */
+   for (k = 0; k < lanes; k++) {
+      for (i = 0; i < 8; i++) {
+         st[k].input[kwi[i]] = w[kwi[i]][k];
+      }
+      st[k].input[ 0] = c[0];
+      st[k].input[ 5] = c[1];
+      st[k].input[10] = c[2];
+      st[k].input[15] = c[3];
+      LOAD32L(st[k].input[ 6], nonces + k * 24 + 16);
+      LOAD32L(st[k].input[ 7], nonces + k * 24 + 20);
+      st[k].input[ 8] = 0;
+      st[k].input[ 9] = 0;
+      st[k].rounds = rounds;
+      st[k].ksleft = 0;
+      st[k].ivlen  = 24;
+   }
+
+   /* Use AVX2 for zeroing memory */
+   for (i = 0; i < 16; i++) {
+      _mm256_store_si256((__m256i*)w[i], _mm256_setzero_si256());
+      _mm256_store_si256(&x[i], _mm256_setzero_si256());
+   }
+}
+
+/**
+   Initialize several XSalsa20 contexts at once (AVX2 version)
+   @param st        [out] The destinations of the XSalsa20 states (count entries)
+   @param count     The number of contexts to initialize
+   @param keys      The secret key(s)
+   @param keystride The distance between consecutive keys (0 to share one key)
+   @param keylen    The length of each secret key, must be 32 (octets)
+   @param nonces    The nonces, count * 24 octets back to back
+   @param noncelen  The length of each nonce, must be 24 (octets)
+   @param rounds    Number of rounds (must be evenly divisible by 2, default is 20)
+   @return XSALSA_OK if successful
+*/
+int xsalsa20_setup_batch_avx2(xsalsa20_state *st, unsigned long count,
+                              const unsigned char *keys, unsigned long keystride, unsigned long keylen,
+                              const unsigned char *nonces, unsigned long noncelen,
+                              int rounds)
+{
+   unsigned long n;
+
+   if (count == 0) return XSALSA_OK; /* nothing to do */
+
+   XSALSA_ARGCHK(st        != NULL);
+   XSALSA_ARGCHK(keys      != NULL);
+   XSALSA_ARGCHK(keylen    == 32);
+   XSALSA_ARGCHK(nonces    != NULL);
+   XSALSA_ARGCHK(noncelen  == 24);
+   if (rounds == 0) rounds = 20;
+   XSALSA_ARGCHK(rounds % 2 == 0);     /* number of rounds must be evenly divisible by 2 */
+
+   /* 8 HSalsa20 permutations per pass, one per lane */
+   for (n = 0; n < count; n += 8) {
+      s_xsalsa20_setup_lanes_avx2(st + n, MIN(count - n, 8), keys + n * keystride, keystride,
+                                  nonces + n * 24, rounds);
+   }
+
+   XSALSA_STAT_ADD(XSALSA_IMPL_AVX2, setups, count);
+   return XSALSA_OK;
+}
+
 /**
    Encrypt (or decrypt) bytes of ciphertext (or plaintext) with XSalsa20 (AVX2 version)
    @param st      The XSalsa20 state
    @param in      The plaintext (or ciphertext)
    @param inlen   The length of the input (octets)
    @param out     [out] The ciphertext (or plaintext), length inlen
+   @param rounds  The number of rounds (a constant in the _r8/_r12/_r20 entry points)
    @return XSALSA_OK if successful
 */
-int xsalsa20_crypt_avx2(xsalsa20_state *st, const unsigned char *in, unsigned long inlen, unsigned char *out)
+static XSALSA_INLINE int s_xsalsa20_crypt_avx2(xsalsa20_state *st, const unsigned char *in, unsigned long inlen,
+                                               unsigned char *out, int rounds)
 {
-   unsigned char buf[512];  /* Buffer for 8 blocks (8 * 64 = 512 bytes) */
+   __m256i v[16];           /* Context splatted for the bulk loop */
    unsigned long i, j;
 
    if (inlen == 0) return XSALSA_OK; /* nothing to do */
@@ -310,52 +573,31 @@ int xsalsa20_crypt_avx2(xsalsa20_state *st, const unsigned char *in, unsigned lo
    XSALSA_ARGCHK(in        != NULL);
    XSALSA_ARGCHK(out       != NULL);
    XSALSA_ARGCHK(st->ivlen == 24);
+   XSALSA_STAT_CALL(XSALSA_IMPL_AVX2, inlen);
 
    if (st->ksleft > 0) {
       j = MIN(st->ksleft, inlen);
+      XSALSA_STAT_ADD(XSALSA_IMPL_AVX2, drain_bytes, j);
       for (i = 0; i < j; ++i, st->ksleft--) out[i] = in[i] ^ st->kstream[64 - st->ksleft];
       inlen -= j;
       if (inlen == 0) return XSALSA_OK;
       out += j;
       in  += j;
    }
+   XSALSA_STAT_BLOCKS(XSALSA_IMPL_AVX2, inlen, 512);
    
    /* Process data in 8-block chunks for better AVX2 utilization */
+   if (inlen >= 512) s_salsa20_lanes_avx2(v, st->input);
    while (inlen >= 512) {
-      /* Generate 8 blocks of keystream */
-      ulong32 input_blocks[128];  /* 8 blocks * 16 words each */
-      int block;
+      /* Generate 8 blocks of keystream and XOR them straight into out */
+      s_salsa20_block_avx2_8blocks(out, in, v, rounds);
       
-      /* Prepare 8 blocks with consecutive counters */
-      for (block = 0; block < 8; block++) {
-         for (i = 0; i < 16; i++) {
-            input_blocks[block * 16 + i] = st->input[i];
-         }
-         /* Increment counter for next block */
-         if (block < 7) {
-            input_blocks[block * 16 + 8]++;
-            if (input_blocks[block * 16 + 8] == 0) {
-               input_blocks[block * 16 + 9]++;
-            }
-         }
-      }
-      
-      /* Generate keystream for all 8 blocks at once */
-      s_salsa20_block_avx2_8blocks(buf, input_blocks, st->rounds);
-      
-      /* XOR with input using AVX2 */
-      for (i = 0; i < 512; i += 32) {
-         __m256i in_vec = _mm256_loadu_si256((__m256i*)(in + i));
-         __m256i buf_vec = _mm256_loadu_si256((__m256i*)(buf + i));
-         __m256i out_vec = _mm256_xor_si256(in_vec, buf_vec);
-         _mm256_storeu_si256((__m256i*)(out + i), out_vec);
-      }
-      
-      /* Update counter for next iteration */
+      /* Update counter for next iteration: the lanes in-vector, and the context */
+      s_salsa20_lanes_step_avx2(v);
       st->input[8] += 8;
       if (st->input[8] < 8) {  /* Overflow check */
          st->input[9]++;
-         if (st->input[9] == 0) return XSALSA_OVERFLOW;
+         if (st->input[9] == 0) return XSALSA_STAT_OVERFLOW(XSALSA_IMPL_AVX2);
       }
       
       inlen -= 512;
@@ -363,40 +605,210 @@ int xsalsa20_crypt_avx2(xsalsa20_state *st, const unsigned char *in, unsigned lo
       in  += 512;
    }
    
-   /* Handle remaining data with single blocks */
-   for (;;) {
-     s_salsa20_block_avx2(buf, st->input, st->rounds);
+   /* Whole blocks go straight to out; the keystream of a final partial block
+      goes to st->kstream, which keeps the part left unused */
+   while (inlen >= 64) {
+     s_salsa20_block_avx2(out, in, st->input, rounds);
      /* XSalsa20: 64-bit counter, increment 64-bit counter */
-     if (0 == ++st->input[8] && 0 == ++st->input[9]) return XSALSA_OVERFLOW;
-     if (inlen <= 64) {
-       /* Use AVX2 for XOR operations when possible */
-       if (inlen >= 32) {
-          for (i = 0; i < inlen - 31; i += 32) {
-             __m256i in_vec = _mm256_loadu_si256((__m256i*)(in + i));
-             __m256i buf_vec = _mm256_loadu_si256((__m256i*)(buf + i));
-             __m256i out_vec = _mm256_xor_si256(in_vec, buf_vec);
-             _mm256_storeu_si256((__m256i*)(out + i), out_vec);
-          }
-          /* Handle remaining bytes */
-          for (; i < inlen; ++i) out[i] = in[i] ^ buf[i];
-       } else {
-          for (i = 0; i < inlen; ++i) out[i] = in[i] ^ buf[i];
-       }
-       st->ksleft = 64 - inlen;
-       for (i = inlen; i < 64; ++i) st->kstream[i] = buf[i];
-       return XSALSA_OK;
-     }
-     /* Use AVX2 for XOR operations */
-     for (i = 0; i < 64; i += 32) {
-        __m256i in_vec = _mm256_loadu_si256((__m256i*)(in + i));
-        __m256i buf_vec = _mm256_loadu_si256((__m256i*)(buf + i));
-        __m256i out_vec = _mm256_xor_si256(in_vec, buf_vec);
-        _mm256_storeu_si256((__m256i*)(out + i), out_vec);
-     }
+     if (0 == ++st->input[8] && 0 == ++st->input[9]) return XSALSA_STAT_OVERFLOW(XSALSA_IMPL_AVX2);
      inlen -= 64;
      out += 64;
      in  += 64;
    }
+   if (inlen == 0) return XSALSA_OK;   /* ended on a block boundary, nothing to buffer */
+
+   s_salsa20_block_avx2(st->kstream, NULL, st->input, rounds);
+   if (0 == ++st->input[8] && 0 == ++st->input[9]) return XSALSA_STAT_OVERFLOW(XSALSA_IMPL_AVX2);
+   /* Use AVX2 for XOR operations when possible */
+   for (i = 0; i + 32 <= inlen; i += 32) {
+      __m256i ks_vec = _mm256_loadu_si256((const __m256i*)(st->kstream + i));
+      __m256i in_vec = _mm256_loadu_si256((const __m256i*)(in + i));
+      _mm256_storeu_si256((__m256i*)(out + i), _mm256_xor_si256(in_vec, ks_vec));
+   }
+   for (; i < inlen; ++i) out[i] = in[i] ^ st->kstream[i];
+   st->ksleft = 64 - inlen;
+   return XSALSA_OK;
+}
+
+XSALSA_CRYPT_ENTRIES(avx2)
+
+/**
+   Encrypt (or decrypt) several independent streams at once (AVX2 version)
+   Every stream occupies one of the 8 lanes; a lane whose stream has
+   finished is masked out and refilled with the next pending job. Jobs
+   whose round count differs from the first job run on their own.
+   @param jobs    The jobs (state, input, length, output)
+   @param count   The number of jobs
+   @return XSALSA_OK if successful, otherwise the first error met by a job
+*/
+int xsalsa20_crypt_multi_avx2(xsalsa20_job *jobs, unsigned long count)
+{
+   _Alignas(32) ulong32 w[16][8];   /* input state of every lane, word-major */
+   xsalsa20_job lane[8];             /* remaining work of every lane */
+   unsigned char blk[64];
+   __m256i x[16];
+   unsigned long next = 0, i, j;
+   unsigned long blocks = 0;         /* lane blocks, counted once at the end */
+   unsigned int active = 0;           /* bit k set: lane k holds a stream */
+   int rounds = 0;
+   int err = XSALSA_OK, e;
+   int k;
+
+   if (count == 0) return XSALSA_OK; /* nothing to do */
+
+   XSALSA_ARGCHK(jobs != NULL);
+
+   for (;;) {
+      /* Refill idle lanes with pending jobs */
+      for (k = 0; k < 8 && next < count; k++) {
+         if (active & (1u << k)) continue;
+         while (next < count) {
+            xsalsa20_job *job = &jobs[next++];
+            xsalsa20_state *st = job->st;
+            if (job->inlen == 0) continue;
+            if (st == NULL || job->in == NULL || job->out == NULL || st->ivlen != 24) {
+               if (err == XSALSA_OK) err = XSALSA_INVALID_ARG;
+               continue;
+            }
+            if (rounds == 0) rounds = st->rounds;
+            if (st->rounds != rounds) {
+               e = xsalsa20_crypt_avx2(st, job->in, job->inlen, job->out);
+               if (err == XSALSA_OK) err = e;
+               continue;
+            }
+            lane[k] = *job;
+            XSALSA_STAT_CALL(XSALSA_IMPL_AVX2, job->inlen);
+            if (st->ksleft > 0) {
+               j = MIN(st->ksleft, lane[k].inlen);
+               XSALSA_STAT_ADD(XSALSA_IMPL_AVX2, drain_bytes, j);
+               for (i = 0; i < j; ++i, st->ksleft--) lane[k].out[i] = lane[k].in[i] ^ st->kstream[64 - st->ksleft];
+               lane[k].inlen -= j;
+               if (lane[k].inlen == 0) continue;
+               lane[k].out += j;
+               lane[k].in  += j;
+            }
+            for (i = 0; i < 16; i++) w[i][k] = st->input[i];
+            active |= 1u << k;
+            break;
+         }
+      }
+      if (active == 0) break;
+
+      /* One keystream block for every lane */
+      for (i = 0; i < 16; i++) {
+         x[i] = _mm256_load_si256((const __m256i*)w[i]);
+      }
+      for (i = rounds; i > 0; i -= 2) {
+         /* columnround */
+         quarterround_avx2_8blocks(x,  0,  4,  8, 12);
+         quarterround_avx2_8blocks(x,  5,  9, 13,  1);
+         quarterround_avx2_8blocks(x, 10, 14,  2,  6);
+         quarterround_avx2_8blocks(x, 15,  3,  7, 11);
+         /* rowround */
+         quarterround_avx2_8blocks(x,  0,  1,  2,  3);
+         quarterround_avx2_8blocks(x,  5,  6,  7,  4);
+         quarterround_avx2_8blocks(x, 10, 11,  8,  9);
+         quarterround_avx2_8blocks(x, 15, 12, 13, 14);
+      }
+      for (i = 0; i < 16; i++) {
+         x[i] = _mm256_add_epi32(x[i], _mm256_load_si256((const __m256i*)w[i]));
+      }
+      transpose8x8_avx2(x);
+      transpose8x8_avx2(x + 8);
+
+      /* Consume the block of every active lane */
+      for (k = 0; k < 8; k++) {
+         xsalsa20_state *st = lane[k].st;
+         if (!(active & (1u << k))) continue;
+         blocks++;
+         /* XSalsa20: 64-bit counter, increment 64-bit counter */
+         if (0 == ++w[8][k] && 0 == ++w[9][k]) {
+            XSALSA_STAT_ADD(XSALSA_IMPL_AVX2, overflows, 1);
+            if (err == XSALSA_OK) err = XSALSA_OVERFLOW;
+            lane[k].inlen = 0;
+         } else if (lane[k].inlen >= 64) {
+            _mm256_storeu_si256((__m256i*)(lane[k].out), _mm256_xor_si256(x[k],
+                                _mm256_loadu_si256((const __m256i*)(lane[k].in))));
+            _mm256_storeu_si256((__m256i*)(lane[k].out + 32), _mm256_xor_si256(x[8 + k],
+                                _mm256_loadu_si256((const __m256i*)(lane[k].in + 32))));
+            lane[k].inlen -= 64;
+            lane[k].out += 64;
+            lane[k].in  += 64;
+         } else {
+            _mm256_storeu_si256((__m256i*)(blk), x[k]);
+            _mm256_storeu_si256((__m256i*)(blk + 32), x[8 + k]);
+            for (i = 0; i < lane[k].inlen; ++i) lane[k].out[i] = lane[k].in[i] ^ blk[i];
+            st->ksleft = 64 - lane[k].inlen;
+            for (i = lane[k].inlen; i < 64; ++i) st->kstream[i] = blk[i];
+            lane[k].inlen = 0;
+         }
+         if (lane[k].inlen == 0) {
+            st->input[8] = w[8][k];
+            st->input[9] = w[9][k];
+            active &= ~(1u << k);
+         }
+      }
+   }
+
+   XSALSA_STAT_ADD(XSALSA_IMPL_AVX2, bulk_blocks, blocks);
+   zeromem(blk, sizeof(blk));
+   zeromem(w, sizeof(w));
+   zeromem(x, sizeof(x));
+   return err;
+}
+
+/**
+   Encrypt (or decrypt) a batch of packets that share one key (AVX2 version)
+   Packets are taken 16 at a time: their subkeys are derived 8 per pass
+   with the batch setup, then the chunk runs through the multi-buffer kernel
+   while its states are still in cache.
+   @param key       The secret key shared by every packet
+   @param keylen    The length of the secret key, must be 32 (octets)
+   @param nonces    The nonces, count * 24 octets back to back
+   @param noncelen  The length of each nonce, must be 24 (octets)
+   @param rounds    Number of rounds (must be evenly divisible by 2, default is 20)
+   @param count     The number of packets
+   @param in        The input of every packet
+   @param inlen     The length of every packet (octets)
+   @param out       [out] The output of every packet, length inlen[n]
+   @return XSALSA_OK if successful, otherwise the first error met by a packet
+*/
+int xsalsa20_crypt_batch_avx2(const unsigned char *key, unsigned long keylen,
+                              const unsigned char *nonces, unsigned long noncelen,
+                              int rounds, unsigned long count,
+                              const unsigned char *const *in, const unsigned long *inlen,
+                              unsigned char *const *out)
+{
+   xsalsa20_state st[16];
+   xsalsa20_job jobs[16];
+   unsigned long n, k, c;
+   int err = XSALSA_OK, e;
+
+   if (count == 0) return XSALSA_OK; /* nothing to do */
+
+   XSALSA_ARGCHK(key       != NULL);
+   XSALSA_ARGCHK(nonces    != NULL);
+   XSALSA_ARGCHK(in        != NULL);
+   XSALSA_ARGCHK(inlen     != NULL);
+   XSALSA_ARGCHK(out       != NULL);
+
+   for (n = 0; n < count; n += c) {
+      c = MIN(count - n, 16);
+      if ((e = xsalsa20_setup_batch_avx2(st, c, key, 0, keylen, nonces + n * 24, noncelen, rounds)) != XSALSA_OK) {
+         return e;
+      }
+      for (k = 0; k < c; k++) {
+         jobs[k].st    = &st[k];
+         jobs[k].in    = in[n + k];
+         jobs[k].inlen = inlen[n + k];
+         jobs[k].out   = out[n + k];
+      }
+      e = xsalsa20_crypt_multi_avx2(jobs, c);
+      if (err == XSALSA_OK) err = e;
+   }
+
+   for (k = 0; k < 16; k++) xsalsa20_done(&st[k]);
+   return err;
 }
 
 /**
@@ -404,11 +816,13 @@ int xsalsa20_crypt_avx2(xsalsa20_state *st, const unsigned char *in, unsigned lo
    @param st      The XSalsa20 state
    @param out     [out] The keystream output
    @param outlen  The number of keystream bytes to generate
+   @param rounds  The number of rounds (a constant in the _r8/_r12/_r20 entry points)
    @return XSALSA_OK if successful
 */
-int xsalsa20_keystream_avx2(xsalsa20_state *st, unsigned char *out, unsigned long outlen)
+static XSALSA_INLINE int s_xsalsa20_keystream_avx2(xsalsa20_state *st, unsigned char *out, unsigned long outlen,
+                                                   int rounds)
 {
-   unsigned char buf[512];  /* Buffer for 8 blocks (8 * 64 = 512 bytes) */
+   __m256i v[16];           /* Context splatted for the bulk loop */
    unsigned long i, j;
 
    if (outlen == 0) return XSALSA_OK; /* nothing to do */
@@ -416,86 +830,60 @@ int xsalsa20_keystream_avx2(xsalsa20_state *st, unsigned char *out, unsigned lon
    XSALSA_ARGCHK(st        != NULL);
    XSALSA_ARGCHK(out       != NULL);
    XSALSA_ARGCHK(st->ivlen == 24);
+   XSALSA_STAT_CALL(XSALSA_IMPL_AVX2, outlen);
 
    if (st->ksleft > 0) {
       j = MIN(st->ksleft, outlen);
+      XSALSA_STAT_ADD(XSALSA_IMPL_AVX2, drain_bytes, j);
       for (i = 0; i < j; ++i, st->ksleft--) out[i] = st->kstream[64 - st->ksleft];
       outlen -= j;
       if (outlen == 0) return XSALSA_OK;
       out += j;
    }
+   XSALSA_STAT_BLOCKS(XSALSA_IMPL_AVX2, outlen, 512);
    
    /* Process data in 8-block chunks for better AVX2 utilization */
+   if (outlen >= 512) s_salsa20_lanes_avx2(v, st->input);
    while (outlen >= 512) {
-      /* Generate 8 blocks of keystream */
-      ulong32 input_blocks[128];  /* 8 blocks * 16 words each */
-      int block;
-      
-      /* Prepare 8 blocks with consecutive counters */
-      for (block = 0; block < 8; block++) {
-         for (i = 0; i < 16; i++) {
-            input_blocks[block * 16 + i] = st->input[i];
-         }
-         /* Increment counter for next block */
-         if (block < 7) {
-            input_blocks[block * 16 + 8]++;
-            if (input_blocks[block * 16 + 8] == 0) {
-               input_blocks[block * 16 + 9]++;
-            }
-         }
-      }
-      
-      /* Generate keystream for all 8 blocks at once */
-      s_salsa20_block_avx2_8blocks(buf, input_blocks, st->rounds);
-      
-      /* Copy keystream using AVX2 */
-      for (i = 0; i < 512; i += 32) {
-         __m256i buf_vec = _mm256_loadu_si256((__m256i*)(buf + i));
-         _mm256_storeu_si256((__m256i*)(out + i), buf_vec);
-      }
+      /* Generate 8 blocks of keystream straight into out */
+      s_salsa20_block_avx2_8blocks(out, NULL, v, rounds);
       
-      /* Update counter for next iteration */
+      /* Update counter for next iteration: the lanes in-vector, and the context */
+      s_salsa20_lanes_step_avx2(v);
       st->input[8] += 8;
       if (st->input[8] < 8) {  /* Overflow check */
          st->input[9]++;
-         if (st->input[9] == 0) return XSALSA_OVERFLOW;
+         if (st->input[9] == 0) return XSALSA_STAT_OVERFLOW(XSALSA_IMPL_AVX2);
       }
       
       outlen -= 512;
       out += 512;
    }
    
-   /* Handle remaining data with single blocks */
-   for (;;) {
-     s_salsa20_block_avx2(buf, st->input, st->rounds);
+   /* Whole blocks go straight to out; the keystream of a final partial block
+      goes to st->kstream, which keeps the part left unused */
+   while (outlen >= 64) {
+     s_salsa20_block_avx2(out, NULL, st->input, rounds);
      /* XSalsa20: 64-bit counter, increment 64-bit counter */
-     if (0 == ++st->input[8] && 0 == ++st->input[9]) return XSALSA_OVERFLOW;
-     if (outlen <= 64) {
-       /* Use AVX2 for memory copy when possible */
-       if (outlen >= 32) {
-          for (i = 0; i < outlen - 31; i += 32) {
-             __m256i buf_vec = _mm256_loadu_si256((__m256i*)(buf + i));
-             _mm256_storeu_si256((__m256i*)(out + i), buf_vec);
-          }
-          /* Handle remaining bytes */
-          for (; i < outlen; ++i) out[i] = buf[i];
-       } else {
-          for (i = 0; i < outlen; ++i) out[i] = buf[i];
-       }
-       st->ksleft = 64 - outlen;
-       for (i = outlen; i < 64; ++i) st->kstream[i] = buf[i];
-       return XSALSA_OK;
-     }
-     /* Use AVX2 for memory copy */
-     for (i = 0; i < 64; i += 32) {
-        __m256i buf_vec = _mm256_loadu_si256((__m256i*)(buf + i));
-        _mm256_storeu_si256((__m256i*)(out + i), buf_vec);
-     }
+     if (0 == ++st->input[8] && 0 == ++st->input[9]) return XSALSA_STAT_OVERFLOW(XSALSA_IMPL_AVX2);
      outlen -= 64;
      out += 64;
    }
+   if (outlen == 0) return XSALSA_OK;   /* ended on a block boundary, nothing to buffer */
+
+   s_salsa20_block_avx2(st->kstream, NULL, st->input, rounds);
+   if (0 == ++st->input[8] && 0 == ++st->input[9]) return XSALSA_STAT_OVERFLOW(XSALSA_IMPL_AVX2);
+   /* Use AVX2 for memory copy when possible */
+   for (i = 0; i + 32 <= outlen; i += 32) {
+      _mm256_storeu_si256((__m256i*)(out + i), _mm256_loadu_si256((const __m256i*)(st->kstream + i)));
+   }
+   for (; i < outlen; ++i) out[i] = st->kstream[i];
+   st->ksleft = 64 - outlen;
+   return XSALSA_OK;
 }
 
+XSALSA_KEYSTREAM_ENTRIES(avx2)
+
 /**
    One-shot encryption/decryption function (AVX2 version)
    @param key       The secret key (32 bytes)
@@ -0,0 +1,887 @@
+#include "xsalsa.h"
+#include "xsalsa_stats.h"
+#include "xsalsa_rounds.h"
+#include <immintrin.h>
+#include <string.h>
+#include <stdio.h>
+
+/* Internal macros and definitions */
+#define XSALSA_ARGCHK(x) do { if (!(x)) return XSALSA_INVALID_ARG; } while(0)
+
+/* Endianness detection and macros */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ || \
+    defined(__LITTLE_ENDIAN__) || defined(__ARMEL__) || defined(__THUMBEL__) || \
+    defined(__AARCH64EL__) || defined(_MIPSEL) || defined(__MIPSEL) || \
+    defined(__MIPSEL__) || defined(_M_ARM) || defined(_M_ARM64) || \
+    defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+    #define ENDIAN_LITTLE
+#elif defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__ || \
+      defined(__BIG_ENDIAN__) || defined(__ARMEB__) || defined(__THUMBEB__) || \
+      defined(__AARCH64EB__) || defined(_MIPSEB) || defined(__MIPSEB) || \
+      defined(__MIPSEB__) || defined(__sparc__) || defined(__sparc)
+    #define ENDIAN_BIG
+#else
+    #define ENDIAN_LITTLE  /* Default to little endian */
+#endif
+
+/* Byte order macros */
+#ifdef ENDIAN_LITTLE
+    #define STORE32L(x, y) do { \
+        (y)[0] = (unsigned char)((x)&255); \
+        (y)[1] = (unsigned char)(((x)>>8)&255); \
+        (y)[2] = (unsigned char)(((x)>>16)&255); \
+        (y)[3] = (unsigned char)(((x)>>24)&255); \
+    } while(0)
+    
+    #define LOAD32L(x, y) do { \
+        x = ((ulong32)((y)[0] & 255)) | \
+            ((ulong32)((y)[1] & 255) << 8) | \
+            ((ulong32)((y)[2] & 255) << 16) | \
+            ((ulong32)((y)[3] & 255) << 24); \
+    } while(0)
+#else
+    #define STORE32L(x, y) do { \
+        (y)[3] = (unsigned char)((x)&255); \
+        (y)[2] = (unsigned char)(((x)>>8)&255); \
+        (y)[1] = (unsigned char)(((x)>>16)&255); \
+        (y)[0] = (unsigned char)(((x)>>24)&255); \
+    } while(0)
+    
+    #define LOAD32L(x, y) do { \
+        x = ((ulong32)((y)[3] & 255)) | \
+            ((ulong32)((y)[2] & 255) << 8) | \
+            ((ulong32)((y)[1] & 255) << 16) | \
+            ((ulong32)((y)[0] & 255) << 24); \
+    } while(0)
+#endif
+
+/* Rotate left macro */
+#define ROL(x, y) (((x) << (y)) | ((x) >> (32 - (y))))
+
+/* Quarter round macro */
+#define QUARTERROUND(a,b,c,d) \
+    x[b] ^= (ROL((x[a] + x[d]),  7)); \
+    x[c] ^= (ROL((x[b] + x[a]),  9)); \
+    x[d] ^= (ROL((x[c] + x[b]), 13)); \
+    x[a] ^= (ROL((x[d] + x[c]), 18));
+
+/* AVX-512VL quarter round macro - processes 8 words at once */
+#define QUARTERROUND_AVX512VL(a,b,c,d) \
+    x[b] = _mm256_xor_si256(x[b], _mm256_rol_epi32(_mm256_add_epi32(x[a], x[d]),  7)); \
+    x[c] = _mm256_xor_si256(x[c], _mm256_rol_epi32(_mm256_add_epi32(x[b], x[a]),  9)); \
+    x[d] = _mm256_xor_si256(x[d], _mm256_rol_epi32(_mm256_add_epi32(x[c], x[b]), 13)); \
+    x[a] = _mm256_xor_si256(x[a], _mm256_rol_epi32(_mm256_add_epi32(x[d], x[c]), 18));
+
+/* Constants */
+static const char * const constants = "expand 32-byte k";
+
+/* Internal function: XSalsa20 doubleround with AVX-512VL (no final addition as in Salsa20) */
+static inline void s_xsalsa20_doubleround_avx512vl(ulong32 *x, int rounds)
+{
+   int i;
+
+   for (i = rounds; i > 0; i -= 2) {
+      /* columnround */
+      QUARTERROUND( 0, 4, 8,12)
+      QUARTERROUND( 5, 9,13, 1)
+      QUARTERROUND(10,14, 2, 6)
+      QUARTERROUND(15, 3, 7,11)
+      /* rowround */
+      QUARTERROUND( 0, 1, 2, 3)
+      QUARTERROUND( 5, 6, 7, 4)
+      QUARTERROUND(10,11, 8, 9)
+      QUARTERROUND(15,12,13,14)
+   }
+}
+
+/* Internal function: Salsa20 block generation with AVX-512VL - a single block
+   kept as four 128-bit diagonal rows (x0,x5,x10,x15), (x4,x9,x14,x3),
+   (x8,x13,x2,x7), (x12,x1,x6,x11); lane shuffles switch between the
+   column and row round layouts. The block is XOR-ed with in (or stored as-is
+   when in is NULL) into out. */
+static XSALSA_INLINE void s_salsa20_block_avx512vl(unsigned char *output, const unsigned char *in,
+                                                   const ulong32 *input, int rounds)
+{
+   __m128i a, b, c, d, a0, b0, c0, d0, t;
+   __m128i r0, r1, r2, r3;
+
+   a = a0 = _mm_set_epi32((int)input[15], (int)input[10], (int)input[ 5], (int)input[ 0]);
+   b = b0 = _mm_set_epi32((int)input[ 3], (int)input[14], (int)input[ 9], (int)input[ 4]);
+   c = c0 = _mm_set_epi32((int)input[ 7], (int)input[ 2], (int)input[13], (int)input[ 8]);
+   d = d0 = _mm_set_epi32((int)input[11], (int)input[ 6], (int)input[ 1], (int)input[12]);
+
+   XSALSA_ROUNDS(rounds,
+      /* columnround */
+      b = _mm_xor_si128(b, _mm_rol_epi32(_mm_add_epi32(a, d),  7));
+      c = _mm_xor_si128(c, _mm_rol_epi32(_mm_add_epi32(b, a),  9));
+      d = _mm_xor_si128(d, _mm_rol_epi32(_mm_add_epi32(c, b), 13));
+      a = _mm_xor_si128(a, _mm_rol_epi32(_mm_add_epi32(d, c), 18));
+      /* to row layout: (x1,x6,x11,x12), (x2,x7,x8,x13), (x3,x4,x9,x14) */
+      t = b;
+      b = _mm_shuffle_epi32(d, 0x39);
+      c = _mm_shuffle_epi32(c, 0x4E);
+      d = _mm_shuffle_epi32(t, 0x93);
+      /* rowround */
+      b = _mm_xor_si128(b, _mm_rol_epi32(_mm_add_epi32(a, d),  7));
+      c = _mm_xor_si128(c, _mm_rol_epi32(_mm_add_epi32(b, a),  9));
+      d = _mm_xor_si128(d, _mm_rol_epi32(_mm_add_epi32(c, b), 13));
+      a = _mm_xor_si128(a, _mm_rol_epi32(_mm_add_epi32(d, c), 18));
+      /* back to column layout */
+      t = b;
+      b = _mm_shuffle_epi32(d, 0x39);
+      c = _mm_shuffle_epi32(c, 0x4E);
+      d = _mm_shuffle_epi32(t, 0x93);
+   );
+
+   a = _mm_add_epi32(a, a0);
+   b = _mm_add_epi32(b, b0);
+   c = _mm_add_epi32(c, c0);
+   d = _mm_add_epi32(d, d0);
+
+   /* Gather the diagonals back into rows of the output block */
+   r0 = _mm_blend_epi32(_mm_blend_epi32(a, d, 0x2), _mm_blend_epi32(c, b, 0x8), 0xC);
+   r1 = _mm_blend_epi32(_mm_blend_epi32(b, a, 0x2), _mm_blend_epi32(d, c, 0x8), 0xC);
+   r2 = _mm_blend_epi32(_mm_blend_epi32(c, b, 0x2), _mm_blend_epi32(a, d, 0x8), 0xC);
+   r3 = _mm_blend_epi32(_mm_blend_epi32(d, c, 0x2), _mm_blend_epi32(b, a, 0x8), 0xC);
+   if (in != NULL) {
+      r0 = _mm_xor_si128(r0, _mm_loadu_si128((const __m128i*)(in +  0)));
+      r1 = _mm_xor_si128(r1, _mm_loadu_si128((const __m128i*)(in + 16)));
+      r2 = _mm_xor_si128(r2, _mm_loadu_si128((const __m128i*)(in + 32)));
+      r3 = _mm_xor_si128(r3, _mm_loadu_si128((const __m128i*)(in + 48)));
+   }
+   _mm_storeu_si128((__m128i*)(output +  0), r0);
+   _mm_storeu_si128((__m128i*)(output + 16), r1);
+   _mm_storeu_si128((__m128i*)(output + 32), r2);
+   _mm_storeu_si128((__m128i*)(output + 48), r3);
+}
+
+/* Internal function: Zero memory */
+static inline void zeromem(volatile void *out, size_t outlen)
+{
+   volatile unsigned char *x = (volatile unsigned char *)out;
+   while (outlen--) *x++ = 0;
+}
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+/* AVX-512VL vectorized quarter round - processes 8 blocks in parallel.
+   Rotates use the native vprold on 256-bit registers. */
+static XSALSA_INLINE void quarterround_avx512vl_8blocks(__m256i *x, int a, int b, int c, int d)
+{
+   /* x[b] ^= ROL((x[a] + x[d]), 7) */
+   x[b] = _mm256_xor_si256(x[b], _mm256_rol_epi32(_mm256_add_epi32(x[a], x[d]), 7));
+   /* x[c] ^= ROL((x[b] + x[a]), 9) */
+   x[c] = _mm256_xor_si256(x[c], _mm256_rol_epi32(_mm256_add_epi32(x[b], x[a]), 9));
+   /* x[d] ^= ROL((x[c] + x[b]), 13) */
+   x[d] = _mm256_xor_si256(x[d], _mm256_rol_epi32(_mm256_add_epi32(x[c], x[b]), 13));
+   /* x[a] ^= ROL((x[d] + x[c]), 18) */
+   x[a] = _mm256_xor_si256(x[a], _mm256_rol_epi32(_mm256_add_epi32(x[d], x[c]), 18));
+}
+
+/* AVX-512VL 8x8 transpose of 32-bit words: r[i] holds word i of blocks 0..7 on
+   entry, r[k] holds words 0..7 of block k on exit */
+static inline void transpose8x8_avx512vl(__m256i *r)
+{
+   __m256i t0, t1, t2, t3, t4, t5, t6, t7;
+   __m256i u0, u1, u2, u3, u4, u5, u6, u7;
+
+   t0 = _mm256_unpacklo_epi32(r[0], r[1]);
+   t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+   t2 = _mm256_unpacklo_epi32(r[2], r[3]);
+   t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+   t4 = _mm256_unpacklo_epi32(r[4], r[5]);
+   t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+   t6 = _mm256_unpacklo_epi32(r[6], r[7]);
+   t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+
+   u0 = _mm256_unpacklo_epi64(t0, t2);
+   u1 = _mm256_unpackhi_epi64(t0, t2);
+   u2 = _mm256_unpacklo_epi64(t1, t3);
+   u3 = _mm256_unpackhi_epi64(t1, t3);
+   u4 = _mm256_unpacklo_epi64(t4, t6);
+   u5 = _mm256_unpackhi_epi64(t4, t6);
+   u6 = _mm256_unpacklo_epi64(t5, t7);
+   u7 = _mm256_unpackhi_epi64(t5, t7);
+
+   r[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+   r[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+   r[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+   r[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+   r[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+   r[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+   r[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+   r[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+}
+
+/* Store (or XOR with in, when in is not NULL) eight transposed 32-byte half-blocks */
+static inline void store8_avx512vl(unsigned char *out, const unsigned char *in, const __m256i *r)
+{
+   int k;
+
+   for (k = 0; k < 8; k++) {
+      __m256i v = r[k];
+      if (in != NULL) {
+         v = _mm256_xor_si256(v, _mm256_loadu_si256((const __m256i*)(in + k * 64)));
+      }
+      _mm256_storeu_si256((__m256i*)(out + k * 64), v);
+   }
+}
+
+/* Internal function: splat the context for the 8-block kernel, one vector per
+   state word; lane k of words 8 and 9 holds the 64-bit counter input[8..9] + k */
+static inline void s_salsa20_lanes_avx512vl(__m256i *v, const ulong32 *input)
+{
+   __m256i ctr;
+   int i;
+
+   for (i = 0; i < 16; i++) {
+      v[i] = _mm256_set1_epi32((int)input[i]);
+   }
+   ctr = _mm256_add_epi32(v[8], _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+   v[9] = _mm256_mask_add_epi32(v[9], _mm256_cmplt_epu32_mask(ctr, v[8]), v[9], _mm256_set1_epi32(1));
+   v[8] = ctr;
+}
+
+/* Internal function: advance the counter lanes of a splatted context by 8 blocks */
+static inline void s_salsa20_lanes_step_avx512vl(__m256i *v)
+{
+   const __m256i step = _mm256_set1_epi32(8);
+
+   v[8] = _mm256_add_epi32(v[8], step);
+   v[9] = _mm256_mask_add_epi32(v[9], _mm256_cmplt_epu32_mask(v[8], step), v[9], _mm256_set1_epi32(1));
+}
+
+/* AVX-512VL vectorized Salsa20 block generation - processes 8 blocks at once.
+   v is the context splatted by s_salsa20_lanes_avx512vl; lane k of every
+   vector belongs to the block with the counter in lane k of v[8..9].
+   The 8 keystream blocks are XOR-ed with in (or stored as-is when in is NULL)
+   into 512 contiguous bytes at out. */
+static XSALSA_INLINE void s_salsa20_block_avx512vl_8blocks(unsigned char *out, const unsigned char *in,
+                                                       const __m256i *v, int rounds)
+{
+   __m256i x[16];  /* 16 __m256i = 128 32-bit values (8 blocks) */
+   int i;
+
+   for (i = 0; i < 16; i++) {
+      x[i] = v[i];
+   }
+
+   /* Process rounds */
+   XSALSA_ROUNDS(rounds,
+      /* columnround */
+      quarterround_avx512vl_8blocks(x,  0,  4,  8, 12);
+      quarterround_avx512vl_8blocks(x,  5,  9, 13,  1);
+      quarterround_avx512vl_8blocks(x, 10, 14,  2,  6);
+      quarterround_avx512vl_8blocks(x, 15,  3,  7, 11);
+      /* rowround */
+      quarterround_avx512vl_8blocks(x,  0,  1,  2,  3);
+      quarterround_avx512vl_8blocks(x,  5,  6,  7,  4);
+      quarterround_avx512vl_8blocks(x, 10, 11,  8,  9);
+      quarterround_avx512vl_8blocks(x, 15, 12, 13, 14);
+   );
+
+   /* Feed-forward: add the input state back */
+   for (i = 0; i < 16; i++) {
+      x[i] = _mm256_add_epi32(x[i], v[i]);
+   }
+
+   /* De-interleave lanes into blocks: words 0..7 then words 8..15 */
+   transpose8x8_avx512vl(x);
+   transpose8x8_avx512vl(x + 8);
+   store8_avx512vl(out, in, x);
+   store8_avx512vl(out + 32, in != NULL ? in + 32 : NULL, x + 8);
+}
+
+/**
+   Initialize an XSalsa20 context (AVX-512VL version)
+   @param st        [out] The destination of the XSalsa20 state
+   @param key       The secret key
+   @param keylen    The length of the secret key, must be 32 (octets)
+   @param nonce     The nonce
+   @param noncelen  The length of the nonce, must be 24 (octets)
+   @param rounds    Number of rounds (must be evenly divisible by 2, default is 20)
+   @return XSALSA_OK if successful
+*/
+int xsalsa20_setup_avx512vl(xsalsa20_state *st, const unsigned char *key, unsigned long keylen,
+                                           const unsigned char *nonce, unsigned long noncelen,
+                                           int rounds)
+{
+   const int sti[] = {0, 5, 10, 15, 6, 7, 8, 9};  /* indices used to build subkey fm x */
+   ulong32       x[64];                           /* input to & output fm doubleround */
+   unsigned char subkey[32];
+   int i;
+
+   XSALSA_ARGCHK(st        != NULL);
+   XSALSA_ARGCHK(key       != NULL);
+   XSALSA_ARGCHK(keylen    == 32);
+   XSALSA_ARGCHK(nonce     != NULL);
+   XSALSA_ARGCHK(noncelen  == 24);
+   if (rounds == 0) rounds = 20;
+   XSALSA_ARGCHK(rounds % 2 == 0);     /* number of rounds must be evenly divisible by 2 */
+
+   /* load the state to "hash" the key */
+   LOAD32L(x[ 0], constants +  0);
+   LOAD32L(x[ 5], constants +  4);
+   LOAD32L(x[10], constants +  8);
+   LOAD32L(x[15], constants + 12);
+   LOAD32L(x[ 1], key +  0);
+   LOAD32L(x[ 2], key +  4);
+   LOAD32L(x[ 3], key +  8);
+   LOAD32L(x[ 4], key + 12);
+   LOAD32L(x[11], key + 16);
+   LOAD32L(x[12], key + 20);
+   LOAD32L(x[13], key + 24);
+   LOAD32L(x[14], key + 28);
+   LOAD32L(x[ 6], nonce +  0);
+   LOAD32L(x[ 7], nonce +  4);
+   LOAD32L(x[ 8], nonce +  8);
+   LOAD32L(x[ 9], nonce + 12);
+
+   /* use modified salsa20 doubleround (no final addition) */
+   s_xsalsa20_doubleround_avx512vl(x, rounds);
+
+   /* extract the subkey */
+   for (i = 0; i < 8; ++i) {
+     STORE32L(x[sti[i]], subkey + 4 * i);
+   }
+
+   /* load the final initial state */
+   LOAD32L(st->input[ 0], constants +  0);
+   LOAD32L(st->input[ 5], constants +  4);
+   LOAD32L(st->input[10], constants +  8);
+   LOAD32L(st->input[15], constants + 12);
+   LOAD32L(st->input[ 1], subkey +  0);
+   LOAD32L(st->input[ 2], subkey +  4);
+   LOAD32L(st->input[ 3], subkey +  8);
+   LOAD32L(st->input[ 4], subkey + 12);
+   LOAD32L(st->input[11], subkey + 16);
+   LOAD32L(st->input[12], subkey + 20);
+   LOAD32L(st->input[13], subkey + 24);
+   LOAD32L(st->input[14], subkey + 28);
+   LOAD32L(st->input[ 6], &(nonce[16]) + 0);
+   LOAD32L(st->input[ 7], &(nonce[16]) + 4);
+   st->input[ 8] = 0;
+   st->input[ 9] = 0;
+   st->rounds = rounds;
+   st->ksleft = 0;
+   st->ivlen  = 24;           /* set switch to say nonce/IV has been loaded */
+   XSALSA_STAT_ADD(XSALSA_IMPL_AVX512VL, setups, 1);
+
+   /* Use AVX-512VL for zeroing memory */
+   for (i = 0; i < 64; i += 8) {
+      _mm256_storeu_si256((__m256i*)(x + i), _mm256_setzero_si256());
+   }
+   for (i = 0; i < 32; i += 32) {
+      _mm256_storeu_si256((__m256i*)(subkey + i), _mm256_setzero_si256());
+   }
+
+   return XSALSA_OK;
+}
+
+/* Internal function: HSalsa20 for up to 8 contexts at once, one per lane.
+   Lanes past the last context repeat its key/nonce and are discarded. */
+static void s_xsalsa20_setup_lanes_avx512vl(xsalsa20_state *st, unsigned long lanes,
+                                            const unsigned char *keys, unsigned long keystride,
+                                            const unsigned char *nonces, int rounds)
+{
+   static const int kwi[] = {1, 2, 3, 4, 11, 12, 13, 14};  /* words loaded from the key */
+   _Alignas(32) ulong32 w[16][8];   /* lane-major key/nonce words */
+   __m256i x[16];
+   ulong32 c[4];
+   unsigned long k;
+   int i;
+
+   LOAD32L(c[0], constants +  0);
+   LOAD32L(c[1], constants +  4);
+   LOAD32L(c[2], constants +  8);
+   LOAD32L(c[3], constants + 12);
+
+   for (k = 0; k < 8; k++) {
+      unsigned long src = k < lanes ? k : lanes - 1;
+      const unsigned char *key = keys + src * keystride;
+      const unsigned char *nonce = nonces + src * 24;
+      if (keystride != 0) {
+         for (i = 0; i < 8; i++) {
+            LOAD32L(w[kwi[i]][k], key + 4 * i);
+         }
+      }
+      for (i = 0; i < 4; i++) {
+         LOAD32L(w[6 + i][k], nonce + 4 * i);
+      }
+   }
+
+   /* load the state to "hash" the keys */
+   x[ 0] = _mm256_set1_epi32((int)c[0]);
+   x[ 5] = _mm256_set1_epi32((int)c[1]);
+   x[10] = _mm256_set1_epi32((int)c[2]);
+   x[15] = _mm256_set1_epi32((int)c[3]);
+   for (i = 0; i < 8; i++) {
+      if (keystride != 0) {
+         x[kwi[i]] = _mm256_load_si256((const __m256i*)w[kwi[i]]);
+      } else {
+         /* shared key: the same word in every lane */
+         ulong32 kw;
+         LOAD32L(kw, keys + 4 * i);
+         x[kwi[i]] = _mm256_set1_epi32((int)kw);
+      }
+   }
+   for (i = 6; i < 10; i++) {
+      x[i] = _mm256_load_si256((const __m256i*)w[i]);
+   }
+
+   /* use modified salsa20 doubleround (no final addition) */
+   for (i = rounds; i > 0; i -= 2) {
+      /* columnround */
+      quarterround_avx512vl_8blocks(x,  0,  4,  8, 12);
+      quarterround_avx512vl_8blocks(x,  5,  9, 13,  1);
+      quarterround_avx512vl_8blocks(x, 10, 14,  2,  6);
+      quarterround_avx512vl_8blocks(x, 15,  3,  7, 11);
+      /* rowround */
+      quarterround_avx512vl_8blocks(x,  0,  1,  2,  3);
+      quarterround_avx512vl_8blocks(x,  5,  6,  7,  4);
+      quarterround_avx512vl_8blocks(x, 10, 11,  8,  9);
+      quarterround_avx512vl_8blocks(x, 15, 12, 13, 14);
+   }
+
+   /* extract the subkeys: words 0, 5, 10, 15, 6, 7, 8, 9 */
+   _mm256_store_si256((__m256i*)w[ 1], x[ 0]);
+   _mm256_store_si256((__m256i*)w[ 2], x[ 5]);
+   _mm256_store_si256((__m256i*)w[ 3], x[10]);
+   _mm256_store_si256((__m256i*)w[ 4], x[15]);
+   _mm256_store_si256((__m256i*)w[11], x[ 6]);
+   _mm256_store_si256((__m256i*)w[12], x[ 7]);
+   _mm256_store_si256((__m256i*)w[13], x[ 8]);
+   _mm256_store_si256((__m256i*)w[14], x[ 9]);
+
+   /* load the final initial states */
+   for (k = 0; k < lanes; k++) {
+      for (i = 0; i < 8; i++) {
+         st[k].input[kwi[i]] = w[kwi[i]][k];
+      }
+      st[k].input[ 0] = c[0];
+      st[k].input[ 5] = c[1];
+      st[k].input[10] = c[2];
+      st[k].input[15] = c[3];
+      LOAD32L(st[k].input[ 6], nonces + k * 24 + 16);
+      LOAD32L(st[k].input[ 7], nonces + k * 24 + 20);
+      st[k].input[ 8] = 0;
+      st[k].input[ 9] = 0;
+      st[k].rounds = rounds;
+      st[k].ksleft = 0;
+      st[k].ivlen  = 24;
+   }
+
+   /* Use AVX-512VL for zeroing memory */
+   for (i = 0; i < 16; i++) {
+      _mm256_store_si256((__m256i*)w[i], _mm256_setzero_si256());
+      _mm256_store_si256(&x[i], _mm256_setzero_si256());
+   }
+}
+
+/**
+   Initialize several XSalsa20 contexts at once (AVX-512VL version)
+   @param st        [out] The destinations of the XSalsa20 states (count entries)
+   @param count     The number of contexts to initialize
+   @param keys      The secret key(s)
+   @param keystride The distance between consecutive keys (0 to share one key)
+   @param keylen    The length of each secret key, must be 32 (octets)
+   @param nonces    The nonces, count * 24 octets back to back
+   @param noncelen  The length of each nonce, must be 24 (octets)
+   @param rounds    Number of rounds (must be evenly divisible by 2, default is 20)
+   @return XSALSA_OK if successful
+*/
+int xsalsa20_setup_batch_avx512vl(xsalsa20_state *st, unsigned long count,
+                                  const unsigned char *keys, unsigned long keystride, unsigned long keylen,
+                                  const unsigned char *nonces, unsigned long noncelen,
+                                  int rounds)
+{
+   unsigned long n;
+
+   if (count == 0) return XSALSA_OK; /* nothing to do */
+
+   XSALSA_ARGCHK(st        != NULL);
+   XSALSA_ARGCHK(keys      != NULL);
+   XSALSA_ARGCHK(keylen    == 32);
+   XSALSA_ARGCHK(nonces    != NULL);
+   XSALSA_ARGCHK(noncelen  == 24);
+   if (rounds == 0) rounds = 20;
+   XSALSA_ARGCHK(rounds % 2 == 0);     /* number of rounds must be evenly divisible by 2 */
+
+   /* 8 HSalsa20 permutations per pass, one per lane */
+   for (n = 0; n < count; n += 8) {
+      s_xsalsa20_setup_lanes_avx512vl(st + n, MIN(count - n, 8), keys + n * keystride, keystride,
+                                      nonces + n * 24, rounds);
+   }
+
+   XSALSA_STAT_ADD(XSALSA_IMPL_AVX512VL, setups, count);
+   return XSALSA_OK;
+}
+
+/**
+   Encrypt (or decrypt) bytes of ciphertext (or plaintext) with XSalsa20 (AVX-512VL version)
+   @param st      The XSalsa20 state
+   @param in      The plaintext (or ciphertext)
+   @param inlen   The length of the input (octets)
+   @param out     [out] The ciphertext (or plaintext), length inlen
+   @param rounds  The number of rounds (a constant in the _r8/_r12/_r20 entry points)
+   @return XSALSA_OK if successful
+*/
+static XSALSA_INLINE int s_xsalsa20_crypt_avx512vl(xsalsa20_state *st, const unsigned char *in, unsigned long inlen,
+                                                   unsigned char *out, int rounds)
+{
+   __m256i v[16];           /* Context splatted for the bulk loop */
+   unsigned long i, j;
+
+   if (inlen == 0) return XSALSA_OK; /* nothing to do */
+
+   XSALSA_ARGCHK(st        != NULL);
+   XSALSA_ARGCHK(in        != NULL);
+   XSALSA_ARGCHK(out       != NULL);
+   XSALSA_ARGCHK(st->ivlen == 24);
+   XSALSA_STAT_CALL(XSALSA_IMPL_AVX512VL, inlen);
+
+   if (st->ksleft > 0) {
+      j = MIN(st->ksleft, inlen);
+      XSALSA_STAT_ADD(XSALSA_IMPL_AVX512VL, drain_bytes, j);
+      for (i = 0; i < j; ++i, st->ksleft--) out[i] = in[i] ^ st->kstream[64 - st->ksleft];
+      inlen -= j;
+      if (inlen == 0) return XSALSA_OK;
+      out += j;
+      in  += j;
+   }
+   XSALSA_STAT_BLOCKS(XSALSA_IMPL_AVX512VL, inlen, 512);
+   
+   /* Process data in 8-block chunks for better AVX-512VL utilization */
+   if (inlen >= 512) s_salsa20_lanes_avx512vl(v, st->input);
+   while (inlen >= 512) {
+      /* Generate 8 blocks of keystream and XOR them straight into out */
+      s_salsa20_block_avx512vl_8blocks(out, in, v, rounds);
+      
+      /* Update counter for next iteration: the lanes in-vector, and the context */
+      s_salsa20_lanes_step_avx512vl(v);
+      st->input[8] += 8;
+      if (st->input[8] < 8) {  /* Overflow check */
+         st->input[9]++;
+         if (st->input[9] == 0) return XSALSA_STAT_OVERFLOW(XSALSA_IMPL_AVX512VL);
+      }
+      
+      inlen -= 512;
+      out += 512;
+      in  += 512;
+   }
+   
+   /* Whole blocks go straight to out; the keystream of a final partial block
+      goes to st->kstream, which keeps the part left unused */
+   while (inlen >= 64) {
+     s_salsa20_block_avx512vl(out, in, st->input, rounds);
+     /* XSalsa20: 64-bit counter, increment 64-bit counter */
+     if (0 == ++st->input[8] && 0 == ++st->input[9]) return XSALSA_STAT_OVERFLOW(XSALSA_IMPL_AVX512VL);
+     inlen -= 64;
+     out += 64;
+     in  += 64;
+   }
+   if (inlen == 0) return XSALSA_OK;   /* ended on a block boundary, nothing to buffer */
+
+   s_salsa20_block_avx512vl(st->kstream, NULL, st->input, rounds);
+   if (0 == ++st->input[8] && 0 == ++st->input[9]) return XSALSA_STAT_OVERFLOW(XSALSA_IMPL_AVX512VL);
+   /* Use AVX-512VL for XOR operations when possible */
+   for (i = 0; i + 32 <= inlen; i += 32) {
+      __m256i ks_vec = _mm256_loadu_si256((const __m256i*)(st->kstream + i));
+      __m256i in_vec = _mm256_loadu_si256((const __m256i*)(in + i));
+      _mm256_storeu_si256((__m256i*)(out + i), _mm256_xor_si256(in_vec, ks_vec));
+   }
+   for (; i < inlen; ++i) out[i] = in[i] ^ st->kstream[i];
+   st->ksleft = 64 - inlen;
+   return XSALSA_OK;
+}
+
+XSALSA_CRYPT_ENTRIES(avx512vl)
+
+/**
+   Encrypt (or decrypt) several independent streams at once (AVX-512VL version)
+   Every stream occupies one of the 8 lanes; a lane whose stream has
+   finished is masked out and refilled with the next pending job. Jobs
+   whose round count differs from the first job run on their own.
+   @param jobs    The jobs (state, input, length, output)
+   @param count   The number of jobs
+   @return XSALSA_OK if successful, otherwise the first error met by a job
+*/
+int xsalsa20_crypt_multi_avx512vl(xsalsa20_job *jobs, unsigned long count)
+{
+   _Alignas(32) ulong32 w[16][8];   /* input state of every lane, word-major */
+   xsalsa20_job lane[8];             /* remaining work of every lane */
+   unsigned char blk[64];
+   __m256i x[16];
+   unsigned long next = 0, i, j;
+   unsigned long blocks = 0;         /* lane blocks, counted once at the end */
+   unsigned int active = 0;           /* bit k set: lane k holds a stream */
+   int rounds = 0;
+   int err = XSALSA_OK, e;
+   int k;
+
+   if (count == 0) return XSALSA_OK; /* nothing to do */
+
+   XSALSA_ARGCHK(jobs != NULL);
+
+   for (;;) {
+      /* Refill idle lanes with pending jobs */
+      for (k = 0; k < 8 && next < count; k++) {
+         if (active & (1u << k)) continue;
+         while (next < count) {
+            xsalsa20_job *job = &jobs[next++];
+            xsalsa20_state *st = job->st;
+            if (job->inlen == 0) continue;
+            if (st == NULL || job->in == NULL || job->out == NULL || st->ivlen != 24) {
+               if (err == XSALSA_OK) err = XSALSA_INVALID_ARG;
+               continue;
+            }
+            if (rounds == 0) rounds = st->rounds;
+            if (st->rounds != rounds) {
+               e = xsalsa20_crypt_avx512vl(st, job->in, job->inlen, job->out);
+               if (err == XSALSA_OK) err = e;
+               continue;
+            }
+            lane[k] = *job;
+            XSALSA_STAT_CALL(XSALSA_IMPL_AVX512VL, job->inlen);
+            if (st->ksleft > 0) {
+               j = MIN(st->ksleft, lane[k].inlen);
+               XSALSA_STAT_ADD(XSALSA_IMPL_AVX512VL, drain_bytes, j);
+               for (i = 0; i < j; ++i, st->ksleft--) lane[k].out[i] = lane[k].in[i] ^ st->kstream[64 - st->ksleft];
+               lane[k].inlen -= j;
+               if (lane[k].inlen == 0) continue;
+               lane[k].out += j;
+               lane[k].in  += j;
+            }
+            for (i = 0; i < 16; i++) w[i][k] = st->input[i];
+            active |= 1u << k;
+            break;
+         }
+      }
+      if (active == 0) break;
+
+      /* One keystream block for every lane */
+      for (i = 0; i < 16; i++) {
+         x[i] = _mm256_load_si256((const __m256i*)w[i]);
+      }
+      for (i = rounds; i > 0; i -= 2) {
+         /* columnround */
+         quarterround_avx512vl_8blocks(x,  0,  4,  8, 12);
+         quarterround_avx512vl_8blocks(x,  5,  9, 13,  1);
+         quarterround_avx512vl_8blocks(x, 10, 14,  2,  6);
+         quarterround_avx512vl_8blocks(x, 15,  3,  7, 11);
+         /* rowround */
+         quarterround_avx512vl_8blocks(x,  0,  1,  2,  3);
+         quarterround_avx512vl_8blocks(x,  5,  6,  7,  4);
+         quarterround_avx512vl_8blocks(x, 10, 11,  8,  9);
+         quarterround_avx512vl_8blocks(x, 15, 12, 13, 14);
+      }
+      for (i = 0; i < 16; i++) {
+         x[i] = _mm256_add_epi32(x[i], _mm256_load_si256((const __m256i*)w[i]));
+      }
+      transpose8x8_avx512vl(x);
+      transpose8x8_avx512vl(x + 8);
+
+      /* Consume the block of every active lane */
+      for (k = 0; k < 8; k++) {
+         xsalsa20_state *st = lane[k].st;
+         if (!(active & (1u << k))) continue;
+         blocks++;
+         /* XSalsa20: 64-bit counter, increment 64-bit counter */
+         if (0 == ++w[8][k] && 0 == ++w[9][k]) {
+            XSALSA_STAT_ADD(XSALSA_IMPL_AVX512VL, overflows, 1);
+            if (err == XSALSA_OK) err = XSALSA_OVERFLOW;
+            lane[k].inlen = 0;
+         } else if (lane[k].inlen >= 64) {
+            _mm256_storeu_si256((__m256i*)(lane[k].out), _mm256_xor_si256(x[k],
+                                _mm256_loadu_si256((const __m256i*)(lane[k].in))));
+            _mm256_storeu_si256((__m256i*)(lane[k].out + 32), _mm256_xor_si256(x[8 + k],
+                                _mm256_loadu_si256((const __m256i*)(lane[k].in + 32))));
+            lane[k].inlen -= 64;
+            lane[k].out += 64;
+            lane[k].in  += 64;
+         } else {
+            _mm256_storeu_si256((__m256i*)(blk), x[k]);
+            _mm256_storeu_si256((__m256i*)(blk + 32), x[8 + k]);
+            for (i = 0; i < lane[k].inlen; ++i) lane[k].out[i] = lane[k].in[i] ^ blk[i];
+            st->ksleft = 64 - lane[k].inlen;
+            for (i = lane[k].inlen; i < 64; ++i) st->kstream[i] = blk[i];
+            lane[k].inlen = 0;
+         }
+         if (lane[k].inlen == 0) {
+            st->input[8] = w[8][k];
+            st->input[9] = w[9][k];
+            active &= ~(1u << k);
+         }
+      }
+   }
+
+   XSALSA_STAT_ADD(XSALSA_IMPL_AVX512VL, bulk_blocks, blocks);
+   zeromem(blk, sizeof(blk));
+   zeromem(w, sizeof(w));
+   zeromem(x, sizeof(x));
+   return err;
+}
+
+/**
+   Encrypt (or decrypt) a batch of packets that share one key (AVX-512VL version)
+   Packets are taken 16 at a time: their subkeys are derived 8 per pass
+   with the batch setup, then the chunk runs through the multi-buffer kernel
+   while its states are still in cache.
+   @param key       The secret key shared by every packet
+   @param keylen    The length of the secret key, must be 32 (octets)
+   @param nonces    The nonces, count * 24 octets back to back
+   @param noncelen  The length of each nonce, must be 24 (octets)
+   @param rounds    Number of rounds (must be evenly divisible by 2, default is 20)
+   @param count     The number of packets
+   @param in        The input of every packet
+   @param inlen     The length of every packet (octets)
+   @param out       [out] The output of every packet, length inlen[n]
+   @return XSALSA_OK if successful, otherwise the first error met by a packet
+*/
+int xsalsa20_crypt_batch_avx512vl(const unsigned char *key, unsigned long keylen,
+                                  const unsigned char *nonces, unsigned long noncelen,
+                                  int rounds, unsigned long count,
+                                  const unsigned char *const *in, const unsigned long *inlen,
+                                  unsigned char *const *out)
+{
+   xsalsa20_state st[16];
+   xsalsa20_job jobs[16];
+   unsigned long n, k, c;
+   int err = XSALSA_OK, e;
+
+   if (count == 0) return XSALSA_OK; /* nothing to do */
+
+   XSALSA_ARGCHK(key       != NULL);
+   XSALSA_ARGCHK(nonces    != NULL);
+   XSALSA_ARGCHK(in        != NULL);
+   XSALSA_ARGCHK(inlen     != NULL);
+   XSALSA_ARGCHK(out       != NULL);
+
+   for (n = 0; n < count; n += c) {
+      c = MIN(count - n, 16);
+      if ((e = xsalsa20_setup_batch_avx512vl(st, c, key, 0, keylen, nonces + n * 24, noncelen, rounds)) != XSALSA_OK) {
+         return e;
+      }
+      for (k = 0; k < c; k++) {
+         jobs[k].st    = &st[k];
+         jobs[k].in    = in[n + k];
+         jobs[k].inlen = inlen[n + k];
+         jobs[k].out   = out[n + k];
+      }
+      e = xsalsa20_crypt_multi_avx512vl(jobs, c);
+      if (err == XSALSA_OK) err = e;
+   }
+
+   for (k = 0; k < 16; k++) xsalsa20_done(&st[k]);
+   return err;
+}
+
+/**
+   Generate keystream bytes (AVX-512VL version)
+   @param st      The XSalsa20 state
+   @param out     [out] The keystream output
+   @param outlen  The number of keystream bytes to generate
+   @param rounds  The number of rounds (a constant in the _r8/_r12/_r20 entry points)
+   @return XSALSA_OK if successful
+*/
+static XSALSA_INLINE int s_xsalsa20_keystream_avx512vl(xsalsa20_state *st, unsigned char *out, unsigned long outlen,
+                                                       int rounds)
+{
+   __m256i v[16];           /* Context splatted for the bulk loop */
+   unsigned long i, j;
+
+   if (outlen == 0) return XSALSA_OK; /* nothing to do */
+
+   XSALSA_ARGCHK(st        != NULL);
+   XSALSA_ARGCHK(out       != NULL);
+   XSALSA_ARGCHK(st->ivlen == 24);
+   XSALSA_STAT_CALL(XSALSA_IMPL_AVX512VL, outlen);
+
+   if (st->ksleft > 0) {
+      j = MIN(st->ksleft, outlen);
+      XSALSA_STAT_ADD(XSALSA_IMPL_AVX512VL, drain_bytes, j);
+      for (i = 0; i < j; ++i, st->ksleft--) out[i] = st->kstream[64 - st->ksleft];
+      outlen -= j;
+      if (outlen == 0) return XSALSA_OK;
+      out += j;
+   }
+   XSALSA_STAT_BLOCKS(XSALSA_IMPL_AVX512VL, outlen, 512);
+   
+   /* Process data in 8-block chunks for better AVX-512VL utilization */
+   if (outlen >= 512) s_salsa20_lanes_avx512vl(v, st->input);
+   while (outlen >= 512) {
+      /* Generate 8 blocks of keystream straight into out */
+      s_salsa20_block_avx512vl_8blocks(out, NULL, v, rounds);
+      
+      /* Update counter for next iteration: the lanes in-vector, and the context */
+      s_salsa20_lanes_step_avx512vl(v);
+      st->input[8] += 8;
+      if (st->input[8] < 8) {  /* Overflow check */
+         st->input[9]++;
+         if (st->input[9] == 0) return XSALSA_STAT_OVERFLOW(XSALSA_IMPL_AVX512VL);
+      }
+      
+      outlen -= 512;
+      out += 512;
+   }
+   
+   /* Whole blocks go straight to out; the keystream of a final partial block
+      goes to st->kstream, which keeps the part left unused */
+   while (outlen >= 64) {
+     s_salsa20_block_avx512vl(out, NULL, st->input, rounds);
+     /* XSalsa20: 64-bit counter, increment 64-bit counter */
+     if (0 == ++st->input[8] && 0 == ++st->input[9]) return XSALSA_STAT_OVERFLOW(XSALSA_IMPL_AVX512VL);
+     outlen -= 64;
+     out += 64;
+   }
+   if (outlen == 0) return XSALSA_OK;   /* ended on a block boundary, nothing to buffer */
+
+   s_salsa20_block_avx512vl(st->kstream, NULL, st->input, rounds);
+   if (0 == ++st->input[8] && 0 == ++st->input[9]) return XSALSA_STAT_OVERFLOW(XSALSA_IMPL_AVX512VL);
+   /* Use AVX-512VL for memory copy when possible */
+   for (i = 0; i + 32 <= outlen; i += 32) {
+      _mm256_storeu_si256((__m256i*)(out + i), _mm256_loadu_si256((const __m256i*)(st->kstream + i)));
+   }
+   for (; i < outlen; ++i) out[i] = st->kstream[i];
+   st->ksleft = 64 - outlen;
+   return XSALSA_OK;
+}
+
+XSALSA_KEYSTREAM_ENTRIES(avx512vl)
+
+/**
+   One-shot encryption/decryption function (AVX-512VL version)
+   @param key       The secret key (32 bytes)
+   @param keylen    The length of the secret key (must be 32)
+   @param nonce     The nonce (24 bytes)
+   @param noncelen  The length of the nonce (must be 24)
+   @param rounds    Number of rounds (must be evenly divisible by 2, default is 20)
+   @param datain    The input data
+   @param datalen   The length of the input data
+   @param dataout   [out] The output data (same length as input)
+   @return XSALSA_OK if successful
+*/
+int xsalsa20_memory_avx512vl(const unsigned char *key, unsigned long keylen,
+                         const unsigned char *nonce, unsigned long noncelen,
+                         unsigned long rounds,
+                         const unsigned char *datain, unsigned long datalen,
+                         unsigned char *dataout)
+{
+   xsalsa20_state st;
+   int err;
+
+   XSALSA_ARGCHK(key       != NULL);
+   XSALSA_ARGCHK(nonce     != NULL);
+   XSALSA_ARGCHK(datain    != NULL);
+   XSALSA_ARGCHK(dataout   != NULL);
+
+   if ((err = xsalsa20_setup_avx512vl(&st, key, keylen, nonce, noncelen, (int)rounds)) != XSALSA_OK) {
+      return err;
+   }
+   if ((err = xsalsa20_crypt_avx512vl(&st, datain, datalen, dataout)) != XSALSA_OK) {
+      xsalsa20_done(&st);
+      return err;
+   }
+   xsalsa20_done(&st);
+   return XSALSA_OK;
+} 
\ No newline at end of file
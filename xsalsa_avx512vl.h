@@ -0,0 +1,58 @@
+#ifndef XSALSA_AVX512VL_H
+#define XSALSA_AVX512VL_H
+
+#include "xsalsa.h"
+#include "xsalsa_poly1305_impl.h"
+
+int xsalsa20_setup_avx512vl(xsalsa20_state *st, const unsigned char *key, unsigned long keylen,
+                                           const unsigned char *nonce, unsigned long noncelen,
+                                           int rounds);
+int xsalsa20_setup_batch_avx512vl(xsalsa20_state *st, unsigned long count,
+                                  const unsigned char *keys, unsigned long keystride, unsigned long keylen,
+                                  const unsigned char *nonces, unsigned long noncelen,
+                                  int rounds);
+int xsalsa20_crypt_avx512vl(xsalsa20_state *st, const unsigned char *in, unsigned long inlen, unsigned char *out);
+int xsalsa20_crypt_avx512vl_r8(xsalsa20_state *st, const unsigned char *in, unsigned long inlen, unsigned char *out);
+int xsalsa20_crypt_avx512vl_r12(xsalsa20_state *st, const unsigned char *in, unsigned long inlen, unsigned char *out);
+int xsalsa20_crypt_avx512vl_r20(xsalsa20_state *st, const unsigned char *in, unsigned long inlen, unsigned char *out);
+int xsalsa20_crypt_multi_avx512vl(xsalsa20_job *jobs, unsigned long count);
+int xsalsa20_crypt_batch_avx512vl(const unsigned char *key, unsigned long keylen,
+                                  const unsigned char *nonces, unsigned long noncelen,
+                                  int rounds, unsigned long count,
+                                  const unsigned char *const *in, const unsigned long *inlen,
+                                  unsigned char *const *out);
+int xsalsa20_keystream_avx512vl(xsalsa20_state *st, unsigned char *out, unsigned long outlen);
+int xsalsa20_keystream_avx512vl_r8(xsalsa20_state *st, unsigned char *out, unsigned long outlen);
+int xsalsa20_keystream_avx512vl_r12(xsalsa20_state *st, unsigned char *out, unsigned long outlen);
+int xsalsa20_keystream_avx512vl_r20(xsalsa20_state *st, unsigned char *out, unsigned long outlen);
+int xsalsa20_memory_avx512vl(const unsigned char *key, unsigned long keylen,
+                         const unsigned char *nonce, unsigned long noncelen,
+                         unsigned long rounds,
+                         const unsigned char *datain, unsigned long datalen,
+                         unsigned char *dataout);
+
+static inline void xsalsa20_avx512vl_init(xsalsa20_setup_fn *xsalsa20_setup_impl, xsalsa20_setup_batch_fn *xsalsa20_setup_batch_impl, xsalsa20_crypt_fn *xsalsa20_crypt_impl, xsalsa20_crypt_multi_fn *xsalsa20_crypt_multi_impl, xsalsa20_crypt_batch_fn *xsalsa20_crypt_batch_impl, xsalsa20_keystream_fn *xsalsa20_keystream_impl, xsalsa20_memory_fn *xsalsa20_memory_impl, xsalsa20_poly1305_blocks_fn *xsalsa20_poly1305_blocks_impl, xsalsa20_crypt_fn *xsalsa20_crypt_rounds_impl, xsalsa20_keystream_fn *xsalsa20_keystream_rounds_impl) {
+    #ifdef XSALSA_USE_IMPL_AVX512VL
+    *xsalsa20_setup_impl = xsalsa20_setup_avx512vl;
+    *xsalsa20_setup_batch_impl = xsalsa20_setup_batch_avx512vl;
+    *xsalsa20_crypt_impl = xsalsa20_crypt_avx512vl;
+    *xsalsa20_crypt_multi_impl = xsalsa20_crypt_multi_avx512vl;
+    *xsalsa20_crypt_batch_impl = xsalsa20_crypt_batch_avx512vl;
+    *xsalsa20_keystream_impl = xsalsa20_keystream_avx512vl;
+    *xsalsa20_memory_impl = xsalsa20_memory_avx512vl;
+    xsalsa20_crypt_rounds_impl[0] = xsalsa20_crypt_avx512vl_r8;
+    xsalsa20_crypt_rounds_impl[1] = xsalsa20_crypt_avx512vl_r12;
+    xsalsa20_crypt_rounds_impl[2] = xsalsa20_crypt_avx512vl_r20;
+    xsalsa20_keystream_rounds_impl[0] = xsalsa20_keystream_avx512vl_r8;
+    xsalsa20_keystream_rounds_impl[1] = xsalsa20_keystream_avx512vl_r12;
+    xsalsa20_keystream_rounds_impl[2] = xsalsa20_keystream_avx512vl_r20;
+    #ifdef XSALSA_USE_IMPL_AVX2
+    *xsalsa20_poly1305_blocks_impl = xsalsa20_poly1305_blocks_avx2;
+    #else
+    *xsalsa20_poly1305_blocks_impl = xsalsa20_poly1305_blocks_scalar;
+    #endif
+    #endif
+}
+
+
+#endif /* XSALSA_AVX512VL_H */ 
\ No newline at end of file
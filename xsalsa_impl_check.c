@@ -3,6 +3,8 @@
 
 /* CPU feature detection */
 static volatile int impl_selected = -1;  /* -1 = not checked */
+static volatile int impl_policy = XSALSA_POLICY_THROUGHPUT | XSALSA_POLICY_ADAPTIVE;
+static volatile int impl_forced = 0;     /* set by xsalsa20_force_impl */
 
 #ifdef XSALSA_ARCH_X86
 
@@ -32,6 +34,22 @@ bool check_avx512_support(void)
     /* EBX[16] - AVX-512F flag */
     return (cpu_info[1] & (1 << 16));
 }
+
+bool check_avx512vl_support(void)
+{
+    int cpu_info[4];
+    __cpuid(cpu_info, 7);
+    /* EBX[16] - AVX-512F flag, EBX[31] - AVX-512VL flag */
+    return (cpu_info[1] & (1 << 16)) && (cpu_info[1] & (1u << 31));
+}
+
+bool check_avx512ifma_support(void)
+{
+    int cpu_info[4];
+    __cpuid(cpu_info, 7);
+    /* EBX[16] - AVX-512F flag, EBX[21] - AVX-512 IFMA flag */
+    return (cpu_info[1] & (1 << 16)) && (cpu_info[1] & (1 << 21));
+}
 #else
 #include <cpuid.h>
 
@@ -72,6 +90,30 @@ bool check_avx512_support(void)
     /* EBX[16] - AVX-512F flag */
     return (ebx & (1 << 16));
 }
+
+bool check_avx512vl_support(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) == 0) {
+        return false;
+    }
+
+    /* EBX[16] - AVX-512F flag, EBX[31] - AVX-512VL flag */
+    return (ebx & (1 << 16)) && (ebx & (1u << 31));
+}
+
+bool check_avx512ifma_support(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) == 0) {
+        return false;
+    }
+
+    /* EBX[16] - AVX-512F flag, EBX[21] - AVX-512 IFMA flag */
+    return (ebx & (1 << 16)) && (ebx & (1 << 21));
+}
 #endif /* _WIN32 */
 
 #else /* XSALSA_ARCH_X86 */
@@ -89,6 +131,16 @@ bool check_avx512_support(void)
 {
     return false;
 }
+
+bool check_avx512vl_support(void)
+{
+    return false;
+}
+
+bool check_avx512ifma_support(void)
+{
+    return false;
+}
 #endif /* XSALSA_ARCH_X86 */
 
 int xsalsa20_get_best_impl(void)
@@ -99,12 +151,19 @@ int xsalsa20_get_best_impl(void)
 
     /* Check for best available implementation in order of preference */
     #ifdef XSALSA_USE_IMPL_AVX512
-    if (check_avx512_support()) {
+    if (!(impl_policy & XSALSA_POLICY_NO_ZMM) && check_avx512_support()) {
         impl_selected = XSALSA_IMPL_AVX512;
         return impl_selected;
     }
     #endif
 
+    #ifdef XSALSA_USE_IMPL_AVX512VL
+    if (check_avx512vl_support()) {
+        impl_selected = XSALSA_IMPL_AVX512VL;
+        return impl_selected;
+    }
+    #endif
+
     #ifdef XSALSA_USE_IMPL_AVX2
     if (check_avx2_support()) {
         impl_selected = XSALSA_IMPL_AVX2;
@@ -126,5 +185,24 @@ int xsalsa20_get_best_impl(void)
 void xsalsa20_force_impl(int impl)
 {
     impl_selected = impl;
+    impl_forced = 1;
+    xsalsa20_reset_impl();
+}
+
+void xsalsa20_set_impl_policy(int policy)
+{
+    impl_policy = policy;
+    impl_selected = -1;
+    impl_forced = 0;
     xsalsa20_reset_impl();
+}
+
+int xsalsa20_get_impl_policy(void)
+{
+    return impl_policy;
+}
+
+bool xsalsa20_impl_forced(void)
+{
+    return impl_forced != 0;
 } 
\ No newline at end of file
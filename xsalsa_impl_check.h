@@ -7,6 +7,8 @@
 bool check_avx_support(void);
 bool check_avx2_support(void);
 bool check_avx512_support(void);
+bool check_avx512vl_support(void);
+bool check_avx512ifma_support(void);
 
 /**
  * Get the best available implementation
@@ -20,4 +22,10 @@ int xsalsa20_get_best_impl(void);
  */
 void xsalsa20_force_impl(int impl);
 
+/**
+ * Check whether xsalsa20_force_impl pinned an implementation
+ * @return true until the next xsalsa20_set_impl_policy (declared in xsalsa.h)
+ */
+bool xsalsa20_impl_forced(void);
+
 #endif /* XSALSA_IMPL_CHECK_H */
\ No newline at end of file
@@ -0,0 +1,291 @@
+#include "xsalsa.h"
+#include <stddef.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#define XSALSA_ARGCHK(x) do { if (!(x)) return XSALSA_INVALID_ARG; } while(0)
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+/* Upper bound on worker threads (and on ranges per call) */
+#define XSALSA_MAX_THREADS 64
+
+/* Ranges start on multiples of the widest kernel step (16 blocks), so every
+   range runs the same bulk/tail split as a serial call would */
+#define XSALSA_RANGE_ALIGN 1024UL
+
+/* Smallest range worth handing to another thread */
+#define XSALSA_MIN_RANGE (256UL * 1024)
+
+/* Thread primitives */
+#ifdef _WIN32
+typedef CRITICAL_SECTION xsalsa_mutex;
+typedef CONDITION_VARIABLE xsalsa_cond;
+#define mutex_init(m)      InitializeCriticalSection(m)
+#define mutex_lock(m)      EnterCriticalSection(m)
+#define mutex_unlock(m)    LeaveCriticalSection(m)
+#define cond_init(c)       InitializeConditionVariable(c)
+#define cond_wait(c, m)    SleepConditionVariableCS(c, m, INFINITE)
+#define cond_broadcast(c)  WakeAllConditionVariable(c)
+#else
+typedef pthread_mutex_t xsalsa_mutex;
+typedef pthread_cond_t xsalsa_cond;
+#define mutex_init(m)      pthread_mutex_init(m, NULL)
+#define mutex_lock(m)      pthread_mutex_lock(m)
+#define mutex_unlock(m)    pthread_mutex_unlock(m)
+#define cond_init(c)       pthread_cond_init(c, NULL)
+#define cond_wait(c, m)    pthread_cond_wait(c, m)
+#define cond_broadcast(c)  pthread_cond_broadcast(c)
+#endif
+
+/* One counter-aligned slice of a parallel call */
+typedef struct {
+    xsalsa20_state st;        /* Private copy, counter set to the slice start */
+    const unsigned char *in;
+    unsigned long inlen;
+    unsigned char *out;
+    int err;
+} xsalsa20_range;
+
+/* Internal thread pool, created on first use and stopped when the library is
+   unloaded (on Windows the library stays loaded once the pool has started) */
+static struct {
+    xsalsa_mutex lock;        /* Guards every field below */
+    xsalsa_cond work;         /* Signalled when ranges are published */
+    xsalsa_cond done;         /* Signalled when the last range finishes */
+    xsalsa_mutex call;        /* Serialises parallel calls on the pool */
+    xsalsa20_range *ranges;
+    unsigned int nranges;
+    unsigned int next;        /* Next range to hand out */
+    unsigned int pending;     /* Ranges not finished yet */
+    unsigned int nthreads;    /* Worker threads started so far */
+    int stopping;             /* Set on unload: workers exit once no range is left */
+#ifndef _WIN32
+    pthread_t threads[XSALSA_MAX_THREADS];
+#endif
+} pool;
+
+static volatile unsigned int pool_threads = 0;   /* 0 = one per online CPU */
+
+#ifdef _WIN32
+static INIT_ONCE pool_once = INIT_ONCE_STATIC_INIT;
+#else
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+#endif
+
+
+/* Internal function: Zero memory */
+static void zeromem(volatile void *out, size_t outlen)
+{
+    volatile unsigned char *x = (volatile unsigned char *)out;
+    while (outlen--) *x++ = 0;
+}
+
+static unsigned int online_cpus(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return (unsigned int)si.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (unsigned int)n : 1;
+#endif
+}
+
+#ifdef _WIN32
+static BOOL CALLBACK pool_init(PINIT_ONCE once, PVOID param, PVOID *ctx)
+{
+    (void)once; (void)param; (void)ctx;
+#else
+static void pool_init(void)
+{
+#endif
+    mutex_init(&pool.lock);
+    mutex_init(&pool.call);
+    cond_init(&pool.work);
+    cond_init(&pool.done);
+#ifdef _WIN32
+    return TRUE;
+#endif
+}
+
+/* Worker: take ranges until none are left, then sleep until the next call or the pool stops */
+#ifdef _WIN32
+static DWORD WINAPI pool_worker(LPVOID arg)
+#else
+static void *pool_worker(void *arg)
+#endif
+{
+    xsalsa20_range *r;
+
+    (void)arg;
+    mutex_lock(&pool.lock);
+    for (;;) {
+        while (pool.next >= pool.nranges && !pool.stopping) {
+            cond_wait(&pool.work, &pool.lock);
+        }
+        if (pool.next >= pool.nranges) break;
+        r = &pool.ranges[pool.next++];
+        mutex_unlock(&pool.lock);
+
+        r->err = xsalsa20_crypt(&r->st, r->in, r->inlen, r->out);
+
+        mutex_lock(&pool.lock);
+        if (--pool.pending == 0) {
+            cond_broadcast(&pool.done);
+        }
+    }
+    mutex_unlock(&pool.lock);
+#ifdef _WIN32
+    return 0;
+#else
+    return NULL;
+#endif
+}
+
+/* Start workers until the pool has want threads; returns the number running */
+static unsigned int pool_grow(unsigned int want)
+{
+    while (pool.nthreads < want && pool.nthreads < XSALSA_MAX_THREADS) {
+#ifdef _WIN32
+        HANDLE h;
+        HMODULE self;
+        /* Workers cannot be joined from DllMain (exiting needs the loader lock),
+           so the first one pins the DLL: FreeLibrary then never unmaps their code */
+        if (pool.nthreads == 0) {
+            GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_PIN,
+                               (LPCSTR)(void *)pool_worker, &self);
+        }
+        h = CreateThread(NULL, 0, pool_worker, NULL, 0, NULL);
+        if (h == NULL) break;
+        CloseHandle(h);
+#else
+        if (pthread_create(&pool.threads[pool.nthreads], NULL, pool_worker, NULL) != 0) break;
+#endif
+        pool.nthreads++;
+    }
+    return pool.nthreads;
+}
+
+#ifndef _WIN32
+/* Library unload (dlclose) or exit: wake and join the workers before their code goes away */
+__attribute__((destructor)) static void pool_stop(void)
+{
+    unsigned int k, n;
+
+    if (pool.nthreads == 0) return;   /* the pool was never started */
+    mutex_lock(&pool.lock);
+    pool.stopping = 1;
+    n = pool.nthreads;
+    cond_broadcast(&pool.work);
+    mutex_unlock(&pool.lock);
+    for (k = 0; k < n; k++) pthread_join(pool.threads[k], NULL);
+}
+#endif
+
+
+void xsalsa20_set_threads(unsigned int threads)
+{
+    pool_threads = MIN(threads, XSALSA_MAX_THREADS);
+}
+
+
+int xsalsa20_crypt_parallel(xsalsa20_state *st, const unsigned char *in, unsigned long inlen, unsigned char *out)
+{
+    static xsalsa20_range ranges[XSALSA_MAX_THREADS];
+    unsigned long step, off, j;
+    unsigned int threads, n, k, pooled;
+    ulong64 block, blocks;
+    int err = XSALSA_OK;
+
+    XSALSA_ARGCHK(st        != NULL);
+    XSALSA_ARGCHK(st->ivlen == 24);
+    if (inlen == 0) return XSALSA_OK; /* nothing to do */
+    XSALSA_ARGCHK(in        != NULL);
+    XSALSA_ARGCHK(out       != NULL);
+
+    /* Drain buffered keystream first so the rest starts on a block boundary.
+       This also resolves the implementation before any worker runs. */
+    j = MIN(st->ksleft, inlen);
+    if ((err = xsalsa20_crypt(st, in, j, out)) != XSALSA_OK) return err;
+    inlen -= j;
+    in  += j;
+    out += j;
+
+    threads = pool_threads;
+    if (threads == 0) threads = MIN(online_cpus(), XSALSA_MAX_THREADS);
+    threads = (unsigned int)MIN(threads, inlen / XSALSA_MIN_RANGE);
+
+    /* Ranges that would cross the counter wrap keep the serial overflow behaviour */
+    block  = ((ulong64)st->input[9] << 32) | st->input[8];
+    blocks = (ulong64)inlen / 64 + 1;
+    if (inlen < XSALSA_PARALLEL_THRESHOLD || threads < 2 || block > ~(ulong64)0 - blocks) {
+        return xsalsa20_crypt(st, in, inlen, out);
+    }
+
+    step = (inlen + threads - 1) / threads;
+    step = (step + XSALSA_RANGE_ALIGN - 1) & ~(XSALSA_RANGE_ALIGN - 1);
+
+#ifdef _WIN32
+    InitOnceExecuteOnce(&pool_once, pool_init, NULL, NULL);
+#else
+    pthread_once(&pool_once, pool_init);
+#endif
+    mutex_lock(&pool.call);
+
+    for (n = 0, off = 0; off < inlen; n++, off += step) {
+        ulong64 b = block + off / 64;
+        ranges[n].st = *st;
+        ranges[n].st.input[8] = (ulong32)b;
+        ranges[n].st.input[9] = (ulong32)(b >> 32);
+        ranges[n].in = in + off;
+        ranges[n].inlen = MIN(step, inlen - off);
+        ranges[n].out = out + off;
+        ranges[n].err = XSALSA_OK;
+    }
+
+    /* The caller runs range 0 itself, the pool takes the rest */
+    mutex_lock(&pool.lock);
+    pooled = !pool.stopping && pool_grow(n - 1) > 0;
+    if (pooled) {
+        pool.ranges = ranges;
+        pool.next = 1;
+        pool.pending = n - 1;
+        pool.nranges = n;
+        cond_broadcast(&pool.work);
+    }
+    mutex_unlock(&pool.lock);
+
+    if (!pooled) {
+        /* No worker could be started, or the pool has stopped */
+        for (k = 1; k < n; k++) {
+            ranges[k].err = xsalsa20_crypt(&ranges[k].st, ranges[k].in, ranges[k].inlen, ranges[k].out);
+        }
+    }
+    ranges[0].err = xsalsa20_crypt(&ranges[0].st, ranges[0].in, ranges[0].inlen, ranges[0].out);
+
+    mutex_lock(&pool.lock);
+    while (pool.pending > 0) {
+        cond_wait(&pool.done, &pool.lock);
+    }
+    pool.nranges = 0;
+    pool.next = 0;
+    mutex_unlock(&pool.lock);
+
+    for (k = 0; k < n; k++) {
+        if (err == XSALSA_OK) err = ranges[k].err;
+    }
+
+    /* The last range ends where a serial call would */
+    *st = ranges[n - 1].st;
+    zeromem(ranges, n * sizeof(ranges[0]));
+
+    mutex_unlock(&pool.call);
+    return err;
+}
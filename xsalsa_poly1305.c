@@ -0,0 +1,262 @@
+#include "xsalsa_poly1305_impl.h"
+#include <string.h>
+
+/* Byte-wise little-endian access, independent of host byte order */
+#define LOAD32L(x, y) do { \
+    x = ((ulong32)((y)[0] & 255)) | \
+        ((ulong32)((y)[1] & 255) << 8) | \
+        ((ulong32)((y)[2] & 255) << 16) | \
+        ((ulong32)((y)[3] & 255) << 24); \
+} while(0)
+
+#define STORE32L(x, y) do { \
+    (y)[0] = (unsigned char)((x)&255); \
+    (y)[1] = (unsigned char)(((x)>>8)&255); \
+    (y)[2] = (unsigned char)(((x)>>16)&255); \
+    (y)[3] = (unsigned char)(((x)>>24)&255); \
+} while(0)
+
+/* Internal function: Zero memory */
+static void zeromem(volatile void *out, size_t outlen)
+{
+   volatile unsigned char *x = (volatile unsigned char *)out;
+   while (outlen--) *x++ = 0;
+}
+
+/**
+   Absorb whole 16-byte blocks (scalar version)
+   @param st      The Poly1305 state
+   @param in      The message blocks
+   @param inlen   The length of the message, a multiple of 16 (octets)
+*/
+void xsalsa20_poly1305_blocks_scalar(xsalsa20_poly1305_state *st, const unsigned char *in, unsigned long inlen)
+{
+   const ulong32 hibit = st->final ? 0 : (1UL << 24);   /* 1 << 128 */
+   ulong32 r0, r1, r2, r3, r4;
+   ulong32 s1, s2, s3, s4;
+   ulong32 h0, h1, h2, h3, h4;
+   ulong32 t0, t1, t2, t3, t4, c;
+   ulong64 d0, d1, d2, d3, d4;
+
+   r0 = st->r[0]; r1 = st->r[1]; r2 = st->r[2]; r3 = st->r[3]; r4 = st->r[4];
+   s1 = r1 * 5; s2 = r2 * 5; s3 = r3 * 5; s4 = r4 * 5;
+   h0 = st->h[0]; h1 = st->h[1]; h2 = st->h[2]; h3 = st->h[3]; h4 = st->h[4];
+
+   while (inlen >= 16) {
+      /* h += m[i] */
+      LOAD32L(t0, in +  0);
+      LOAD32L(t1, in +  3);
+      LOAD32L(t2, in +  6);
+      LOAD32L(t3, in +  9);
+      LOAD32L(t4, in + 12);
+      h0 += (t0     ) & 0x3ffffff;
+      h1 += (t1 >> 2) & 0x3ffffff;
+      h2 += (t2 >> 4) & 0x3ffffff;
+      h3 += (t3 >> 6) & 0x3ffffff;
+      h4 += (t4 >> 8) | hibit;
+
+      /* h *= r */
+      d0 = ((ulong64)h0 * r0) + ((ulong64)h1 * s4) + ((ulong64)h2 * s3) + ((ulong64)h3 * s2) + ((ulong64)h4 * s1);
+      d1 = ((ulong64)h0 * r1) + ((ulong64)h1 * r0) + ((ulong64)h2 * s4) + ((ulong64)h3 * s3) + ((ulong64)h4 * s2);
+      d2 = ((ulong64)h0 * r2) + ((ulong64)h1 * r1) + ((ulong64)h2 * r0) + ((ulong64)h3 * s4) + ((ulong64)h4 * s3);
+      d3 = ((ulong64)h0 * r3) + ((ulong64)h1 * r2) + ((ulong64)h2 * r1) + ((ulong64)h3 * r0) + ((ulong64)h4 * s4);
+      d4 = ((ulong64)h0 * r4) + ((ulong64)h1 * r3) + ((ulong64)h2 * r2) + ((ulong64)h3 * r1) + ((ulong64)h4 * r0);
+
+      /* (partial) h %= p */
+                    c = (ulong32)(d0 >> 26); h0 = (ulong32)d0 & 0x3ffffff;
+      d1 += c;      c = (ulong32)(d1 >> 26); h1 = (ulong32)d1 & 0x3ffffff;
+      d2 += c;      c = (ulong32)(d2 >> 26); h2 = (ulong32)d2 & 0x3ffffff;
+      d3 += c;      c = (ulong32)(d3 >> 26); h3 = (ulong32)d3 & 0x3ffffff;
+      d4 += c;      c = (ulong32)(d4 >> 26); h4 = (ulong32)d4 & 0x3ffffff;
+      h0 += c * 5;  c = (h0 >> 26); h0 = h0 & 0x3ffffff;
+      h1 += c;
+
+      in += 16;
+      inlen -= 16;
+   }
+
+   st->h[0] = h0; st->h[1] = h1; st->h[2] = h2; st->h[3] = h3; st->h[4] = h4;
+}
+
+/* Internal function: a = a * b mod 2^130 - 5, carried to 26-bit limbs */
+static void s_poly1305_mul(ulong32 a[5], const ulong32 b[5])
+{
+   ulong32 s1 = b[1] * 5, s2 = b[2] * 5, s3 = b[3] * 5, s4 = b[4] * 5;
+   ulong64 d0, d1, d2, d3, d4;
+   ulong32 c;
+
+   d0 = ((ulong64)a[0] * b[0]) + ((ulong64)a[1] * s4) + ((ulong64)a[2] * s3) + ((ulong64)a[3] * s2) + ((ulong64)a[4] * s1);
+   d1 = ((ulong64)a[0] * b[1]) + ((ulong64)a[1] * b[0]) + ((ulong64)a[2] * s4) + ((ulong64)a[3] * s3) + ((ulong64)a[4] * s2);
+   d2 = ((ulong64)a[0] * b[2]) + ((ulong64)a[1] * b[1]) + ((ulong64)a[2] * b[0]) + ((ulong64)a[3] * s4) + ((ulong64)a[4] * s3);
+   d3 = ((ulong64)a[0] * b[3]) + ((ulong64)a[1] * b[2]) + ((ulong64)a[2] * b[1]) + ((ulong64)a[3] * b[0]) + ((ulong64)a[4] * s4);
+   d4 = ((ulong64)a[0] * b[4]) + ((ulong64)a[1] * b[3]) + ((ulong64)a[2] * b[2]) + ((ulong64)a[3] * b[1]) + ((ulong64)a[4] * b[0]);
+
+                  c = (ulong32)(d0 >> 26); a[0] = (ulong32)d0 & 0x3ffffff;
+   d1 += c;       c = (ulong32)(d1 >> 26); a[1] = (ulong32)d1 & 0x3ffffff;
+   d2 += c;       c = (ulong32)(d2 >> 26); a[2] = (ulong32)d2 & 0x3ffffff;
+   d3 += c;       c = (ulong32)(d3 >> 26); a[3] = (ulong32)d3 & 0x3ffffff;
+   d4 += c;       c = (ulong32)(d4 >> 26); a[4] = (ulong32)d4 & 0x3ffffff;
+   a[0] += c * 5; c = a[0] >> 26;          a[0] &= 0x3ffffff;
+   a[1] += c;
+}
+
+/**
+   Compute the key powers r^1 .. r^n for the multi-lane block functions
+   @param st      The Poly1305 state
+   @param pow     [out] pow[k] receives r^(k+1), 26-bit limbs
+   @param n       The number of powers
+*/
+void xsalsa20_poly1305_powers(const xsalsa20_poly1305_state *st, ulong32 pow[][5], int n)
+{
+   int k, i;
+
+   for (i = 0; i < 5; i++) pow[0][i] = st->r[i];
+   for (k = 1; k < n; k++) {
+      for (i = 0; i < 5; i++) pow[k][i] = pow[k - 1][i];
+      s_poly1305_mul(pow[k], st->r);
+   }
+}
+
+/**
+   Initialize a Poly1305 state
+   @param st      [out] The Poly1305 state
+   @param key     The one-time key, 32 octets (r || s)
+*/
+void xsalsa20_poly1305_init(xsalsa20_poly1305_state *st, const unsigned char key[32])
+{
+   ulong32 t;
+
+   /* r &= 0xffffffc0ffffffc0ffffffc0fffffff */
+   LOAD32L(t, key +  0); st->r[0] = (t     ) & 0x3ffffff;
+   LOAD32L(t, key +  3); st->r[1] = (t >> 2) & 0x3ffff03;
+   LOAD32L(t, key +  6); st->r[2] = (t >> 4) & 0x3ffc0ff;
+   LOAD32L(t, key +  9); st->r[3] = (t >> 6) & 0x3f03fff;
+   LOAD32L(t, key + 12); st->r[4] = (t >> 8) & 0x00fffff;
+
+   st->h[0] = st->h[1] = st->h[2] = st->h[3] = st->h[4] = 0;
+
+   LOAD32L(st->pad[0], key + 16);
+   LOAD32L(st->pad[1], key + 20);
+   LOAD32L(st->pad[2], key + 24);
+   LOAD32L(st->pad[3], key + 28);
+
+   st->leftover = 0;
+   st->final = 0;
+}
+
+/**
+   Absorb message bytes into a Poly1305 state, whole blocks with a given block function
+   @param st      The Poly1305 state
+   @param in      The message
+   @param inlen   The length of the message (octets)
+   @param blocks  The block function for the whole blocks
+*/
+void xsalsa20_poly1305_update_with(xsalsa20_poly1305_state *st, const unsigned char *in, unsigned long inlen,
+                                   xsalsa20_poly1305_blocks_fn blocks)
+{
+   unsigned long i, want;
+
+   /* handle leftover */
+   if (st->leftover) {
+      want = 16 - st->leftover;
+      if (want > inlen) want = inlen;
+      for (i = 0; i < want; i++) st->buffer[st->leftover + i] = in[i];
+      inlen -= want;
+      in += want;
+      st->leftover += want;
+      if (st->leftover < 16) return;
+      xsalsa20_poly1305_blocks_scalar(st, st->buffer, 16);
+      st->leftover = 0;
+   }
+
+   /* process full blocks */
+   if (inlen >= 16) {
+      want = inlen & ~15UL;
+      blocks(st, in, want);
+      in += want;
+      inlen -= want;
+   }
+
+   /* store leftover */
+   for (i = 0; i < inlen; i++) st->buffer[st->leftover + i] = in[i];
+   st->leftover += inlen;
+}
+
+/**
+   Absorb message bytes into a Poly1305 state
+   @param st      The Poly1305 state
+   @param in      The message
+   @param inlen   The length of the message (octets)
+*/
+void xsalsa20_poly1305_update(xsalsa20_poly1305_state *st, const unsigned char *in, unsigned long inlen)
+{
+   xsalsa20_poly1305_update_with(st, in, inlen, xsalsa20_poly1305_blocks);
+}
+
+/**
+   Produce the Poly1305 tag and wipe the state
+   @param st      The Poly1305 state
+   @param mac     [out] The tag, 16 octets
+*/
+void xsalsa20_poly1305_finish(xsalsa20_poly1305_state *st, unsigned char mac[16])
+{
+   ulong32 h0, h1, h2, h3, h4, c;
+   ulong32 g0, g1, g2, g3, g4;
+   ulong64 f;
+   ulong32 mask;
+
+   /* process the remaining block */
+   if (st->leftover) {
+      unsigned long i = st->leftover;
+      st->buffer[i++] = 1;
+      for (; i < 16; i++) st->buffer[i] = 0;
+      st->final = 1;
+      xsalsa20_poly1305_blocks_scalar(st, st->buffer, 16);
+   }
+
+   /* fully carry h */
+   h0 = st->h[0]; h1 = st->h[1]; h2 = st->h[2]; h3 = st->h[3]; h4 = st->h[4];
+
+                c = h1 >> 26; h1 = h1 & 0x3ffffff;
+   h2 +=     c; c = h2 >> 26; h2 = h2 & 0x3ffffff;
+   h3 +=     c; c = h3 >> 26; h3 = h3 & 0x3ffffff;
+   h4 +=     c; c = h4 >> 26; h4 = h4 & 0x3ffffff;
+   h0 += c * 5; c = h0 >> 26; h0 = h0 & 0x3ffffff;
+   h1 +=     c;
+
+   /* compute h + -p */
+   g0 = h0 + 5; c = g0 >> 26; g0 &= 0x3ffffff;
+   g1 = h1 + c; c = g1 >> 26; g1 &= 0x3ffffff;
+   g2 = h2 + c; c = g2 >> 26; g2 &= 0x3ffffff;
+   g3 = h3 + c; c = g3 >> 26; g3 &= 0x3ffffff;
+   g4 = h4 + c - (1UL << 26);
+
+   /* select h if h < p, or h + -p if h >= p */
+   mask = (g4 >> 31) - 1;
+   g0 &= mask; g1 &= mask; g2 &= mask; g3 &= mask; g4 &= mask;
+   mask = ~mask;
+   h0 = (h0 & mask) | g0;
+   h1 = (h1 & mask) | g1;
+   h2 = (h2 & mask) | g2;
+   h3 = (h3 & mask) | g3;
+   h4 = (h4 & mask) | g4;
+
+   /* h = h % (2^128) */
+   h0 = ((h0      ) | (h1 << 26)) & 0xffffffff;
+   h1 = ((h1 >>  6) | (h2 << 20)) & 0xffffffff;
+   h2 = ((h2 >> 12) | (h3 << 14)) & 0xffffffff;
+   h3 = ((h3 >> 18) | (h4 <<  8)) & 0xffffffff;
+
+   /* mac = (h + pad) % (2^128) */
+   f = (ulong64)h0 + st->pad[0]            ; h0 = (ulong32)f;
+   f = (ulong64)h1 + st->pad[1] + (f >> 32); h1 = (ulong32)f;
+   f = (ulong64)h2 + st->pad[2] + (f >> 32); h2 = (ulong32)f;
+   f = (ulong64)h3 + st->pad[3] + (f >> 32); h3 = (ulong32)f;
+
+   STORE32L(h0, mac +  0);
+   STORE32L(h1, mac +  4);
+   STORE32L(h2, mac +  8);
+   STORE32L(h3, mac + 12);
+
+   zeromem(st, sizeof(*st));
+}
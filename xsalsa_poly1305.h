@@ -0,0 +1,38 @@
+#ifndef XSALSA_POLY1305_H
+#define XSALSA_POLY1305_H
+
+#include "xsalsa.h"
+
+/* Poly1305 one-time authenticator state (26-bit limbs) */
+typedef struct {
+    ulong32 r[5];              /* Clamped key r */
+    ulong32 h[5];              /* Accumulator */
+    ulong32 pad[4];            /* Key s, added at the end */
+    unsigned char buffer[16];  /* Partial block */
+    unsigned long leftover;    /* Number of bytes in buffer */
+    int final;                 /* Set while the padded last block is absorbed */
+} xsalsa20_poly1305_state;
+
+/**
+ * Initialize a Poly1305 state
+ * @param st   [out] The Poly1305 state
+ * @param key  The one-time key (32 bytes: r || s)
+ */
+void xsalsa20_poly1305_init(xsalsa20_poly1305_state *st, const unsigned char key[32]);
+
+/**
+ * Absorb message bytes
+ * @param st   The Poly1305 state
+ * @param in   The message bytes
+ * @param inlen  The number of bytes
+ */
+void xsalsa20_poly1305_update(xsalsa20_poly1305_state *st, const unsigned char *in, unsigned long inlen);
+
+/**
+ * Produce the tag and wipe the state
+ * @param st   The Poly1305 state
+ * @param mac  [out] The 16-byte tag
+ */
+void xsalsa20_poly1305_finish(xsalsa20_poly1305_state *st, unsigned char mac[16]);
+
+#endif /* XSALSA_POLY1305_H */
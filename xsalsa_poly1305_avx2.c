@@ -0,0 +1,124 @@
+#include "xsalsa_poly1305_impl.h"
+#include <immintrin.h>
+
+/* Four blocks run side by side, one per 64-bit lane, each limb in the low
+   32 bits of its lane so _mm256_mul_epu32 gives the 26x26-bit products.
+   Lane j of a 64-byte group holds block j, accumulated with r^4 per step;
+   the lanes are folded into h with r^4, r^3, r^2, r^1 at the end. */
+
+#define MASK26 0x3ffffff
+
+/* Internal function: h = h * r mod 2^130 - 5 on four lanes; s = 5 * r */
+static inline void s_poly1305_mul_avx2(__m256i h[5], const __m256i r[5], const __m256i s[5])
+{
+   const __m256i mask = _mm256_set1_epi64x(MASK26);
+   __m256i d0, d1, d2, d3, d4, c;
+
+   d0 = _mm256_add_epi64(_mm256_add_epi64(_mm256_mul_epu32(h[0], r[0]), _mm256_mul_epu32(h[1], s[4])),
+        _mm256_add_epi64(_mm256_add_epi64(_mm256_mul_epu32(h[2], s[3]), _mm256_mul_epu32(h[3], s[2])),
+                         _mm256_mul_epu32(h[4], s[1])));
+   d1 = _mm256_add_epi64(_mm256_add_epi64(_mm256_mul_epu32(h[0], r[1]), _mm256_mul_epu32(h[1], r[0])),
+        _mm256_add_epi64(_mm256_add_epi64(_mm256_mul_epu32(h[2], s[4]), _mm256_mul_epu32(h[3], s[3])),
+                         _mm256_mul_epu32(h[4], s[2])));
+   d2 = _mm256_add_epi64(_mm256_add_epi64(_mm256_mul_epu32(h[0], r[2]), _mm256_mul_epu32(h[1], r[1])),
+        _mm256_add_epi64(_mm256_add_epi64(_mm256_mul_epu32(h[2], r[0]), _mm256_mul_epu32(h[3], s[4])),
+                         _mm256_mul_epu32(h[4], s[3])));
+   d3 = _mm256_add_epi64(_mm256_add_epi64(_mm256_mul_epu32(h[0], r[3]), _mm256_mul_epu32(h[1], r[2])),
+        _mm256_add_epi64(_mm256_add_epi64(_mm256_mul_epu32(h[2], r[1]), _mm256_mul_epu32(h[3], r[0])),
+                         _mm256_mul_epu32(h[4], s[4])));
+   d4 = _mm256_add_epi64(_mm256_add_epi64(_mm256_mul_epu32(h[0], r[4]), _mm256_mul_epu32(h[1], r[3])),
+        _mm256_add_epi64(_mm256_add_epi64(_mm256_mul_epu32(h[2], r[2]), _mm256_mul_epu32(h[3], r[1])),
+                         _mm256_mul_epu32(h[4], r[0])));
+
+   /* (partial) h %= p */
+   c = _mm256_srli_epi64(d0, 26); h[0] = _mm256_and_si256(d0, mask);
+   d1 = _mm256_add_epi64(d1, c);
+   c = _mm256_srli_epi64(d1, 26); h[1] = _mm256_and_si256(d1, mask);
+   d2 = _mm256_add_epi64(d2, c);
+   c = _mm256_srli_epi64(d2, 26); h[2] = _mm256_and_si256(d2, mask);
+   d3 = _mm256_add_epi64(d3, c);
+   c = _mm256_srli_epi64(d3, 26); h[3] = _mm256_and_si256(d3, mask);
+   d4 = _mm256_add_epi64(d4, c);
+   c = _mm256_srli_epi64(d4, 26); h[4] = _mm256_and_si256(d4, mask);
+   h[0] = _mm256_add_epi64(h[0], _mm256_add_epi64(c, _mm256_slli_epi64(c, 2)));
+   c = _mm256_srli_epi64(h[0], 26); h[0] = _mm256_and_si256(h[0], mask);
+   h[1] = _mm256_add_epi64(h[1], c);
+}
+
+/* Internal function: split four 16-byte blocks into 26-bit limbs, one block per lane */
+static inline void s_poly1305_load_avx2(__m256i m[5], const unsigned char *in)
+{
+   const __m256i mask = _mm256_set1_epi64x(MASK26);
+   const __m256i hibit = _mm256_set1_epi64x(1 << 24);   /* 1 << 128 */
+   __m256i v0 = _mm256_loadu_si256((const __m256i*)(in +  0));   /* blocks 0, 1 */
+   __m256i v1 = _mm256_loadu_si256((const __m256i*)(in + 32));   /* blocks 2, 3 */
+   /* unpack gives lane order 0, 2, 1, 3; restore block order */
+   __m256i lo = _mm256_permute4x64_epi64(_mm256_unpacklo_epi64(v0, v1), 0xD8);
+   __m256i hi = _mm256_permute4x64_epi64(_mm256_unpackhi_epi64(v0, v1), 0xD8);
+
+   m[0] = _mm256_and_si256(lo, mask);
+   m[1] = _mm256_and_si256(_mm256_srli_epi64(lo, 26), mask);
+   m[2] = _mm256_and_si256(_mm256_or_si256(_mm256_srli_epi64(lo, 52), _mm256_slli_epi64(hi, 12)), mask);
+   m[3] = _mm256_and_si256(_mm256_srli_epi64(hi, 14), mask);
+   m[4] = _mm256_or_si256(_mm256_srli_epi64(hi, 40), hibit);
+}
+
+/**
+   Absorb whole 16-byte blocks (AVX2 version, 4 blocks per step)
+   @param st      The Poly1305 state
+   @param in      The message blocks
+   @param inlen   The length of the message, a multiple of 16 (octets)
+*/
+void xsalsa20_poly1305_blocks_avx2(xsalsa20_poly1305_state *st, const unsigned char *in, unsigned long inlen)
+{
+   ulong32 pow[4][5];
+   ulong64 t[5], c;
+   __m256i h[5], m[5], r4[5], s4[5], p[5], ps[5];
+   _Alignas(32) ulong64 lane[5][4];
+   unsigned long groups = inlen / 64;
+   int i;
+
+   /* Short runs and the padded final block do not amortise the powers */
+   if (groups < 4 || st->final) {
+      xsalsa20_poly1305_blocks_scalar(st, in, inlen);
+      return;
+   }
+
+   xsalsa20_poly1305_powers(st, pow, 4);
+   for (i = 0; i < 5; i++) {
+      r4[i] = _mm256_set1_epi64x(pow[3][i]);
+      s4[i] = _mm256_set1_epi64x(pow[3][i] * 5);
+      /* lane j finishes with r^(4-j) */
+      p[i]  = _mm256_set_epi64x(pow[0][i], pow[1][i], pow[2][i], pow[3][i]);
+      ps[i] = _mm256_set_epi64x(pow[0][i] * 5, pow[1][i] * 5, pow[2][i] * 5, pow[3][i] * 5);
+      /* the running h joins the first block of lane 0 */
+      h[i]  = _mm256_set_epi64x(0, 0, 0, st->h[i]);
+   }
+
+   for (;;) {
+      s_poly1305_load_avx2(m, in);
+      for (i = 0; i < 5; i++) h[i] = _mm256_add_epi64(h[i], m[i]);
+      in += 64;
+      inlen -= 64;
+      if (--groups == 0) break;
+      s_poly1305_mul_avx2(h, r4, s4);
+   }
+   s_poly1305_mul_avx2(h, p, ps);
+
+   /* Fold the four lanes into one accumulator */
+   for (i = 0; i < 5; i++) {
+      _mm256_store_si256((__m256i*)lane[i], h[i]);
+      t[i] = lane[i][0] + lane[i][1] + lane[i][2] + lane[i][3];
+   }
+                     c = t[0] >> 26; t[0] &= MASK26;
+   t[1] += c;        c = t[1] >> 26; t[1] &= MASK26;
+   t[2] += c;        c = t[2] >> 26; t[2] &= MASK26;
+   t[3] += c;        c = t[3] >> 26; t[3] &= MASK26;
+   t[4] += c;        c = t[4] >> 26; t[4] &= MASK26;
+   t[0] += c * 5;    c = t[0] >> 26; t[0] &= MASK26;
+   t[1] += c;
+   for (i = 0; i < 5; i++) st->h[i] = (ulong32)t[i];
+
+   /* Remaining blocks of an incomplete group */
+   if (inlen > 0) xsalsa20_poly1305_blocks_scalar(st, in, inlen);
+}
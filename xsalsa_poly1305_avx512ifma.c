@@ -0,0 +1,165 @@
+#include "xsalsa_poly1305_impl.h"
+#include <immintrin.h>
+
+/* Eight blocks run side by side, one per 64-bit lane, in radix 2^44
+   (limbs of 44, 44 and 42 bits) so vpmadd52luq/vpmadd52huq form the
+   products directly. Lane j of a 128-byte group holds block j,
+   accumulated with r^8 per step; the lanes are folded into h with
+   r^8 .. r^1 at the end. */
+
+#define MASK26 0x3ffffffULL
+#define MASK42 0x3ffffffffffULL
+#define MASK44 0xfffffffffffULL
+
+/* Internal function: h = h * r mod 2^130 - 5 on eight lanes; s = 20 * r
+   (2^132 = 20 mod p) */
+static inline void s_poly1305_mul_ifma(__m512i h[3], const __m512i r[3], const __m512i s[3])
+{
+   const __m512i zero = _mm512_setzero_si512();
+   const __m512i mask44 = _mm512_set1_epi64(MASK44);
+   const __m512i mask42 = _mm512_set1_epi64(MASK42);
+   __m512i l0, l1, l2, u0, u1, u2, c;
+
+   /* low and high 52-bit halves of every limb product */
+   l0 = _mm512_madd52lo_epu64(zero, h[0], r[0]);
+   u0 = _mm512_madd52hi_epu64(zero, h[0], r[0]);
+   l0 = _mm512_madd52lo_epu64(l0, h[1], s[2]);
+   u0 = _mm512_madd52hi_epu64(u0, h[1], s[2]);
+   l0 = _mm512_madd52lo_epu64(l0, h[2], s[1]);
+   u0 = _mm512_madd52hi_epu64(u0, h[2], s[1]);
+
+   l1 = _mm512_madd52lo_epu64(zero, h[0], r[1]);
+   u1 = _mm512_madd52hi_epu64(zero, h[0], r[1]);
+   l1 = _mm512_madd52lo_epu64(l1, h[1], r[0]);
+   u1 = _mm512_madd52hi_epu64(u1, h[1], r[0]);
+   l1 = _mm512_madd52lo_epu64(l1, h[2], s[2]);
+   u1 = _mm512_madd52hi_epu64(u1, h[2], s[2]);
+
+   l2 = _mm512_madd52lo_epu64(zero, h[0], r[2]);
+   u2 = _mm512_madd52hi_epu64(zero, h[0], r[2]);
+   l2 = _mm512_madd52lo_epu64(l2, h[1], r[1]);
+   u2 = _mm512_madd52hi_epu64(u2, h[1], r[1]);
+   l2 = _mm512_madd52lo_epu64(l2, h[2], r[0]);
+   u2 = _mm512_madd52hi_epu64(u2, h[2], r[0]);
+
+   /* a high half sits 52 = 44 + 8 bits up: it belongs to the next limb,
+      shifted by 8; the top one wraps to limb 0 times 20 << 8 */
+   l1 = _mm512_add_epi64(l1, _mm512_slli_epi64(u0, 8));
+   l2 = _mm512_add_epi64(l2, _mm512_slli_epi64(u1, 8));
+   l0 = _mm512_add_epi64(l0, _mm512_add_epi64(_mm512_slli_epi64(u2, 12), _mm512_slli_epi64(u2, 10)));
+
+   /* (partial) h %= p */
+   c = _mm512_srli_epi64(l0, 44); h[0] = _mm512_and_si512(l0, mask44);
+   l1 = _mm512_add_epi64(l1, c);
+   c = _mm512_srli_epi64(l1, 44); h[1] = _mm512_and_si512(l1, mask44);
+   l2 = _mm512_add_epi64(l2, c);
+   c = _mm512_srli_epi64(l2, 42); h[2] = _mm512_and_si512(l2, mask42);
+   h[0] = _mm512_add_epi64(h[0], _mm512_add_epi64(c, _mm512_slli_epi64(c, 2)));
+   c = _mm512_srli_epi64(h[0], 44); h[0] = _mm512_and_si512(h[0], mask44);
+   h[1] = _mm512_add_epi64(h[1], c);
+}
+
+/* Internal function: split eight 16-byte blocks into 44-bit limbs, one block per lane */
+static inline void s_poly1305_load_ifma(__m512i m[3], const unsigned char *in)
+{
+   const __m512i mask44 = _mm512_set1_epi64(MASK44);
+   const __m512i hibit = _mm512_set1_epi64(1ULL << 40);   /* 1 << 128 */
+   const __m512i even = _mm512_set_epi64(14, 12, 10, 8, 6, 4, 2, 0);
+   const __m512i odd  = _mm512_set_epi64(15, 13, 11, 9, 7, 5, 3, 1);
+   __m512i v0 = _mm512_loadu_si512((const void*)(in +  0));   /* blocks 0..3 */
+   __m512i v1 = _mm512_loadu_si512((const void*)(in + 64));   /* blocks 4..7 */
+   __m512i lo = _mm512_permutex2var_epi64(v0, even, v1);
+   __m512i hi = _mm512_permutex2var_epi64(v0, odd, v1);
+
+   m[0] = _mm512_and_si512(lo, mask44);
+   m[1] = _mm512_and_si512(_mm512_or_si512(_mm512_srli_epi64(lo, 44), _mm512_slli_epi64(hi, 20)), mask44);
+   m[2] = _mm512_or_si512(_mm512_srli_epi64(hi, 24), hibit);
+}
+
+/* Internal function: 26-bit limbs to radix 2^44 */
+static void s_poly1305_to44(ulong64 out[3], const ulong32 in[5])
+{
+   ulong32 h0 = in[0], h1 = in[1], h2 = in[2], h3 = in[3], h4 = in[4], c;
+   ulong64 t;
+
+   /* bring every limb under 26 bits first */
+                c = h0 >> 26; h0 &= MASK26;
+   h1 +=     c; c = h1 >> 26; h1 &= MASK26;
+   h2 +=     c; c = h2 >> 26; h2 &= MASK26;
+   h3 +=     c; c = h3 >> 26; h3 &= MASK26;
+   h4 +=     c; c = h4 >> 26; h4 &= MASK26;
+   h0 += c * 5; c = h0 >> 26; h0 &= MASK26;
+   h1 +=     c;
+
+   /* h1 may be exactly 2^26 here: add the limbs in place, so that bit carries */
+   t  = (ulong64)h0 + ((ulong64)h1 << 26);
+   out[0] = t & MASK44;
+   t  = (t >> 44) + ((ulong64)h2 << 8) + ((ulong64)h3 << 34);
+   out[1] = t & MASK44;
+   out[2] = (t >> 44) + ((ulong64)h4 << 16);
+}
+
+/**
+   Absorb whole 16-byte blocks (AVX-512 IFMA version, 8 blocks per step)
+   @param st      The Poly1305 state
+   @param in      The message blocks
+   @param inlen   The length of the message, a multiple of 16 (octets)
+*/
+void xsalsa20_poly1305_blocks_avx512ifma(xsalsa20_poly1305_state *st, const unsigned char *in, unsigned long inlen)
+{
+   ulong32 pow[8][5];
+   ulong64 p44[8][3], h44[3], t0, t1, t2, c;
+   __m512i h[3], m[3], r8[3], s8[3], p[3], ps[3];
+   unsigned long groups = inlen / 128;
+   int i, j;
+
+   /* Short runs and the padded final block do not amortise the powers */
+   if (groups < 4 || st->final) {
+      xsalsa20_poly1305_blocks_scalar(st, in, inlen);
+      return;
+   }
+
+   xsalsa20_poly1305_powers(st, pow, 8);
+   for (j = 0; j < 8; j++) s_poly1305_to44(p44[j], pow[j]);
+   s_poly1305_to44(h44, st->h);
+   for (i = 0; i < 3; i++) {
+      r8[i] = _mm512_set1_epi64((long long)p44[7][i]);
+      s8[i] = _mm512_set1_epi64((long long)(p44[7][i] * 20));
+      /* lane j finishes with r^(8-j) */
+      p[i]  = _mm512_set_epi64((long long)p44[0][i], (long long)p44[1][i], (long long)p44[2][i], (long long)p44[3][i],
+                               (long long)p44[4][i], (long long)p44[5][i], (long long)p44[6][i], (long long)p44[7][i]);
+      ps[i] = _mm512_add_epi64(_mm512_slli_epi64(p[i], 4), _mm512_slli_epi64(p[i], 2));
+      /* the running h joins the first block of lane 0 */
+      h[i]  = _mm512_maskz_set1_epi64(1, (long long)h44[i]);
+   }
+
+   for (;;) {
+      s_poly1305_load_ifma(m, in);
+      for (i = 0; i < 3; i++) h[i] = _mm512_add_epi64(h[i], m[i]);
+      in += 128;
+      inlen -= 128;
+      if (--groups == 0) break;
+      s_poly1305_mul_ifma(h, r8, s8);
+   }
+   s_poly1305_mul_ifma(h, p, ps);
+
+   /* Fold the eight lanes into one accumulator and return to 26-bit limbs */
+   t0 = (ulong64)_mm512_reduce_add_epi64(h[0]);
+   t1 = (ulong64)_mm512_reduce_add_epi64(h[1]);
+   t2 = (ulong64)_mm512_reduce_add_epi64(h[2]);
+                    c = t0 >> 44; t0 &= MASK44;
+   t1 += c;         c = t1 >> 44; t1 &= MASK44;
+   t2 += c;         c = t2 >> 42; t2 &= MASK42;
+   t0 += c * 5;     c = t0 >> 44; t0 &= MASK44;
+   t1 += c;         c = t1 >> 44; t1 &= MASK44;   /* t1 may have reached 2^44 */
+   t2 += c;
+
+   st->h[0] = (ulong32)(t0 & MASK26);
+   st->h[1] = (ulong32)(((t0 >> 26) | (t1 << 18)) & MASK26);
+   st->h[2] = (ulong32)((t1 >> 8) & MASK26);
+   st->h[3] = (ulong32)(((t1 >> 34) | (t2 << 10)) & MASK26);
+   st->h[4] = (ulong32)(t2 >> 16);
+
+   /* Remaining blocks of an incomplete group */
+   if (inlen > 0) xsalsa20_poly1305_blocks_scalar(st, in, inlen);
+}
@@ -0,0 +1,59 @@
+#ifndef XSALSA_POLY1305_IMPL_H
+#define XSALSA_POLY1305_IMPL_H
+
+#include "xsalsa.h"
+#include "xsalsa_poly1305.h"
+
+/* Poly1305 internals shared by the runtime, the tier headers and the block functions */
+
+/* Absorb inlen bytes (a multiple of 16) of whole blocks */
+typedef void (*xsalsa20_poly1305_blocks_fn)(xsalsa20_poly1305_state *st,
+                                            const unsigned char *in, unsigned long inlen);
+
+/**
+ * Absorb whole blocks with the block function of the selected implementation
+ * @param st   The Poly1305 state
+ * @param in   The message blocks
+ * @param inlen  The number of bytes (a multiple of 16)
+ */
+void xsalsa20_poly1305_blocks(xsalsa20_poly1305_state *st, const unsigned char *in, unsigned long inlen);
+
+/**
+ * Get the block function of the tier xsalsa20_crypt runs on for a call of len
+ * bytes on a context (its pinned table and size class), so a MAC over that
+ * call's data uses the same instruction tier as the cipher
+ * @param st   The XSalsa20 state
+ * @param len  The length of the crypt call
+ * @return The Poly1305 block function
+ */
+xsalsa20_poly1305_blocks_fn xsalsa20_poly1305_blocks_for(const xsalsa20_state *st, unsigned long len);
+
+/**
+ * Absorb message bytes, whole blocks with the given block function
+ * @param st   The Poly1305 state
+ * @param in   The message bytes
+ * @param inlen  The number of bytes
+ * @param blocks The block function, e.g. from xsalsa20_poly1305_blocks_for
+ */
+void xsalsa20_poly1305_update_with(xsalsa20_poly1305_state *st, const unsigned char *in, unsigned long inlen,
+                                   xsalsa20_poly1305_blocks_fn blocks);
+
+/* Block functions of the individual implementations */
+void xsalsa20_poly1305_blocks_scalar(xsalsa20_poly1305_state *st, const unsigned char *in, unsigned long inlen);
+#ifdef XSALSA_USE_IMPL_AVX2
+void xsalsa20_poly1305_blocks_avx2(xsalsa20_poly1305_state *st, const unsigned char *in, unsigned long inlen);
+#endif
+#ifdef XSALSA_USE_IMPL_AVX512
+void xsalsa20_poly1305_blocks_avx512ifma(xsalsa20_poly1305_state *st, const unsigned char *in, unsigned long inlen);
+#endif
+
+/**
+ * Compute the key powers r^1 .. r^n (26-bit limbs), as
+ * needed by the multi-lane block functions
+ * @param st   The Poly1305 state
+ * @param pow  [out] pow[k] holds r^(k+1)
+ * @param n    The number of powers
+ */
+void xsalsa20_poly1305_powers(const xsalsa20_poly1305_state *st, ulong32 pow[][5], int n);
+
+#endif /* XSALSA_POLY1305_IMPL_H */
@@ -0,0 +1,83 @@
+#ifndef XSALSA_ROUNDS_H
+#define XSALSA_ROUNDS_H
+
+#include "xsalsa.h"
+
+/* Round-count specialisation. Each tier writes its block functions and its
+   crypt/keystream bodies once, with rounds as a parameter, and force-inlines
+   them into entry points for 8, 12 and 20 rounds (xsalsa20_crypt_<tier>_r20
+   etc.). There the round count is a constant, so XSALSA_ROUNDS unrolls the
+   double rounds completely and no loop branch is left. xsalsa20_setup pins the
+   entry points matching the context's round count; the plain entry points keep
+   the loop for any other count. */
+
+#if defined(_MSC_VER)
+#define XSALSA_INLINE __forceinline
+#else
+#define XSALSA_INLINE inline __attribute__((always_inline))
+#endif
+
+/* Whether rounds is known at compile time. Without __builtin_constant_p the
+   unrolled paths are always emitted and folded wherever rounds is constant. */
+#if defined(__GNUC__) || defined(__clang__)
+#define XSALSA_CONSTANT_P(x) __builtin_constant_p(x)
+#else
+#define XSALSA_CONSTANT_P(x) 1
+#endif
+
+#define XSALSA_REPEAT2(...) { __VA_ARGS__ } { __VA_ARGS__ }
+#define XSALSA_REPEAT4(...) XSALSA_REPEAT2(__VA_ARGS__) XSALSA_REPEAT2(__VA_ARGS__)
+
+/* Run the double round given as the body rounds/2 times, unrolled for 8, 12 and 20 */
+#define XSALSA_ROUNDS(rounds, ...) do { \
+      int r_; \
+      if (XSALSA_CONSTANT_P(rounds) && (rounds) == 8) { \
+         XSALSA_REPEAT4(__VA_ARGS__) \
+      } else if (XSALSA_CONSTANT_P(rounds) && (rounds) == 12) { \
+         XSALSA_REPEAT4(__VA_ARGS__) XSALSA_REPEAT2(__VA_ARGS__) \
+      } else if (XSALSA_CONSTANT_P(rounds) && (rounds) == 20) { \
+         XSALSA_REPEAT4(__VA_ARGS__) XSALSA_REPEAT4(__VA_ARGS__) XSALSA_REPEAT2(__VA_ARGS__) \
+      } else { \
+         for (r_ = (rounds); r_ > 0; r_ -= 2) { __VA_ARGS__ } \
+      } \
+   } while (0)
+
+/* Index of a specialised round count in the tables of xsalsa_runtime.c, or -1 */
+#define XSALSA_ROUNDS_VARIANTS 3
+#define XSALSA_ROUNDS_INDEX(rounds) ((rounds) == 8 ? 0 : (rounds) == 12 ? 1 : (rounds) == 20 ? 2 : -1)
+
+/* Entry points of a tier around s_xsalsa20_crypt_<tier>: the generic one, and one
+   per specialised round count that falls back to it for any other context */
+#define XSALSA_CRYPT_ROUNDS(tier, r) \
+   int xsalsa20_crypt_##tier##_r##r(xsalsa20_state *st, const unsigned char *in, unsigned long inlen, unsigned char *out) \
+   { \
+      if (st == NULL || st->rounds != (r)) return xsalsa20_crypt_##tier(st, in, inlen, out); \
+      return s_xsalsa20_crypt_##tier(st, in, inlen, out, (r)); \
+   }
+
+#define XSALSA_CRYPT_ENTRIES(tier) \
+   int xsalsa20_crypt_##tier(xsalsa20_state *st, const unsigned char *in, unsigned long inlen, unsigned char *out) \
+   { \
+      return s_xsalsa20_crypt_##tier(st, in, inlen, out, st != NULL ? st->rounds : 0); \
+   } \
+   XSALSA_CRYPT_ROUNDS(tier, 8) \
+   XSALSA_CRYPT_ROUNDS(tier, 12) \
+   XSALSA_CRYPT_ROUNDS(tier, 20)
+
+#define XSALSA_KEYSTREAM_ROUNDS(tier, r) \
+   int xsalsa20_keystream_##tier##_r##r(xsalsa20_state *st, unsigned char *out, unsigned long outlen) \
+   { \
+      if (st == NULL || st->rounds != (r)) return xsalsa20_keystream_##tier(st, out, outlen); \
+      return s_xsalsa20_keystream_##tier(st, out, outlen, (r)); \
+   }
+
+#define XSALSA_KEYSTREAM_ENTRIES(tier) \
+   int xsalsa20_keystream_##tier(xsalsa20_state *st, unsigned char *out, unsigned long outlen) \
+   { \
+      return s_xsalsa20_keystream_##tier(st, out, outlen, st != NULL ? st->rounds : 0); \
+   } \
+   XSALSA_KEYSTREAM_ROUNDS(tier, 8) \
+   XSALSA_KEYSTREAM_ROUNDS(tier, 12) \
+   XSALSA_KEYSTREAM_ROUNDS(tier, 20)
+
+#endif /* XSALSA_ROUNDS_H */
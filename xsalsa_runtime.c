@@ -1,51 +1,442 @@
+#ifdef __linux__
+#define _GNU_SOURCE  /* secure_getenv */
+#endif
 #include "xsalsa.h"
+#include "xsalsa_poly1305_impl.h"
 #include "xsalsa_scalar.h"
 #include "xsalsa_avx.h"
 #include "xsalsa_avx2.h"
 #include "xsalsa_avx512.h"
+#include "xsalsa_avx512vl.h"
 #include "xsalsa_impl_check.h"
+#include "xsalsa_stats.h"
+#include "xsalsa_rounds.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <time.h>
 
-/* Function pointers for runtime dispatch */
-static xsalsa20_setup_fn xsalsa20_setup_impl = NULL;
-static xsalsa20_crypt_fn xsalsa20_crypt_impl = NULL;
-static xsalsa20_keystream_fn xsalsa20_keystream_impl = NULL;
-static xsalsa20_memory_fn xsalsa20_memory_impl = NULL;
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
 
+#ifdef XSALSA_ENABLE_USDT
+#include <sys/sdt.h>
+#endif
 
-/* Initialize function pointers based on CPU capabilities */
-static inline void init_impl(void)
+#define XSALSA_ARGCHK(x) do { if (!(x)) return XSALSA_INVALID_ARG; } while(0)
+
+/* USDT probes (CMake option ENABLE_USDT), provider "xsalsa20"; without it they expand to nothing */
+#ifdef XSALSA_ENABLE_USDT
+#define XSALSA_PROBE3(name, a, b, c)          DTRACE_PROBE3(xsalsa20, name, a, b, c)
+#define XSALSA_PROBE4(name, a, b, c, d)       DTRACE_PROBE4(xsalsa20, name, a, b, c, d)
+#define XSALSA_PROBE5(name, a, b, c, d, e)    DTRACE_PROBE5(xsalsa20, name, a, b, c, d, e)
+#else
+#define XSALSA_PROBE3(name, a, b, c)          do { } while (0)
+#define XSALSA_PROBE4(name, a, b, c, d)       do { } while (0)
+#define XSALSA_PROBE5(name, a, b, c, d, e)    do { } while (0)
+#endif
+
+/* Internal function: Zero memory */
+static void zeromem(volatile void *out, size_t outlen)
+{
+   volatile unsigned char *x = (volatile unsigned char *)out;
+   while (outlen--) *x++ = 0;
+}
+
+/* Number of call-size classes the adaptive policy picks a kernel for */
+#define XSALSA_SIZE_CLASSES 4
+
+/* Resolved implementation: one function table per tier */
+struct xsalsa20_impl {
+    xsalsa20_setup_fn setup;
+    xsalsa20_setup_batch_fn setup_batch;
+    xsalsa20_crypt_fn crypt;
+    xsalsa20_crypt_multi_fn crypt_multi;
+    xsalsa20_crypt_batch_fn crypt_batch;
+    xsalsa20_keystream_fn keystream;
+    xsalsa20_memory_fn memory;
+    xsalsa20_poly1305_blocks_fn poly1305_blocks;
+    int id;                                         /* Tier the functions above come from */
+    xsalsa20_crypt_fn crypt_class[XSALSA_SIZE_CLASSES];   /* crypt, by size class of inlen */
+    xsalsa20_memory_fn memory_class[XSALSA_SIZE_CLASSES]; /* memory, by size class of datalen */
+    int class_id[XSALSA_SIZE_CLASSES];              /* Tier used for each size class */
+    xsalsa20_crypt_fn crypt_rounds[XSALSA_ROUNDS_VARIANTS];         /* crypt for 8, 12, 20 rounds */
+    xsalsa20_keystream_fn keystream_rounds[XSALSA_ROUNDS_VARIANTS]; /* keystream for 8, 12, 20 rounds */
+    const struct xsalsa20_impl *by_rounds[XSALSA_ROUNDS_VARIANTS];  /* Same table with those kernels (NULL in it) */
+};
+
+/* Filled once at load time and never written again, so contexts can keep
+   pointers into it while other threads force or reset the implementation */
+static struct xsalsa20_impl impl_table[XSALSA_IMPL_AVX512VL + 1];
+static struct xsalsa20_impl impl_table_rounds[XSALSA_IMPL_AVX512VL + 1][XSALSA_ROUNDS_VARIANTS];
+
+/* Size-adaptive tables (XSALSA_POLICY_ADAPTIVE), indexed by the NO_ZMM policy bit.
+   Each is calibrated once, on first use, and never written again afterwards. */
+static struct xsalsa20_impl impl_adaptive[2];
+static struct xsalsa20_impl impl_adaptive_rounds[2][XSALSA_ROUNDS_VARIANTS];
+static int adaptive_ready[2];
+static int adaptive_pending = 0;  /* Adaptive policy active but not calibrated yet */
+
+/* Table used by xsalsa20_setup and by calls that take no context */
+static const struct xsalsa20_impl *impl_current = &impl_table[XSALSA_IMPL_SCALAR];
+
+/* The flags and impl_current are read without calibration_lock: a release store
+   publishes a table only after its contents, an acquire load sees them complete */
+#if defined(_MSC_VER) && !defined(__clang__)
+#define load_acquire(p)     InterlockedCompareExchange((volatile LONG *)(p), 0, 0)
+#define store_release(p, v) InterlockedExchange((volatile LONG *)(p), (v))
+#define impl_load(p)        ((const struct xsalsa20_impl *)InterlockedCompareExchangePointer((PVOID volatile *)(p), NULL, NULL))
+#define impl_store(p, v)    InterlockedExchangePointer((PVOID volatile *)(p), (PVOID)(v))
+#else
+#define load_acquire(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define impl_load(p)        __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define impl_store(p, v)    __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#endif
+
+/* Representative call length of each size class, and bytes timed per measurement */
+static const unsigned long class_len[XSALSA_SIZE_CLASSES] = { 40, 256, 2048, 16384 };
+#define CALIBRATION_BYTES (32UL * 1024)
+#define CALIBRATION_REPS 3
+
+/* A candidate must beat the throughput tier by this many percent to replace it */
+#define CALIBRATION_MARGIN 5
+
+/* Cache file for calibration results (optional) */
+#define CALIBRATION_ENV "XSALSA20_CALIBRATION_FILE"
+#define CALIBRATION_VERSION 1
+
+#ifdef _WIN32
+static SRWLOCK calibration_lock = SRWLOCK_INIT;
+#define calibration_acquire() AcquireSRWLockExclusive(&calibration_lock)
+#define calibration_release() ReleaseSRWLockExclusive(&calibration_lock)
+#else
+static pthread_mutex_t calibration_lock = PTHREAD_MUTEX_INITIALIZER;
+#define calibration_acquire() pthread_mutex_lock(&calibration_lock)
+#define calibration_release() pthread_mutex_unlock(&calibration_lock)
+#endif
+
+#define IMPL_INIT(tier, t) \
+    xsalsa20_##tier##_init(&(t)->setup, &(t)->setup_batch, &(t)->crypt, &(t)->crypt_multi, \
+                           &(t)->crypt_batch, &(t)->keystream, &(t)->memory, &(t)->poly1305_blocks, \
+                           (t)->crypt_rounds, (t)->keystream_rounds)
+
+/* Fill the round-specialised copies of a table: every kernel it points to,
+   per size class too, is replaced by that tier's kernel for the round count */
+static void derive_rounds(struct xsalsa20_impl *t, struct xsalsa20_impl variant[XSALSA_ROUNDS_VARIANTS])
 {
-    if (xsalsa20_setup_impl != NULL) {
-        return; /* Already initialized */
+    int r, c;
+
+    for (r = 0; r < XSALSA_ROUNDS_VARIANTS; r++) {
+        variant[r] = *t;
+        variant[r].crypt = impl_table[t->id].crypt_rounds[r];
+        variant[r].keystream = impl_table[t->id].keystream_rounds[r];
+        for (c = 0; c < XSALSA_SIZE_CLASSES; c++) {
+            variant[r].crypt_class[c] = impl_table[t->class_id[c]].crypt_rounds[r];
+        }
+        for (c = 0; c < XSALSA_ROUNDS_VARIANTS; c++) variant[r].by_rounds[c] = NULL;
+        t->by_rounds[r] = &variant[r];
     }
-    
+}
+
+/* Table to pin into a context with the given round count */
+static inline const struct xsalsa20_impl *impl_for_rounds(const struct xsalsa20_impl *impl, int rounds)
+{
+    int r = XSALSA_ROUNDS_INDEX(rounds);
+    return (r >= 0 && impl->by_rounds[r] != NULL) ? impl->by_rounds[r] : impl;
+}
+
+/* Fill the per-tier tables and select the best one for this CPU */
+static void init_impl(void)
+{
+    int i, c;
+
+    IMPL_INIT(scalar, &impl_table[XSALSA_IMPL_SCALAR]);
+    IMPL_INIT(avx, &impl_table[XSALSA_IMPL_AVX]);
+    IMPL_INIT(avx2, &impl_table[XSALSA_IMPL_AVX2]);
+    IMPL_INIT(avx512, &impl_table[XSALSA_IMPL_AVX512]);
+    IMPL_INIT(avx512vl, &impl_table[XSALSA_IMPL_AVX512VL]);
+
+    /* A plain tier uses its own kernel for every size */
+    for (i = XSALSA_IMPL_SCALAR; i <= XSALSA_IMPL_AVX512VL; i++) {
+        impl_table[i].id = i;
+        for (c = 0; c < XSALSA_SIZE_CLASSES; c++) {
+            impl_table[i].crypt_class[c] = impl_table[i].crypt;
+            impl_table[i].memory_class[c] = impl_table[i].memory;
+            impl_table[i].class_id[c] = i;
+        }
+        if (impl_table[i].crypt != NULL) derive_rounds(&impl_table[i], impl_table_rounds[i]);
+    }
+    xsalsa20_reset_impl();
+}
+
+/* Run init_impl before main (or DllMain), so no hot call has to check for it */
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((constructor)) static void xsalsa20_runtime_init(void)
+{
+    init_impl();
+}
+#elif defined(_MSC_VER)
+static void __cdecl xsalsa20_runtime_init(void)
+{
+    init_impl();
+}
+#pragma section(".CRT$XCU", read)
+__declspec(allocate(".CRT$XCU")) static void (__cdecl *xsalsa20_runtime_init_ptr)(void) = xsalsa20_runtime_init;
+#else
+#error "xsalsa_runtime.c needs load-time initialisation (GCC/Clang constructor or MSVC .CRT$XCU)"
+#endif
+
+/* Table a context was set up with, or the current one for contexts from a tier's own setup */
+#define STATE_IMPL(st) (((st) != NULL && (st)->impl != NULL) ? (st)->impl : impl_load(&impl_current))
+
+/* Size class of a call: <64, <512, <4K, bulk */
+static inline int size_class(unsigned long len)
+{
+    return len < 64 ? 0 : len < 512 ? 1 : len < 4096 ? 2 : 3;
+}
+
+/* Tier selected by the policy, or scalar when that tier is not compiled in */
+static int best_tier(void)
+{
     int best_impl = xsalsa20_get_best_impl();
-    
-    switch (best_impl) {
-        case XSALSA_IMPL_AVX512:
-            xsalsa20_avx512_init(&xsalsa20_setup_impl, &xsalsa20_crypt_impl, &xsalsa20_keystream_impl, &xsalsa20_memory_impl);
-            break;
-        case XSALSA_IMPL_AVX2:
-            xsalsa20_avx2_init(&xsalsa20_setup_impl, &xsalsa20_crypt_impl, &xsalsa20_keystream_impl, &xsalsa20_memory_impl);
-            break;
+
+    if (best_impl < XSALSA_IMPL_SCALAR || best_impl > XSALSA_IMPL_AVX512VL ||
+        impl_table[best_impl].crypt == NULL) {
+        best_impl = XSALSA_IMPL_SCALAR;
+    }
+    return best_impl;
+}
+
+/* Whether a tier is compiled in, runs on this CPU and is allowed by the policy */
+static bool tier_usable(int impl, int no_zmm)
+{
+    if (impl < XSALSA_IMPL_SCALAR || impl > XSALSA_IMPL_AVX512VL || impl_table[impl].crypt == NULL) {
+        return false;
+    }
+    switch (impl) {
         case XSALSA_IMPL_AVX:
-            xsalsa20_avx_init(&xsalsa20_setup_impl, &xsalsa20_crypt_impl, &xsalsa20_keystream_impl, &xsalsa20_memory_impl);
-            break;
+            return check_avx_support();
+        case XSALSA_IMPL_AVX2:
+            return check_avx2_support();
+        case XSALSA_IMPL_AVX512:
+            return !no_zmm && check_avx512_support();
+        case XSALSA_IMPL_AVX512VL:
+            return check_avx512vl_support();
         default:
-            xsalsa20_scalar_init(&xsalsa20_setup_impl, &xsalsa20_crypt_impl, &xsalsa20_keystream_impl, &xsalsa20_memory_impl);
-            break;
+            return true;
+    }
+}
+
+static ulong64 now_ns(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (ulong64)((double)count.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ulong64)ts.tv_sec * 1000000000u + (ulong64)ts.tv_nsec;
+#endif
+}
+
+/* Fastest time for one tier to crypt CALIBRATION_BYTES in calls of len bytes */
+static ulong64 time_tier(int impl, unsigned long len, unsigned char *buf)
+{
+    static const unsigned char key[32] = { 0 };
+    static const unsigned char nonce[24] = { 0 };
+    unsigned long i, calls = CALIBRATION_BYTES / len;
+    ulong64 t, best = ~(ulong64)0;
+    xsalsa20_state st;
+    int rep;
+
+    if (impl_table[impl].setup(&st, key, 32, nonce, 24, 20) != XSALSA_OK) return best;
+
+    /* The first round only warms up caches and the vector units */
+    for (rep = 0; rep <= CALIBRATION_REPS; rep++) {
+        t = now_ns();
+        for (i = 0; i < calls; i++) {
+            impl_table[impl].crypt(&st, buf, len, buf);
+        }
+        t = now_ns() - t;
+        if (rep > 0 && t < best) best = t;
     }
+    zeromem(&st, sizeof(st));
+    return best;
+}
+
+/* Time every usable tier on each size class; the throughput tier wins ties */
+static void calibrate_measure(int no_zmm, int base, int choice[XSALSA_SIZE_CLASSES])
+{
+    static unsigned char buf[16384];  /* guarded by calibration_lock */
+    ulong64 t, best;
+    int c, i;
+#ifdef XSALSA_ENABLE_STATS
+    xsalsa20_stats saved;
+
+    /* Calibration calls are not the caller's traffic: keep them out of the counters */
+    xsalsa20_stats_copy(&saved, &xsalsa20_stats_local.s);
+#endif
+
+    for (c = 0; c < XSALSA_SIZE_CLASSES; c++) {
+        choice[c] = base;
+        best = time_tier(base, class_len[c], buf);
+        for (i = XSALSA_IMPL_SCALAR; i <= XSALSA_IMPL_AVX512VL; i++) {
+            if (i == base || !tier_usable(i, no_zmm)) continue;
+            t = time_tier(i, class_len[c], buf);
+            if (t * (100 + CALIBRATION_MARGIN) < best * 100) {
+                best = t;
+                choice[c] = i;
+            }
+        }
+    }
+#ifdef XSALSA_ENABLE_STATS
+    xsalsa20_stats_copy(&xsalsa20_stats_local.s, &saved);
+#endif
+}
+
+/* The cache file named by CALIBRATION_ENV. A setuid/setgid (or otherwise
+   privileged) process ignores it: its environment belongs to the invoker */
+static const char *calibration_path(void)
+{
+#if defined(_WIN32)
+    return getenv(CALIBRATION_ENV);
+#elif defined(__GLIBC__)
+    return secure_getenv(CALIBRATION_ENV);
+#else
+    if (getuid() != geteuid() || getgid() != getegid()) return NULL;
+    return getenv(CALIBRATION_ENV);
+#endif
+}
+
+/* Read a choice from the cache file; fails if it is missing, stale or names a tier this host cannot run */
+static bool calibrate_load(int no_zmm, int choice[XSALSA_SIZE_CLASSES])
+{
+    const char *path = calibration_path();
+    int version, zmm, c;
+    bool ok;
+    FILE *f;
+
+    if (path == NULL || (f = fopen(path, "r")) == NULL) return false;
+    ok = fscanf(f, "xsalsa20-calibration %d %d %d %d %d %d", &version, &zmm,
+                &choice[0], &choice[1], &choice[2], &choice[3]) == 2 + XSALSA_SIZE_CLASSES;
+    fclose(f);
+
+    ok = ok && version == CALIBRATION_VERSION && zmm == no_zmm;
+    for (c = 0; ok && c < XSALSA_SIZE_CLASSES; c++) {
+        ok = tier_usable(choice[c], no_zmm);
+    }
+    return ok;
+}
+
+/* Best effort: a read-only or missing directory just means calibrating again next time.
+   The result is written to a new temporary file that is then renamed over the cache,
+   so a concurrent reader sees the old file or the new one, never a partial write */
+static void calibrate_save(int no_zmm, const int choice[XSALSA_SIZE_CLASSES])
+{
+    const char *path = calibration_path();
+    FILE *f = NULL;
+    char *tmp;
+    bool ok;
+#ifndef _WIN32
+    int fd;
+#endif
+
+    if (path == NULL || (tmp = malloc(strlen(path) + 32)) == NULL) return;
+#ifdef _WIN32
+    sprintf(tmp, "%s.%lu.tmp", path, (unsigned long)GetCurrentProcessId());
+    f = fopen(tmp, "w");
+#else
+    sprintf(tmp, "%s.XXXXXX", path);
+    if ((fd = mkstemp(tmp)) >= 0 && (f = fdopen(fd, "w")) == NULL) {
+        close(fd);
+        remove(tmp);
+    }
+#endif
+    if (f != NULL) {
+        ok = fprintf(f, "xsalsa20-calibration %d %d %d %d %d %d\n", CALIBRATION_VERSION, no_zmm,
+                     choice[0], choice[1], choice[2], choice[3]) > 0;
+        ok = fclose(f) == 0 && ok;
+#ifdef _WIN32
+        ok = ok && MoveFileExA(tmp, path, MOVEFILE_REPLACE_EXISTING);
+#else
+        ok = ok && rename(tmp, path) == 0;
+#endif
+        if (!ok) remove(tmp);
+    }
+    free(tmp);
+}
+
+/* Build the adaptive table for the current policy, then publish it */
+static void calibrate(void)
+{
+    int no_zmm = (xsalsa20_get_impl_policy() & XSALSA_POLICY_NO_ZMM) ? 1 : 0;
+    int choice[XSALSA_SIZE_CLASSES];
+    struct xsalsa20_impl *t;
+    int base, c;
+
+    calibration_acquire();
+    if (!load_acquire(&adaptive_ready[no_zmm])) {
+        t = &impl_adaptive[no_zmm];
+        base = best_tier();
+        if (!calibrate_load(no_zmm, choice)) {
+            calibrate_measure(no_zmm, base, choice);
+            calibrate_save(no_zmm, choice);
+        }
+        XSALSA_PROBE5(calibrate, no_zmm, choice[0], choice[1], choice[2], choice[3]);
+        *t = impl_table[base];
+        for (c = 0; c < XSALSA_SIZE_CLASSES; c++) {
+            t->crypt_class[c] = impl_table[choice[c]].crypt;
+            t->memory_class[c] = impl_table[choice[c]].memory;
+            t->class_id[c] = choice[c];
+        }
+        derive_rounds(t, impl_adaptive_rounds[no_zmm]);
+        store_release(&adaptive_ready[no_zmm], 1);
+    }
+    calibration_release();
+    xsalsa20_reset_impl();
+}
+
+/* Table for new contexts and context-free calls, calibrating first if needed */
+static inline const struct xsalsa20_impl *current_impl(void)
+{
+    if (load_acquire(&adaptive_pending)) calibrate();
+    return impl_load(&impl_current);
 }
 
 void xsalsa20_reset_impl(void)
 {
-    xsalsa20_setup_impl = NULL;
-    xsalsa20_crypt_impl = NULL;
-    xsalsa20_keystream_impl = NULL;
-    xsalsa20_memory_impl = NULL;
+    int policy = xsalsa20_get_impl_policy();
+    int no_zmm = (policy & XSALSA_POLICY_NO_ZMM) ? 1 : 0;
+    bool forced = xsalsa20_impl_forced();
+    int pending = 0, tier;
+
+    if ((policy & XSALSA_POLICY_ADAPTIVE) && !forced) {
+        if (load_acquire(&adaptive_ready[no_zmm])) {
+            store_release(&adaptive_pending, 0);
+            impl_store(&impl_current, &impl_adaptive[no_zmm]);
+            XSALSA_PROBE4(select, impl_adaptive[no_zmm].id, policy, (int)forced, 2);
+            return;
+        }
+        pending = 1;  /* calibrated on first use */
+    }
+    tier = best_tier();
+    impl_store(&impl_current, &impl_table[tier]);
+    store_release(&adaptive_pending, pending);
+    XSALSA_PROBE4(select, tier, policy, (int)forced, pending);
+}
+
+
+int xsalsa20_get_size_class_impl(unsigned long len)
+{
+    return current_impl()->class_id[size_class(len)];
 }
 
 
@@ -54,8 +445,48 @@ int xsalsa20_setup(xsalsa20_state *st,
                    const unsigned char *nonce, unsigned long noncelen,
                    int rounds)
 {
-    init_impl();
-    return xsalsa20_setup_impl(st, key, keylen, nonce, noncelen, rounds);
+    const struct xsalsa20_impl *impl = current_impl();
+    int err = impl->setup(st, key, keylen, nonce, noncelen, rounds);
+
+    if (st != NULL) st->impl = (err == XSALSA_OK) ? impl_for_rounds(impl, st->rounds) : NULL;
+    XSALSA_PROBE4(setup, st, impl->id, rounds, err);
+    return err;
+}
+
+
+/* Set up count contexts with one table and pin it into each */
+static int setup_batch(xsalsa20_state *st, unsigned long count,
+                       const unsigned char *keys, unsigned long keystride, unsigned long keylen,
+                       const unsigned char *nonces, unsigned long noncelen,
+                       int rounds)
+{
+    const struct xsalsa20_impl *impl = current_impl();
+    unsigned long i;
+    int err = impl->setup_batch(st, count, keys, keystride, keylen, nonces, noncelen, rounds);
+
+    if (st != NULL) {
+        for (i = 0; i < count; i++) st[i].impl = (err == XSALSA_OK) ? impl_for_rounds(impl, st[i].rounds) : NULL;
+    }
+    XSALSA_PROBE5(setup_batch, st, count, impl->id, rounds, err);
+    return err;
+}
+
+
+int xsalsa20_setup_batch(xsalsa20_state *st, unsigned long count,
+                         const unsigned char *key, unsigned long keylen,
+                         const unsigned char *nonces, unsigned long noncelen,
+                         int rounds)
+{
+    return setup_batch(st, count, key, 0, keylen, nonces, noncelen, rounds);
+}
+
+
+int xsalsa20_setup_batch_keys(xsalsa20_state *st, unsigned long count,
+                              const unsigned char *keys, unsigned long keylen,
+                              const unsigned char *nonces, unsigned long noncelen,
+                              int rounds)
+{
+    return setup_batch(st, count, keys, keylen, keylen, nonces, noncelen, rounds);
 }
 
 
@@ -63,16 +494,59 @@ int xsalsa20_crypt(xsalsa20_state *st,
                    const unsigned char *in, unsigned long inlen, 
                    unsigned char *out)
 {
-    init_impl();
-    return xsalsa20_crypt_impl(st, in, inlen, out);
+    const struct xsalsa20_impl *impl = STATE_IMPL(st);
+    int c = size_class(inlen);
+    int err;
+
+    XSALSA_PROBE3(crypt_entry, st, inlen, impl->class_id[c]);
+    err = impl->crypt_class[c](st, in, inlen, out);
+    XSALSA_PROBE4(crypt_return, st, inlen, impl->class_id[c], err);
+    return err;
+}
+
+
+int xsalsa20_crypt_multi(xsalsa20_job *jobs, unsigned long count)
+{
+    const struct xsalsa20_impl *impl;
+    unsigned long start, end;
+    int err = XSALSA_OK, e;
+
+    if (count == 0) return XSALSA_OK; /* nothing to do */
+
+    XSALSA_ARGCHK(jobs != NULL);
+
+    /* Each run of consecutive jobs pinned to the same tier goes through that tier's kernel */
+    for (start = 0; start < count; start = end) {
+        impl = STATE_IMPL(jobs[start].st);
+        for (end = start + 1; end < count && STATE_IMPL(jobs[end].st)->crypt_multi == impl->crypt_multi; end++) {
+        }
+        e = impl->crypt_multi(jobs + start, end - start);
+        if (err == XSALSA_OK) err = e;
+    }
+    return err;
+}
+
+
+int xsalsa20_crypt_batch(const unsigned char *key, unsigned long keylen,
+                         const unsigned char *nonces, unsigned long noncelen,
+                         int rounds, unsigned long count,
+                         const unsigned char *const *in, const unsigned long *inlen,
+                         unsigned char *const *out)
+{
+    return current_impl()->crypt_batch(key, keylen, nonces, noncelen, rounds, count, in, inlen, out);
 }
 
 
 int xsalsa20_keystream(xsalsa20_state *st, 
                        unsigned char *out, unsigned long outlen)
 {
-    init_impl();
-    return xsalsa20_keystream_impl(st, out, outlen);
+    const struct xsalsa20_impl *impl = STATE_IMPL(st);
+    int err;
+
+    XSALSA_PROBE3(keystream_entry, st, outlen, impl->id);
+    err = impl->keystream(st, out, outlen);
+    XSALSA_PROBE4(keystream_return, st, outlen, impl->id, err);
+    return err;
 }
 
 
@@ -82,12 +556,73 @@ int xsalsa20_memory(const unsigned char *key, unsigned long keylen,
                     const unsigned char *datain, unsigned long datalen,
                     unsigned char *dataout)
 {
-    init_impl();
-    return xsalsa20_memory_impl(key, keylen, nonce, noncelen, rounds, 
-                                datain, datalen, dataout);
+    xsalsa20_memory_fn memory = current_impl()->memory_class[size_class(datalen)];
+
+    return memory(key, keylen, nonce, noncelen, rounds, datain, datalen, dataout);
+}
+
+
+
+
+void xsalsa20_poly1305_blocks(xsalsa20_poly1305_state *st, const unsigned char *in, unsigned long inlen)
+{
+    current_impl()->poly1305_blocks(st, in, inlen);
+}
+
+xsalsa20_poly1305_blocks_fn xsalsa20_poly1305_blocks_for(const xsalsa20_state *st, unsigned long len)
+{
+    return impl_table[STATE_IMPL(st)->class_id[size_class(len)]].poly1305_blocks;
+}
+
+int xsalsa20_seek(xsalsa20_state *st, ulong64 offset)
+{
+    unsigned char buf[64];
+    unsigned long rem = (unsigned long)(offset & 63);
+    ulong64 block = offset >> 6;
+    int err;
+
+    XSALSA_ARGCHK(st        != NULL);
+    XSALSA_ARGCHK(st->ivlen == 24);
+
+    st->input[8] = (ulong32)block;
+    st->input[9] = (ulong32)(block >> 32);
+    st->ksleft = 0;
+    if (rem == 0) return XSALSA_OK;
+
+    /* Mid-block: generate the block and drop the bytes before offset */
+    err = STATE_IMPL(st)->keystream(st, buf, rem);
+    zeromem(buf, sizeof(buf));
+    return err;
 }
 
 
+ulong64 xsalsa20_tell(const xsalsa20_state *st)
+{
+    ulong64 block;
+
+    if (st == NULL) return 0;
+    block = ((ulong64)st->input[9] << 32) | st->input[8];
+    return (block << 6) - st->ksleft;
+}
+
+
+int xsalsa20_crypt_at(const xsalsa20_state *st, ulong64 offset,
+                      const unsigned char *in, unsigned long inlen,
+                      unsigned char *out)
+{
+    xsalsa20_state tmp;
+    int err;
+
+    XSALSA_ARGCHK(st != NULL);
+
+    tmp = *st;
+    if ((err = xsalsa20_seek(&tmp, offset)) == XSALSA_OK) {
+        err = xsalsa20_crypt(&tmp, in, inlen, out);
+    }
+    xsalsa20_done(&tmp);
+    return err;
+}
+
 void xsalsa20_done(xsalsa20_state *st)
 {
     if (st != NULL) {
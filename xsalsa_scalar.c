@@ -1,4 +1,6 @@
 #include "xsalsa.h"
+#include "xsalsa_stats.h"
+#include "xsalsa_rounds.h"
 #include <string.h>
 
 /* Internal macros and definitions */
@@ -83,14 +85,15 @@ void s_xsalsa20_doubleround(ulong32 *x, int rounds)
    }
 }
 
-/* Internal function: Salsa20 block generation */
-static void s_salsa20_block(unsigned char *output, const ulong32 *input, int rounds)
+/* Internal function: Salsa20 block generation, XOR-ed with in (or stored as-is when in is NULL) */
+static XSALSA_INLINE void s_salsa20_block(unsigned char *output, const unsigned char *in,
+                                          const ulong32 *input, int rounds)
 {
-   ulong32 x[16];
+   ulong32 x[16], w;
    int i;
    memcpy((void*)x, (const void*)input, sizeof(x));
    
-   for (i = rounds; i > 0; i -= 2) {
+   XSALSA_ROUNDS(rounds,
       QUARTERROUND( 0, 4, 8,12)
       QUARTERROUND( 5, 9,13, 1)
       QUARTERROUND(10,14, 2, 6)
@@ -99,10 +102,14 @@ static void s_salsa20_block(unsigned char *output, const ulong32 *input, int rou
       QUARTERROUND( 5, 6, 7, 4)
       QUARTERROUND(10,11, 8, 9)
       QUARTERROUND(15,12,13,14)
-   }
+   );
    
    for (i = 0; i < 16; ++i) {
      x[i] += input[i];
+     if (in != NULL) {
+       LOAD32L(w, in + 4 * i);
+       x[i] ^= w;
+     }
      STORE32L(x[i], output + 4 * i);
    }
 }
@@ -190,6 +197,7 @@ int xsalsa20_setup_scalar(xsalsa20_state *st, const unsigned char *key, unsigned
    st->rounds = rounds;
    st->ksleft = 0;
    st->ivlen  = 24;           /* set switch to say nonce/IV has been loaded */
+   XSALSA_STAT_ADD(XSALSA_IMPL_SCALAR, setups, 1);
 
    zeromem(x, sizeof(x));
    zeromem(subkey, sizeof(subkey));
@@ -197,17 +205,54 @@ int xsalsa20_setup_scalar(xsalsa20_state *st, const unsigned char *key, unsigned
    return XSALSA_OK;
 }
 
+/**
+   Initialize several XSalsa20 contexts at once
+   @param st        [out] The destinations of the XSalsa20 states (count entries)
+   @param count     The number of contexts to initialize
+   @param keys      The secret key(s)
+   @param keystride The distance between consecutive keys (0 to share one key)
+   @param keylen    The length of each secret key, must be 32 (octets)
+   @param nonces    The nonces, count * 24 octets back to back
+   @param noncelen  The length of each nonce, must be 24 (octets)
+   @param rounds    Number of rounds (must be evenly divisible by 2, default is 20)
+   @return XSALSA_OK if successful
+*/
+int xsalsa20_setup_batch_scalar(xsalsa20_state *st, unsigned long count,
+                                const unsigned char *keys, unsigned long keystride, unsigned long keylen,
+                                const unsigned char *nonces, unsigned long noncelen,
+                                int rounds)
+{
+   unsigned long n;
+   int err;
+
+   if (count == 0) return XSALSA_OK; /* nothing to do */
+
+   XSALSA_ARGCHK(st        != NULL);
+   XSALSA_ARGCHK(keys      != NULL);
+   XSALSA_ARGCHK(nonces    != NULL);
+
+   for (n = 0; n < count; n++) {
+      if ((err = xsalsa20_setup_scalar(st + n, keys + n * keystride, keylen,
+                                       nonces + n * 24, noncelen, rounds)) != XSALSA_OK) {
+         return err;
+      }
+   }
+
+   return XSALSA_OK;
+}
+
 /**
    Encrypt (or decrypt) bytes of ciphertext (or plaintext) with XSalsa20
    @param st      The XSalsa20 state
    @param in      The plaintext (or ciphertext)
    @param inlen   The length of the input (octets)
    @param out     [out] The ciphertext (or plaintext), length inlen
+   @param rounds  The number of rounds (a constant in the _r8/_r12/_r20 entry points)
    @return XSALSA_OK if successful
 */
-int xsalsa20_crypt_scalar(xsalsa20_state *st, const unsigned char *in, unsigned long inlen, unsigned char *out)
+static XSALSA_INLINE int s_xsalsa20_crypt_scalar(xsalsa20_state *st, const unsigned char *in, unsigned long inlen,
+                                                 unsigned char *out, int rounds)
 {
-   unsigned char buf[64];
    unsigned long i, j;
 
    if (inlen == 0) return XSALSA_OK; /* nothing to do */
@@ -216,30 +261,101 @@ int xsalsa20_crypt_scalar(xsalsa20_state *st, const unsigned char *in, unsigned
    XSALSA_ARGCHK(in        != NULL);
    XSALSA_ARGCHK(out       != NULL);
    XSALSA_ARGCHK(st->ivlen == 24);
+   XSALSA_STAT_CALL(XSALSA_IMPL_SCALAR, inlen);
 
    if (st->ksleft > 0) {
       j = MIN(st->ksleft, inlen);
+      XSALSA_STAT_ADD(XSALSA_IMPL_SCALAR, drain_bytes, j);
       for (i = 0; i < j; ++i, st->ksleft--) out[i] = in[i] ^ st->kstream[64 - st->ksleft];
       inlen -= j;
       if (inlen == 0) return XSALSA_OK;
       out += j;
       in  += j;
    }
-   for (;;) {
-     s_salsa20_block(buf, st->input, st->rounds);
+   XSALSA_STAT_ADD(XSALSA_IMPL_SCALAR, tail_blocks, (inlen + 63) / 64);
+   /* Whole blocks go straight to out; the keystream of a final partial block
+      goes to st->kstream, which keeps the part left unused */
+   while (inlen >= 64) {
+     s_salsa20_block(out, in, st->input, rounds);
      /* XSalsa20: 64-bit counter, increment 64-bit counter */
-     if (0 == ++st->input[8] && 0 == ++st->input[9]) return XSALSA_OVERFLOW;
-     if (inlen <= 64) {
-       for (i = 0; i < inlen; ++i) out[i] = in[i] ^ buf[i];
-       st->ksleft = 64 - inlen;
-       for (i = inlen; i < 64; ++i) st->kstream[i] = buf[i];
-       return XSALSA_OK;
-     }
-     for (i = 0; i < 64; ++i) out[i] = in[i] ^ buf[i];
+     if (0 == ++st->input[8] && 0 == ++st->input[9]) return XSALSA_STAT_OVERFLOW(XSALSA_IMPL_SCALAR);
      inlen -= 64;
      out += 64;
      in  += 64;
    }
+   if (inlen == 0) return XSALSA_OK;   /* ended on a block boundary, nothing to buffer */
+
+   s_salsa20_block(st->kstream, NULL, st->input, rounds);
+   if (0 == ++st->input[8] && 0 == ++st->input[9]) return XSALSA_STAT_OVERFLOW(XSALSA_IMPL_SCALAR);
+   for (i = 0; i < inlen; ++i) out[i] = in[i] ^ st->kstream[i];
+   st->ksleft = 64 - inlen;
+   return XSALSA_OK;
+}
+
+XSALSA_CRYPT_ENTRIES(scalar)
+
+/**
+   Encrypt (or decrypt) several independent streams
+   @param jobs    The jobs (state, input, length, output)
+   @param count   The number of jobs
+   @return XSALSA_OK if successful, otherwise the first error met by a job
+*/
+int xsalsa20_crypt_multi_scalar(xsalsa20_job *jobs, unsigned long count)
+{
+   unsigned long n;
+   int err = XSALSA_OK, e;
+
+   if (count == 0) return XSALSA_OK; /* nothing to do */
+
+   XSALSA_ARGCHK(jobs != NULL);
+
+   for (n = 0; n < count; n++) {
+      e = xsalsa20_crypt_scalar(jobs[n].st, jobs[n].in, jobs[n].inlen, jobs[n].out);
+      if (err == XSALSA_OK) err = e;
+   }
+
+   return err;
+}
+
+/**
+   Encrypt (or decrypt) a batch of packets that share one key
+   @param key       The secret key shared by every packet
+   @param keylen    The length of the secret key, must be 32 (octets)
+   @param nonces    The nonces, count * 24 octets back to back
+   @param noncelen  The length of each nonce, must be 24 (octets)
+   @param rounds    Number of rounds (must be evenly divisible by 2, default is 20)
+   @param count     The number of packets
+   @param in        The input of every packet
+   @param inlen     The length of every packet (octets)
+   @param out       [out] The output of every packet, length inlen[n]
+   @return XSALSA_OK if successful, otherwise the first error met by a packet
+*/
+int xsalsa20_crypt_batch_scalar(const unsigned char *key, unsigned long keylen,
+                                const unsigned char *nonces, unsigned long noncelen,
+                                int rounds, unsigned long count,
+                                const unsigned char *const *in, const unsigned long *inlen,
+                                unsigned char *const *out)
+{
+   xsalsa20_state st;
+   unsigned long n;
+   int err = XSALSA_OK, e;
+
+   if (count == 0) return XSALSA_OK; /* nothing to do */
+
+   XSALSA_ARGCHK(key       != NULL);
+   XSALSA_ARGCHK(nonces    != NULL);
+   XSALSA_ARGCHK(in        != NULL);
+   XSALSA_ARGCHK(inlen     != NULL);
+   XSALSA_ARGCHK(out       != NULL);
+
+   for (n = 0; n < count; n++) {
+      e = xsalsa20_setup_scalar(&st, key, keylen, nonces + n * noncelen, noncelen, rounds);
+      if (e == XSALSA_OK) e = xsalsa20_crypt_scalar(&st, in[n], inlen[n], out[n]);
+      if (err == XSALSA_OK) err = e;
+   }
+
+   xsalsa20_done(&st);
+   return err;
 }
 
 /**
@@ -247,11 +363,12 @@ int xsalsa20_crypt_scalar(xsalsa20_state *st, const unsigned char *in, unsigned
    @param st      The XSalsa20 state
    @param out     [out] The keystream output
    @param outlen  The number of keystream bytes to generate
+   @param rounds  The number of rounds (a constant in the _r8/_r12/_r20 entry points)
    @return XSALSA_OK if successful
 */
-int xsalsa20_keystream_scalar(xsalsa20_state *st, unsigned char *out, unsigned long outlen)
+static XSALSA_INLINE int s_xsalsa20_keystream_scalar(xsalsa20_state *st, unsigned char *out, unsigned long outlen,
+                                                     int rounds)
 {
-   unsigned char buf[64];
    unsigned long i, j;
 
    if (outlen == 0) return XSALSA_OK; /* nothing to do */
@@ -259,30 +376,37 @@ int xsalsa20_keystream_scalar(xsalsa20_state *st, unsigned char *out, unsigned l
    XSALSA_ARGCHK(st        != NULL);
    XSALSA_ARGCHK(out       != NULL);
    XSALSA_ARGCHK(st->ivlen == 24);
+   XSALSA_STAT_CALL(XSALSA_IMPL_SCALAR, outlen);
 
    if (st->ksleft > 0) {
       j = MIN(st->ksleft, outlen);
+      XSALSA_STAT_ADD(XSALSA_IMPL_SCALAR, drain_bytes, j);
       for (i = 0; i < j; ++i, st->ksleft--) out[i] = st->kstream[64 - st->ksleft];
       outlen -= j;
       if (outlen == 0) return XSALSA_OK;
       out += j;
    }
-   for (;;) {
-     s_salsa20_block(buf, st->input, st->rounds);
+   XSALSA_STAT_ADD(XSALSA_IMPL_SCALAR, tail_blocks, (outlen + 63) / 64);
+   /* Whole blocks go straight to out; the keystream of a final partial block
+      goes to st->kstream, which keeps the part left unused */
+   while (outlen >= 64) {
+     s_salsa20_block(out, NULL, st->input, rounds);
      /* XSalsa20: 64-bit counter, increment 64-bit counter */
-     if (0 == ++st->input[8] && 0 == ++st->input[9]) return XSALSA_OVERFLOW;
-     if (outlen <= 64) {
-       for (i = 0; i < outlen; ++i) out[i] = buf[i];
-       st->ksleft = 64 - outlen;
-       for (i = outlen; i < 64; ++i) st->kstream[i] = buf[i];
-       return XSALSA_OK;
-     }
-     for (i = 0; i < 64; ++i) out[i] = buf[i];
+     if (0 == ++st->input[8] && 0 == ++st->input[9]) return XSALSA_STAT_OVERFLOW(XSALSA_IMPL_SCALAR);
      outlen -= 64;
      out += 64;
    }
+   if (outlen == 0) return XSALSA_OK;   /* ended on a block boundary, nothing to buffer */
+
+   s_salsa20_block(st->kstream, NULL, st->input, rounds);
+   if (0 == ++st->input[8] && 0 == ++st->input[9]) return XSALSA_STAT_OVERFLOW(XSALSA_IMPL_SCALAR);
+   for (i = 0; i < outlen; ++i) out[i] = st->kstream[i];
+   st->ksleft = 64 - outlen;
+   return XSALSA_OK;
 }
 
+XSALSA_KEYSTREAM_ENTRIES(scalar)
+
 
 
 /**
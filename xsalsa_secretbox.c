@@ -0,0 +1,131 @@
+#include "xsalsa.h"
+#include "xsalsa_poly1305_impl.h"
+
+#define XSALSA_ARGCHK(x) do { if (!(x)) return XSALSA_INVALID_ARG; } while(0)
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+/* Bytes encrypted per step before they are MACed; small enough that the
+   ciphertext is still in L1 when Poly1305 reads it back, and a multiple
+   of every kernel's bulk step so the wide path is never cut short */
+#define XSALSA_SECRETBOX_CHUNK 4096UL
+
+/* Internal function: Zero memory */
+static void zeromem(volatile void *out, size_t outlen)
+{
+    volatile unsigned char *x = (volatile unsigned char *)out;
+    while (outlen--) *x++ = 0;
+}
+
+/* Internal function: set up the stream and derive the Poly1305 key from
+   the first 32 keystream bytes; the other 32 bytes of block 0 stay
+   buffered and cover the start of the message */
+static int s_secretbox_setup(xsalsa20_state *st, xsalsa20_poly1305_state *poly,
+                             const unsigned char *key, unsigned long keylen,
+                             const unsigned char *nonce, unsigned long noncelen)
+{
+    unsigned char polykey[32];
+    int err;
+
+    if ((err = xsalsa20_setup(st, key, keylen, nonce, noncelen, 20)) != XSALSA_OK) {
+        return err;
+    }
+    if ((err = xsalsa20_keystream(st, polykey, sizeof(polykey))) != XSALSA_OK) {
+        xsalsa20_done(st);
+        return err;
+    }
+    xsalsa20_poly1305_init(poly, polykey);
+    zeromem(polykey, sizeof(polykey));
+    return XSALSA_OK;
+}
+
+/* Internal function: step through the message, crypting one chunk and
+   absorbing its ciphertext while it is still hot; the MAC of every chunk
+   runs on the tier the context's pinned table crypts that chunk with */
+static int s_secretbox_crypt(xsalsa20_state *st, xsalsa20_poly1305_state *poly,
+                             const unsigned char *in, unsigned long inlen,
+                             unsigned char *out, int decrypt)
+{
+    xsalsa20_poly1305_blocks_fn blocks;
+    unsigned long n;
+    int err;
+
+    /* The first chunk also drains the 32 buffered bytes of block 0, so
+       every later chunk starts on a block boundary */
+    n = MIN(inlen, XSALSA_SECRETBOX_CHUNK + 32);
+    while (inlen > 0) {
+        blocks = xsalsa20_poly1305_blocks_for(st, n);
+        if (decrypt) xsalsa20_poly1305_update_with(poly, in, n, blocks);
+        if ((err = xsalsa20_crypt(st, in, n, out)) != XSALSA_OK) {
+            return err;
+        }
+        if (!decrypt) xsalsa20_poly1305_update_with(poly, out, n, blocks);
+        inlen -= n;
+        in += n;
+        out += n;
+        n = MIN(inlen, XSALSA_SECRETBOX_CHUNK);
+    }
+    return XSALSA_OK;
+}
+
+
+int xsalsa20_secretbox(const unsigned char *key, unsigned long keylen,
+                       const unsigned char *nonce, unsigned long noncelen,
+                       const unsigned char *in, unsigned long inlen,
+                       unsigned char *out, unsigned char *tag)
+{
+    xsalsa20_state st;
+    xsalsa20_poly1305_state poly;
+    int err;
+
+    XSALSA_ARGCHK(key   != NULL);
+    XSALSA_ARGCHK(nonce != NULL);
+    XSALSA_ARGCHK(tag   != NULL);
+    XSALSA_ARGCHK(inlen == 0 || (in != NULL && out != NULL));
+
+    if ((err = s_secretbox_setup(&st, &poly, key, keylen, nonce, noncelen)) != XSALSA_OK) {
+        return err;
+    }
+    err = s_secretbox_crypt(&st, &poly, in, inlen, out, 0);
+    xsalsa20_poly1305_finish(&poly, tag);
+    xsalsa20_done(&st);
+    if (err != XSALSA_OK) zeromem(tag, 16);
+    return err;
+}
+
+
+int xsalsa20_secretbox_open(const unsigned char *key, unsigned long keylen,
+                            const unsigned char *nonce, unsigned long noncelen,
+                            const unsigned char *in, unsigned long inlen,
+                            const unsigned char *tag, unsigned char *out)
+{
+    xsalsa20_state st;
+    xsalsa20_poly1305_state poly;
+    unsigned char mac[16];
+    unsigned char diff = 0;
+    unsigned long i;
+    int err;
+
+    XSALSA_ARGCHK(key   != NULL);
+    XSALSA_ARGCHK(nonce != NULL);
+    XSALSA_ARGCHK(tag   != NULL);
+    XSALSA_ARGCHK(inlen == 0 || (in != NULL && out != NULL));
+
+    if ((err = s_secretbox_setup(&st, &poly, key, keylen, nonce, noncelen)) != XSALSA_OK) {
+        return err;
+    }
+    err = s_secretbox_crypt(&st, &poly, in, inlen, out, 1);
+    xsalsa20_poly1305_finish(&poly, mac);
+    xsalsa20_done(&st);
+
+    /* Constant-time tag comparison */
+    for (i = 0; i < 16; i++) diff |= (unsigned char)(mac[i] ^ tag[i]);
+    zeromem(mac, sizeof(mac));
+
+    if (err == XSALSA_OK && diff != 0) err = XSALSA_AUTH_FAILED;
+    if (err != XSALSA_OK && inlen > 0) {
+        /* Never release plaintext that failed authentication */
+        zeromem(out, inlen);
+    }
+    return err;
+}
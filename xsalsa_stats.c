@@ -0,0 +1,186 @@
+#include "xsalsa.h"
+#include "xsalsa_stats.h"
+#include <string.h>
+
+#ifdef XSALSA_ENABLE_STATS
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+#endif
+
+#define XSALSA_ARGCHK(x) do { if (!(x)) return XSALSA_INVALID_ARG; } while(0)
+
+#ifdef XSALSA_ENABLE_STATS
+
+XSALSA_TLS xsalsa20_stats_tls xsalsa20_stats_local;
+
+/* Counter blocks of live threads, the sum of the threads that have exited, and
+   the total at the last xsalsa20_reset_stats (reported counts are relative to it,
+   so a reset never writes counters that other threads own) */
+static xsalsa20_stats_tls *stats_threads = NULL;
+static xsalsa20_stats stats_retired;
+static xsalsa20_stats stats_base;
+
+#ifdef _WIN32
+static SRWLOCK stats_lock = SRWLOCK_INIT;
+#define stats_acquire() AcquireSRWLockExclusive(&stats_lock)
+#define stats_release() ReleaseSRWLockExclusive(&stats_lock)
+static INIT_ONCE stats_once = INIT_ONCE_STATIC_INIT;
+static DWORD stats_key = FLS_OUT_OF_INDEXES;
+#else
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+#define stats_acquire() pthread_mutex_lock(&stats_lock)
+#define stats_release() pthread_mutex_unlock(&stats_lock)
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+static pthread_key_t stats_key;
+#endif
+
+/* Add src, which its thread may still be counting into, to dst (private or under stats_lock) */
+static void stats_add(xsalsa20_stats *dst, const xsalsa20_stats *src)
+{
+    int i;
+
+    for (i = XSALSA_IMPL_SCALAR; i <= XSALSA_IMPL_AVX512VL; i++) {
+        dst->impl[i].calls       += XSALSA_STAT_LOAD(&src->impl[i].calls);
+        dst->impl[i].bytes       += XSALSA_STAT_LOAD(&src->impl[i].bytes);
+        dst->impl[i].drain_bytes += XSALSA_STAT_LOAD(&src->impl[i].drain_bytes);
+        dst->impl[i].bulk_blocks += XSALSA_STAT_LOAD(&src->impl[i].bulk_blocks);
+        dst->impl[i].tail_blocks += XSALSA_STAT_LOAD(&src->impl[i].tail_blocks);
+        dst->impl[i].setups      += XSALSA_STAT_LOAD(&src->impl[i].setups);
+        dst->impl[i].overflows   += XSALSA_STAT_LOAD(&src->impl[i].overflows);
+    }
+}
+
+/* Total of all threads; stats_lock must be held */
+static void stats_total(xsalsa20_stats *dst)
+{
+    const xsalsa20_stats_tls *t;
+
+    *dst = stats_retired;
+    for (t = stats_threads; t != NULL; t = t->next) {
+        stats_add(dst, &t->s);
+    }
+}
+
+static ulong64 stats_since(ulong64 v, ulong64 base)
+{
+    return v > base ? v - base : 0;
+}
+
+/* dst -= base, per counter; a count below base (a thread restored its own
+   counters across a reset, see calibrate_measure) reads as 0 */
+static void stats_sub(xsalsa20_stats *dst, const xsalsa20_stats *base)
+{
+    int i;
+
+    for (i = XSALSA_IMPL_SCALAR; i <= XSALSA_IMPL_AVX512VL; i++) {
+        dst->impl[i].calls       = stats_since(dst->impl[i].calls,       base->impl[i].calls);
+        dst->impl[i].bytes       = stats_since(dst->impl[i].bytes,       base->impl[i].bytes);
+        dst->impl[i].drain_bytes = stats_since(dst->impl[i].drain_bytes, base->impl[i].drain_bytes);
+        dst->impl[i].bulk_blocks = stats_since(dst->impl[i].bulk_blocks, base->impl[i].bulk_blocks);
+        dst->impl[i].tail_blocks = stats_since(dst->impl[i].tail_blocks, base->impl[i].tail_blocks);
+        dst->impl[i].setups      = stats_since(dst->impl[i].setups,      base->impl[i].setups);
+        dst->impl[i].overflows   = stats_since(dst->impl[i].overflows,   base->impl[i].overflows);
+    }
+}
+
+void xsalsa20_stats_copy(xsalsa20_stats *dst, const xsalsa20_stats *src)
+{
+    int i;
+
+    for (i = XSALSA_IMPL_SCALAR; i <= XSALSA_IMPL_AVX512VL; i++) {
+        XSALSA_STAT_STORE(&dst->impl[i].calls,       XSALSA_STAT_LOAD(&src->impl[i].calls));
+        XSALSA_STAT_STORE(&dst->impl[i].bytes,       XSALSA_STAT_LOAD(&src->impl[i].bytes));
+        XSALSA_STAT_STORE(&dst->impl[i].drain_bytes, XSALSA_STAT_LOAD(&src->impl[i].drain_bytes));
+        XSALSA_STAT_STORE(&dst->impl[i].bulk_blocks, XSALSA_STAT_LOAD(&src->impl[i].bulk_blocks));
+        XSALSA_STAT_STORE(&dst->impl[i].tail_blocks, XSALSA_STAT_LOAD(&src->impl[i].tail_blocks));
+        XSALSA_STAT_STORE(&dst->impl[i].setups,      XSALSA_STAT_LOAD(&src->impl[i].setups));
+        XSALSA_STAT_STORE(&dst->impl[i].overflows,   XSALSA_STAT_LOAD(&src->impl[i].overflows));
+    }
+}
+
+/* Thread exit: fold the thread's counters into the retired sum before its block goes away */
+#ifdef _WIN32
+static void WINAPI stats_unlink(PVOID arg)
+#else
+static void stats_unlink(void *arg)
+#endif
+{
+    xsalsa20_stats_tls *t = (xsalsa20_stats_tls *)arg, **p;
+
+    if (t == NULL) return;
+    stats_acquire();
+    for (p = &stats_threads; *p != NULL; p = &(*p)->next) {
+        if (*p == t) {
+            *p = t->next;
+            break;
+        }
+    }
+    stats_add(&stats_retired, &t->s);
+    stats_release();
+    t->linked = 0;
+}
+
+#ifdef _WIN32
+static BOOL CALLBACK stats_init(PINIT_ONCE once, PVOID param, PVOID *ctx)
+{
+    (void)once; (void)param; (void)ctx;
+    stats_key = FlsAlloc(stats_unlink);
+    return TRUE;
+}
+#else
+static void stats_init(void)
+{
+    pthread_key_create(&stats_key, stats_unlink);
+}
+#endif
+
+int xsalsa20_stats_link(void)
+{
+    xsalsa20_stats_tls *t = &xsalsa20_stats_local;
+
+#ifdef _WIN32
+    InitOnceExecuteOnce(&stats_once, stats_init, NULL, NULL);
+    if (stats_key != FLS_OUT_OF_INDEXES) FlsSetValue(stats_key, t);
+#else
+    pthread_once(&stats_once, stats_init);
+    pthread_setspecific(stats_key, t);
+#endif
+    stats_acquire();
+    t->next = stats_threads;
+    stats_threads = t;
+    t->linked = 1;
+    stats_release();
+    return 1;
+}
+
+#endif /* XSALSA_ENABLE_STATS */
+
+
+int xsalsa20_get_stats(xsalsa20_stats *stats)
+{
+    XSALSA_ARGCHK(stats != NULL);
+
+#ifdef XSALSA_ENABLE_STATS
+    stats_acquire();
+    stats_total(stats);
+    stats_sub(stats, &stats_base);
+    stats_release();
+    return XSALSA_OK;
+#else
+    memset(stats, 0, sizeof(*stats));
+    return XSALSA_ERROR;
+#endif
+}
+
+
+void xsalsa20_reset_stats(void)
+{
+#ifdef XSALSA_ENABLE_STATS
+    stats_acquire();
+    stats_total(&stats_base);
+    stats_release();
+#endif
+}
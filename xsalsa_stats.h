@@ -0,0 +1,78 @@
+#ifndef XSALSA_STATS_H
+#define XSALSA_STATS_H
+
+#include "xsalsa.h"
+
+/* Hot-path counters (CMake option ENABLE_STATS, which defines XSALSA_ENABLE_STATS).
+   Each kernel counts into a block owned by the calling thread, so counting takes
+   no lock and shares no cache line; xsalsa20_get_stats sums the blocks of all
+   threads. Without XSALSA_ENABLE_STATS the macros expand to nothing and their
+   arguments are never evaluated. */
+#ifdef XSALSA_ENABLE_STATS
+
+#if defined(_MSC_VER)
+#define XSALSA_TLS __declspec(thread)
+#else
+#define XSALSA_TLS _Thread_local
+#endif
+
+/* Counter access: only the owning thread writes its counters, while
+   xsalsa20_get_stats reads them, so every access is a relaxed atomic load or
+   store (plain moves on x86-64, no torn 64-bit values on 32-bit targets). An
+   add reads its own counter plainly and stores the sum: no locked instruction */
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define XSALSA_STAT_LOAD(p)         ((ulong64)__iso_volatile_load64((const volatile __int64 *)(p)))
+#define XSALSA_STAT_STORE(p, v)     __iso_volatile_store64((volatile __int64 *)(p), (__int64)(v))
+#else
+#define XSALSA_STAT_LOAD(p)         __atomic_load_n((p), __ATOMIC_RELAXED)
+#define XSALSA_STAT_STORE(p, v)     __atomic_store_n((p), (ulong64)(v), __ATOMIC_RELAXED)
+#endif
+
+/* Counters of one thread */
+typedef struct xsalsa20_stats_tls {
+    xsalsa20_stats s;
+    int linked;                       /* Registered with xsalsa20_get_stats */
+    struct xsalsa20_stats_tls *next;  /* Next registered thread */
+} xsalsa20_stats_tls;
+
+extern XSALSA_TLS xsalsa20_stats_tls xsalsa20_stats_local;
+
+/**
+ * Register the calling thread's counters (done on its first count)
+ * @return 1
+ */
+int xsalsa20_stats_link(void);
+
+/**
+ * Copy counters field by field with relaxed atomics (the calling thread's own
+ * counters, or private ones, may be the destination)
+ * @param dst  [out] The destination counters
+ * @param src  The source counters
+ */
+void xsalsa20_stats_copy(xsalsa20_stats *dst, const xsalsa20_stats *src);
+
+#define XSALSA_STAT_ADD(tier, field, n) \
+    ((void)(xsalsa20_stats_local.linked || xsalsa20_stats_link()), \
+     XSALSA_STAT_STORE(&xsalsa20_stats_local.s.impl[tier].field, \
+                       xsalsa20_stats_local.s.impl[tier].field + (ulong64)(n)))
+
+#else
+#define XSALSA_STAT_ADD(tier, field, n) ((void)0)
+#endif
+
+/* One crypt/keystream call (or multi-buffer job) of len bytes */
+#define XSALSA_STAT_CALL(tier, len) \
+    (XSALSA_STAT_ADD(tier, calls, 1), XSALSA_STAT_ADD(tier, bytes, len))
+
+/* len bytes left after the drain: whole steps go through the bulk loop,
+   the rest through the single-block loop */
+#define XSALSA_STAT_BLOCKS(tier, len, step) \
+    (XSALSA_STAT_ADD(tier, bulk_blocks, (len) / (step) * ((step) / 64)), \
+     XSALSA_STAT_ADD(tier, tail_blocks, ((len) % (step) + 63) / 64))
+
+/* Counter overflow: counts it and evaluates to XSALSA_OVERFLOW */
+#define XSALSA_STAT_OVERFLOW(tier) \
+    (XSALSA_STAT_ADD(tier, overflows, 1), XSALSA_OVERFLOW)
+
+#endif /* XSALSA_STATS_H */